@@ -18,6 +18,29 @@
 #include <intrin.h>
 #endif
 
+#if (SIMD >= SSE2) && (COMPILER != MSVC)
+// Skip mm_malloc.h, it drags in stdlib.h whose abs() clashes with ours.
+#define _MM_MALLOC_H_INCLUDED
+#define __MM_MALLOC_H
+#include <immintrin.h>
+#endif
+
+#if PLATFORM == WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if PLATFORM == LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 u32 f32_to_u32(f32 x) {
       return *((u32*)(&x));
 }
@@ -327,6 +350,201 @@ void decompress_rle(void* dst, void* src, sz size, sz decompressed_size) {
       }
 }
 
+#if PLATFORM == WIN32
+internal DWORD WINAPI thread_entry(LPVOID param) {
+      thread* t = (thread*)param;
+      t->proc(t->param);
+      return 0;
+}
+#else
+internal void* thread_entry(void* param) {
+      thread* t = (thread*)param;
+      t->proc(t->param);
+      return 0;
+}
+#endif
+
+b8x start_thread(thread* t, thread_proc* proc, void* param) {
+      t->proc = proc;
+      t->param = param;
+#if PLATFORM == WIN32
+      HANDLE handle = CreateThread(0, 0, thread_entry, t, 0, 0);
+      t->handle = (up)handle;
+      return handle != 0;
+#else
+      pthread_t handle;
+      b8x started = pthread_create(&handle, 0, thread_entry, t) == 0;
+      t->handle = (up)handle;
+      return started;
+#endif
+}
+
+void join_thread(thread* t) {
+#if PLATFORM == WIN32
+      WaitForSingleObject((HANDLE)t->handle, INFINITE);
+      CloseHandle((HANDLE)t->handle);
+#else
+      pthread_join((pthread_t)t->handle, 0);
+#endif
+      t->handle = 0;
+}
+
+b8x pin_thread(thread* t, u32 processor) {
+#if PLATFORM == WIN32
+      return SetThreadAffinityMask((HANDLE)t->handle, (DWORD_PTR)1 << processor) != 0;
+#elif PLATFORM == MACOS
+      return false; // Only affinity hints there.
+#else
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(processor, &set);
+      return pthread_setaffinity_np((pthread_t)t->handle, sizeof(set), &set) == 0;
+#endif
+}
+
+void yield_thread(void) {
+#if PLATFORM == WIN32
+      SwitchToThread();
+#else
+      sched_yield();
+#endif
+}
+
+void futex_wait(volatile u32* x, u32 value) {
+#if PLATFORM == WIN32
+      WaitOnAddress(x, &value, sizeof(value), INFINITE);
+#elif PLATFORM == LINUX
+      syscall(SYS_futex, x, FUTEX_WAIT_PRIVATE, value, 0, 0, 0);
+#else
+      if(atomic_load(x, MEMORY_RELAXED) == value) yield_thread();
+#endif
+}
+
+void futex_wake(volatile u32* x, u32 count) {
+#if PLATFORM == WIN32
+      if(count == 1) WakeByAddressSingle((void*)x);
+      else WakeByAddressAll((void*)x);
+#elif PLATFORM == LINUX
+      syscall(SYS_futex, x, FUTEX_WAKE_PRIVATE, (int)min(count, (u32)S32_MAX), 0, 0, 0);
+#endif
+}
+
+u32 get_processor_count(void) {
+#if PLATFORM == WIN32
+      SYSTEM_INFO info = {};
+      GetSystemInfo(&info);
+      return info.dwNumberOfProcessors;
+#else
+      return (u32)max(sysconf(_SC_NPROCESSORS_ONLN), 1l);
+#endif
+}
+
+u32 get_current_processor(void) {
+#if PLATFORM == WIN32
+      return GetCurrentProcessorNumber();
+#elif PLATFORM == LINUX
+      return (u32)max(sched_getcpu(), 0); // rseq or vDSO backed, no syscall.
+#else
+      global_variable volatile u32 next_thread;
+      thread_variable u32 number = U32_MAX;
+      if(number == U32_MAX) number = atomic_fetch_add(&next_thread, 1u, MEMORY_RELAXED) % get_processor_count();
+      return number;
+#endif
+}
+
+u64 read_timestamp(void) {
+#if (ARCHITECTURE == X64) || (ARCHITECTURE == X86)
+#if COMPILER == MSVC
+      return __rdtsc();
+#else
+      return __builtin_ia32_rdtsc();
+#endif
+#elif COMPILER == MSVC
+      return _ReadStatusReg(ARM64_CNTVCT);
+#else
+      u64 ticks;
+      __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+      return ticks;
+#endif
+}
+
+b8x open_file(file* f, char* path, u32 mode) {
+#if PLATFORM == WIN32
+      DWORD access = is_bit_set(mode, FILE_MODE_WRITE) ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+      DWORD creation = is_bit_set(mode, FILE_MODE_WRITE) ? CREATE_ALWAYS : OPEN_EXISTING;
+      HANDLE handle = CreateFileA(path, access, FILE_SHARE_READ, 0, creation, FILE_ATTRIBUTE_NORMAL, 0);
+      f->handle = (up)handle;
+      return handle != INVALID_HANDLE_VALUE;
+#else
+      int flags = is_bit_set(mode, FILE_MODE_WRITE) ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY;
+      int handle = open(path, flags, 0644);
+      f->handle = (up)handle;
+      return handle >= 0;
+#endif
+}
+
+void close_file(file* f) {
+#if PLATFORM == WIN32
+      CloseHandle((HANDLE)f->handle);
+#else
+      close((int)f->handle);
+#endif
+      f->handle = 0;
+}
+
+u64 get_file_size(file* f) {
+#if PLATFORM == WIN32
+      LARGE_INTEGER size = {};
+      GetFileSizeEx((HANDLE)f->handle, &size);
+      return (u64)size.QuadPart;
+#else
+      struct stat info = {};
+      fstat((int)f->handle, &info);
+      return (u64)info.st_size;
+#endif
+}
+
+sz read_file(file* f, void* dst, sz size, u64 offset) {
+      sz done = 0;
+      while(done < size) {
+            // Chunked, single calls are limited to 32 bits on win32 and to 2GB on linux.
+            sz chunk = min(size - done, (sz)gb(1));
+#if PLATFORM == WIN32
+            OVERLAPPED at = {};
+            at.Offset = (DWORD)(offset + done);
+            at.OffsetHigh = (DWORD)((offset + done) >> 32);
+            DWORD amount = 0;
+            if(!ReadFile((HANDLE)f->handle, (u8*)dst + done, (DWORD)chunk, &amount, &at)) amount = 0;
+#else
+            ssize_t amount = pread((int)f->handle, (u8*)dst + done, chunk, (off_t)(offset + done));
+#endif
+            if(amount <= 0) break;
+            done += (sz)amount;
+      }
+      
+      return done;
+}
+
+sz write_file(file* f, void* src, sz size, u64 offset) {
+      sz done = 0;
+      while(done < size) {
+            sz chunk = min(size - done, (sz)gb(1));
+#if PLATFORM == WIN32
+            OVERLAPPED at = {};
+            at.Offset = (DWORD)(offset + done);
+            at.OffsetHigh = (DWORD)((offset + done) >> 32);
+            DWORD amount = 0;
+            if(!WriteFile((HANDLE)f->handle, (u8*)src + done, (DWORD)chunk, &amount, &at)) amount = 0;
+#else
+            ssize_t amount = pwrite((int)f->handle, (u8*)src + done, chunk, (off_t)(offset + done));
+#endif
+            if(amount <= 0) break;
+            done += (sz)amount;
+      }
+      
+      return done;
+}
+
 b8x are_sorted(sort_entry* entries, u32 count) {
       bool sorted = true;
       if(count > 1) {
@@ -376,18 +594,19 @@ internal void sort_quick_internal(sort_entry* entries, u32 first_entry, u32 last
             }
             
             rswap(&entries[pivot], &entries[j]);
-            sort_quick_internal(entries, first_entry, j-1);
+            if(j > first_entry) sort_quick_internal(entries, first_entry, j-1);
             sort_quick_internal(entries, j+1, last_entry);
       }
 }
 
 void sort_quick(sort_entry* entries, u32 count) {
-      sort_quick_internal(entries, 0, count-1);
+      if(count > 1) {
+            sort_quick_internal(entries, 0, count-1);
+      }
 }
 
-void sort_radix(sort_entry* entries, u32 count) {
+void sort_radix(sort_entry* entries, u32 count, sort_entry* temp) {
       if(count > 1) {
-            sort_entry* temp = 0; // TODO: allocate from scratch memory.
             sort_entry* src = entries;
             sort_entry* dst = temp;
             for(u32 byte_index = 0; byte_index < 32; byte_index += 8) {
@@ -415,354 +634,3850 @@ void sort_radix(sort_entry* entries, u32 count) {
       }
 }
 
-void seed(rng* rn, u32 seed) {
-      rn->seed = seed;
-      clear(rn);
+internal void sift_down(sort_entry* entries, u32 root, u32 count) {
+      for(u32 child = root * 2 + 1; child < count; child = root * 2 + 1) {
+            if((child + 1 < count) && (entries[child + 1].key > entries[child].key)) child++;
+            if(entries[root].key >= entries[child].key) break;
+            rswap(&entries[root], &entries[child]);
+            root = child;
+      }
 }
 
-void clear(rng* rn) {
-      rn->state = rn->seed;
+internal void sort_heap_internal(sort_entry* entries, u32 count) {
+      if(count > 1) {
+            for(u32 i = count / 2; i > 0; --i) {
+                  sift_down(entries, i - 1, count);
+            }
+            
+            for(u32 end = count - 1; end > 0; --end) {
+                  rswap(&entries[0], &entries[end]);
+                  sift_down(entries, 0, end);
+            }
+      }
 }
 
-u32 next_u32(rng* rn) {
-      rn->state ^= rn->state << 13;
-      rn->state ^= rn->state >> 17;
-      rn->state ^= rn->state << 5;
-      return rn->state;
+internal u32 median_of_three(u32 a, u32 b, u32 c) {
+      return max(min(a, b), min(max(a, b), c));
 }
 
-u64 next_u64(rng* rn) {
-      u32 a = next_u32(rn);
-      u32 b = next_u32(rn);
-      return pack_u64_x2(a, b);
+internal void sort_intro_internal(sort_entry* entries, u32 count, u32 depth) {
+      while(count > SORT_NETWORK_MAX) {
+            if(!depth) {
+                  sort_heap_internal(entries, count);
+                  count = 0;
+            } else {
+                  --depth;
+                  
+                  u32 step = count / 8;
+                  u32 pivot = median_of_three(median_of_three(entries[0].key, entries[step].key, entries[step * 2].key),
+                                               median_of_three(entries[step * 3].key, entries[step * 4].key, entries[step * 5].key),
+                                               median_of_three(entries[step * 6].key, entries[step * 7].key, entries[count - 1].key));
+                  
+                  u32 split = partition(entries, count, pivot);
+                  if(split == count) {
+                        // Nothing is above the pivot: pull the keys equal to it to the back, they are already in place.
+                        count = pivot ? partition(entries, count, pivot - 1) : 0;
+                  } else if(split < (count - split)) {
+                        sort_intro_internal(entries, split, depth);
+                        entries += split;
+                        count -= split;
+                  } else {
+                        sort_intro_internal(entries + split, count - split, depth);
+                        count = split;
+                  }
+            }
+      }
+      
+      sort_network(entries, count);
 }
 
-s32 next_s32(rng* rn) {
-      return (s32)next_u32(rn);
+void sort_intro(sort_entry* entries, u32 count) {
+      u32 depth = 0;
+      for(u32 n = count; n > 1; n >>= 1) depth += 2;
+      sort_intro_internal(entries, count, depth);
 }
 
-s64 next_s64(rng* rn) {
-      return (s64)next_u64(rn);
+b8x are_sorted(u32* keys, u32 count) {
+      bool sorted = true;
+      for(u32 i = 1; i < count; i++) {
+            if(keys[i - 1] > keys[i]) {
+                  sorted = false;
+                  break;
+            }
+      }
+      
+      return sorted;
 }
 
-f32 next_f32(rng* rn) {
-      return bilateral_f32(rn) * F32_MAX;
+#if SIMD < AVX2
+// Bitonic network over a power of two count of items.
+internal void sort_network_internal(u64* items, u32 count) {
+      for(u32 k = 2; k <= count; k <<= 1) {
+            for(u32 j = k >> 1; j > 0; j >>= 1) {
+                  for(u32 i = 0; i < count; ++i) {
+                        u32 l = i ^ j;
+                        if(l > i) {
+                              u64 lo = min(items[i], items[l]);
+                              u64 hi = max(items[i], items[l]);
+                              b8x ascending = (i & k) == 0;
+                              items[i] = ascending ? lo : hi;
+                              items[l] = ascending ? hi : lo;
+                        }
+                  }
+            }
+      }
 }
+#endif
 
-f64 next_f64(rng* rn) {
-      return bilateral_f64(rn) * F64_MAX;
+#if SIMD >= AVX2
+// Bitonic network over 8 keys per register.
+internal void sort_network_keys_internal(__m256i* v, u32 vector_count) {
+      u32 count = vector_count * 8;
+      __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+      __m256i zero = _mm256_setzero_si256();
+      for(u32 k = 2; k <= count; k <<= 1) {
+            __m256i k_mask = _mm256_set1_epi32((s32)k);
+            for(u32 j = k >> 1; j > 0; j >>= 1) {
+                  if(j >= 8) {
+                        for(u32 i = 0; i < vector_count; ++i) {
+                              u32 l = i ^ (j / 8);
+                              if(l > i) {
+                                    __m256i lo = _mm256_min_epu32(v[i], v[l]);
+                                    __m256i hi = _mm256_max_epu32(v[i], v[l]);
+                                    b8x ascending = ((i * 8) & k) == 0;
+                                    v[i] = ascending ? lo : hi;
+                                    v[l] = ascending ? hi : lo;
+                              }
+                        }
+                  } else {
+                        __m256i j_mask = _mm256_set1_epi32((s32)j);
+                        for(u32 i = 0; i < vector_count; ++i) {
+                              __m256i a = v[i];
+                              __m256i b = (j == 4) ? _mm256_permute2x128_si256(a, a, 0x01) :
+                                          (j == 2) ? _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)) :
+                                                     _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1));
+                              __m256i index = _mm256_add_epi32(_mm256_set1_epi32((s32)(i * 8)), lanes);
+                              __m256i lower = _mm256_cmpeq_epi32(_mm256_and_si256(index, j_mask), zero);
+                              __m256i ascending = _mm256_cmpeq_epi32(_mm256_and_si256(index, k_mask), zero);
+                              __m256i take_lo = _mm256_cmpeq_epi32(lower, ascending);
+                              v[i] = _mm256_blendv_epi8(_mm256_max_epu32(a, b), _mm256_min_epu32(a, b), take_lo);
+                        }
+                  }
+            }
+      }
 }
 
-u32 range_u32(rng* rn, u32 minimum, u32 maximum) {
-      return (next_u32(rn) % ((maximum + 1) - minimum)) + minimum;
+// Lanes where the (key, value) pair of a is above the one of b.
+internal __m256i sort_entry_greater(__m256i a, __m256i b) {
+      __m256i bias = _mm256_set1_epi64x(S64_MIN);
+      __m256i order_a = _mm256_xor_si256(_mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)), bias);
+      __m256i order_b = _mm256_xor_si256(_mm256_shuffle_epi32(b, _MM_SHUFFLE(2, 3, 0, 1)), bias);
+      return _mm256_cmpgt_epi64(order_a, order_b);
+}
+
+// Bitonic network over 4 entries per register.
+internal void sort_network_entries_internal(__m256i* v, u32 vector_count) {
+      u32 count = vector_count * 4;
+      __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+      __m256i zero = _mm256_setzero_si256();
+      for(u32 k = 2; k <= count; k <<= 1) {
+            __m256i k_mask = _mm256_set1_epi64x(k);
+            for(u32 j = k >> 1; j > 0; j >>= 1) {
+                  if(j >= 4) {
+                        for(u32 i = 0; i < vector_count; ++i) {
+                              u32 l = i ^ (j / 4);
+                              if(l > i) {
+                                    __m256i greater = sort_entry_greater(v[i], v[l]);
+                                    __m256i lo = _mm256_blendv_epi8(v[i], v[l], greater);
+                                    __m256i hi = _mm256_blendv_epi8(v[l], v[i], greater);
+                                    b8x ascending = ((i * 4) & k) == 0;
+                                    v[i] = ascending ? lo : hi;
+                                    v[l] = ascending ? hi : lo;
+                              }
+                        }
+                  } else {
+                        __m256i j_mask = _mm256_set1_epi64x(j);
+                        for(u32 i = 0; i < vector_count; ++i) {
+                              __m256i a = v[i];
+                              __m256i b = (j == 2) ? _mm256_permute4x64_epi64(a, _MM_SHUFFLE(1, 0, 3, 2)) :
+                                                     _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2));
+                              __m256i greater = sort_entry_greater(a, b);
+                              __m256i lo = _mm256_blendv_epi8(a, b, greater);
+                              __m256i hi = _mm256_blendv_epi8(b, a, greater);
+                              __m256i index = _mm256_add_epi64(_mm256_set1_epi64x(i * 4), lanes);
+                              __m256i lower = _mm256_cmpeq_epi64(_mm256_and_si256(index, j_mask), zero);
+                              __m256i ascending = _mm256_cmpeq_epi64(_mm256_and_si256(index, k_mask), zero);
+                              __m256i take_lo = _mm256_cmpeq_epi64(lower, ascending);
+                              v[i] = _mm256_blendv_epi8(hi, lo, take_lo);
+                        }
+                  }
+            }
+      }
 }
+#endif
 
-u64 range_u64(rng* rn, u64 minimum, u64 maximum) {
-      return (next_u64(rn) % ((maximum + 1) - minimum)) + minimum;
+void sort_network(u32* keys, u32 count) {
+      assert(count <= SORT_NETWORK_MAX);
+      if(count > 1) {
+            // Pad up to a power of two with maximum keys, they sink to the back.
+#if SIMD >= AVX2
+            u32 padded = 8;
+            while(padded < count) padded <<= 1;
+            
+            __m256i v[SORT_NETWORK_MAX / 8];
+            u32* items = (u32*)v;
+            for(u32 i = 0; i < count; ++i) items[i] = keys[i];
+            for(u32 i = count; i < padded; ++i) items[i] = U32_MAX;
+            sort_network_keys_internal(v, padded / 8);
+            for(u32 i = 0; i < count; ++i) keys[i] = items[i];
+#else
+            u32 padded = 2;
+            while(padded < count) padded <<= 1;
+            
+            u64 items[SORT_NETWORK_MAX];
+            for(u32 i = 0; i < count; ++i) items[i] = keys[i];
+            for(u32 i = count; i < padded; ++i) items[i] = U32_MAX;
+            sort_network_internal(items, padded);
+            for(u32 i = 0; i < count; ++i) keys[i] = (u32)items[i];
+#endif
+      }
 }
 
-s32 range_s32(rng* rn, s32 minimum, s32 maximum) {
-      return s32(next_u32(rn) % ((maximum + 1) - minimum)) + minimum;
+void sort_network(sort_entry* entries, u32 count) {
+      assert(count <= SORT_NETWORK_MAX);
+      if(count > 1) {
+            // Pad up to a power of two with maximum entries, they sink to the back.
+#if SIMD >= AVX2
+            u32 padded = 4;
+            while(padded < count) padded <<= 1;
+            
+            __m256i v[SORT_NETWORK_MAX / 4];
+            sort_entry* items = (sort_entry*)v;
+            for(u32 i = 0; i < count; ++i) items[i] = entries[i];
+            for(u32 i = count; i < padded; ++i) items[i] = {U32_MAX, U32_MAX};
+            sort_network_entries_internal(v, padded / 4);
+            for(u32 i = 0; i < count; ++i) entries[i] = items[i];
+#else
+            u32 padded = 2;
+            while(padded < count) padded <<= 1;
+            
+            // Sort (key, value) packed into one integer so that ties are ordered too.
+            u64 items[SORT_NETWORK_MAX];
+            for(u32 i = 0; i < count; ++i) items[i] = pack_u64_x2(entries[i].value, entries[i].key);
+            for(u32 i = count; i < padded; ++i) items[i] = U64_MAX;
+            sort_network_internal(items, padded);
+            for(u32 i = 0; i < count; ++i) entries[i] = {(u32)(items[i] >> 32), (u32)items[i]};
+#endif
+      }
 }
 
-s64 range_s64(rng* rn, s64 minimum, s64 maximum) {
-      return s64(next_u32(rn) % ((maximum + 1) - minimum)) + minimum;
+#if SIMD >= AVX2
+// Permutations moving the lanes at or below the pivot to the front, indexed by the mask of the lanes above it.
+global_variable u32 partition_permutations[16][8] = {
+      {0, 1, 2, 3, 4, 5, 6, 7},
+      {2, 3, 4, 5, 6, 7, 0, 1},
+      {0, 1, 4, 5, 6, 7, 2, 3},
+      {4, 5, 6, 7, 0, 1, 2, 3},
+      {0, 1, 2, 3, 6, 7, 4, 5},
+      {2, 3, 6, 7, 0, 1, 4, 5},
+      {0, 1, 6, 7, 2, 3, 4, 5},
+      {6, 7, 0, 1, 2, 3, 4, 5},
+      {0, 1, 2, 3, 4, 5, 6, 7},
+      {2, 3, 4, 5, 0, 1, 6, 7},
+      {0, 1, 4, 5, 2, 3, 6, 7},
+      {4, 5, 0, 1, 2, 3, 6, 7},
+      {0, 1, 2, 3, 4, 5, 6, 7},
+      {2, 3, 0, 1, 4, 5, 6, 7},
+      {0, 1, 2, 3, 4, 5, 6, 7},
+      {0, 1, 2, 3, 4, 5, 6, 7},
+};
+
+// Compress-store emulation: the same permuted register is written to both ends,
+// each end keeps only its side of it.
+internal void partition_store(sort_entry* entries, __m256i x, __m256i pivot, u32* store_left, u32* store_right) {
+      __m256i keys = _mm256_xor_si256(_mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 2, 0, 0)), _mm256_set1_epi32(S32_MIN));
+      u32 mask = (u32)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi32(keys, pivot)));
+      u32 above = (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+      __m256i permuted = _mm256_permutevar8x32_epi32(x, _mm256_loadu_si256((__m256i*)partition_permutations[mask]));
+      _mm256_storeu_si256((__m256i*)(entries + *store_left), permuted);
+      _mm256_storeu_si256((__m256i*)(entries + *store_right - 4), permuted);
+      *store_left += 4 - above;
+      *store_right -= above;
+}
+
+// Count must be a multiple of 4 and at least 8.
+internal u32 partition_internal(sort_entry* entries, u32 count, u32 pivot) {
+      __m256i biased_pivot = _mm256_set1_epi32((s32)(pivot ^ 0x80000000));
+      
+      // Keep the outermost registers aside so that there is always room to store on both ends.
+      __m256i first = _mm256_loadu_si256((__m256i*)entries);
+      __m256i last = _mm256_loadu_si256((__m256i*)(entries + count - 4));
+      u32 read_left = 4;
+      u32 read_right = count - 4;
+      u32 store_left = 0;
+      u32 store_right = count;
+      
+      while(read_left < read_right) {
+            __m256i x;
+            if((read_left - store_left) <= (store_right - read_right)) {
+                  x = _mm256_loadu_si256((__m256i*)(entries + read_left));
+                  read_left += 4;
+            } else {
+                  read_right -= 4;
+                  x = _mm256_loadu_si256((__m256i*)(entries + read_right));
+            }
+            
+            partition_store(entries, x, biased_pivot, &store_left, &store_right);
+      }
+      
+      partition_store(entries, first, biased_pivot, &store_left, &store_right);
+      partition_store(entries, last, biased_pivot, &store_left, &store_right);
+      return store_left;
+}
+#endif
+
+u32 partition(sort_entry* entries, u32 count, u32 pivot) {
+      u32 split = 0;
+      u32 start = 0;
+#if SIMD >= AVX2
+      if(count >= 8) {
+            start = count - (count % 4);
+            split = partition_internal(entries, start, pivot);
+      }
+#endif
+      
+      // Branchless Lomuto for whatever the vector loop left over.
+      for(u32 i = start; i < count; ++i) {
+            sort_entry e = entries[i];
+            entries[i] = entries[split];
+            entries[split] = e;
+            split += (e.key <= pivot);
+      }
+      
+      return split;
+}
+
+#define SORT_EXTERNAL_MIN_BLOCK 512
+
+struct sort_external_op {
+      file* f;
+      void* data;
+      sz size;
+      u64 offset;
+      b8x write;
+};
+
+// One worker thread per io for the whole sort, each start bumps submitted and the worker bumps completed once the ops are done.
+struct sort_external_io {
+      thread worker;
+      sort_external_op ops[2];
+      u32 op_count;
+      volatile u32 submitted;
+      volatile u32 completed;
+      volatile u32 running;
+      b8x threaded; // False when the worker could not start, ops then run inline.
+      b8x busy;
+      b8x failed;
+};
+
+struct sort_external_run {
+      sort_entry* block;
+      sort_entry* at;
+      sort_entry* end;
+      u64 next; // Next entry to read from the file.
+      u64 last; // One past the last entry of the run in the file.
+};
+
+struct sort_external_merge {
+      sort_external_run* runs;
+      u32* tree; // Losers of each match, the overall winner is at index 0.
+      u32 run_count;
+      u32 leaf_count;
+};
+
+internal void sort_external_io_run(sort_external_io* io) {
+      for(u32 i = 0; i < io->op_count; ++i) {
+            sort_external_op* op = io->ops + i;
+            sz done = op->write ? write_file(op->f, op->data, op->size, op->offset) : read_file(op->f, op->data, op->size, op->offset);
+            if(done != op->size) {
+                  io->failed = true;
+            }
+      }
 }
 
-f32 range_f32(rng* rn, f32 minimum, f32 maximum) {
-      return minimum + (unilateral_f32(rn) * (maximum - minimum));
+internal void sort_external_io_proc(void* param) {
+      sort_external_io* io = (sort_external_io*)param;
+      u32 seen = 0;
+      for(;;) {
+            u32 submitted = atomic_load(&io->submitted, MEMORY_ACQUIRE);
+            if(submitted == seen) {
+                  futex_wait(&io->submitted, seen);
+                  continue;
+            }
+            
+            if(!atomic_load(&io->running, MEMORY_ACQUIRE)) break;
+            sort_external_io_run(io);
+            seen = submitted;
+            atomic_store(&io->completed, seen, MEMORY_RELEASE);
+            futex_wake(&io->completed);
+      }
 }
 
-f64 range_f64(rng* rn, f64 minimum, f64 maximum) {
-      return minimum + (unilateral_f64(rn) * (maximum - minimum));
+internal void sort_external_io_open(sort_external_io* io) {
+      zero_obj(io);
+      io->running = true;
+      io->threaded = start_thread(&io->worker, sort_external_io_proc, io);
 }
 
-b8x chance(rng* rn, u32 chance) {
-      return (next_u32(rn) % chance) == 0;
+internal void sort_external_io_close(sort_external_io* io) {
+      if(io->threaded) {
+            atomic_store(&io->running, 0u, MEMORY_RELEASE);
+            atomic_fetch_add(&io->submitted, 1u, MEMORY_RELEASE);
+            futex_wake(&io->submitted);
+            join_thread(&io->worker);
+            io->threaded = false;
+      }
 }
 
-f32 unilateral_f32(rng* rn) {
-      return next_u32(rn) / (f32)U32_MAX;
+internal void sort_external_io_push(sort_external_io* io, file* f, sort_entry* data, u64 count, u64 first, b8x write) {
+      assert(io->op_count < countof(io->ops));
+      io->ops[io->op_count++] = {f, data, (sz)(count * sizeof(sort_entry)), first * sizeof(sort_entry), write};
 }
 
-f32 bilateral_f32(rng* rn) {
-      return unilateral_f32(rn) * 2.0f - 1.0f;
+internal void sort_external_io_start(sort_external_io* io) {
+      io->busy = io->threaded;
+      if(io->busy) {
+            atomic_fetch_add(&io->submitted, 1u, MEMORY_RELEASE);
+            futex_wake(&io->submitted);
+      } else {
+            sort_external_io_run(io);
+      }
 }
 
-f64 unilateral_f64(rng* rn) {
-      return next_u64(rn) / (f64)U64_MAX;
+internal b8x sort_external_io_wait(sort_external_io* io) {
+      if(io->busy) {
+            u32 submitted = atomic_load(&io->submitted, MEMORY_RELAXED);
+            for(u32 completed; (completed = atomic_load(&io->completed, MEMORY_ACQUIRE)) != submitted;) {
+                  futex_wait(&io->completed, completed);
+            }
+            io->busy = false;
+      }
+      
+      io->op_count = 0;
+      return !io->failed;
 }
 
-f64 bilateral_f64(rng* rn) {
-      return unilateral_f64(rn) * 2.0f - 1.0f;
+// Sorts chunks of run_length entries, reading the next chunk and writing the previous one while the current one sorts.
+internal b8x sort_external_runs(file* src, file* dst, u64 count, u32 run_length, sort_entry* memory, sort_external_io* io) {
+      sort_entry* chunks[3] = {memory, memory + run_length, memory + run_length * 2};
+      sort_entry* temp = memory + run_length * 3;
+      u64 run_count = (count + run_length - 1) / run_length;
+      
+      sort_external_io_push(io, src, chunks[0], min(count, (u64)run_length), 0, false);
+      sort_external_io_start(io);
+      b8x ok = sort_external_io_wait(io);
+      
+      for(u64 run = 0; ok && (run < run_count); ++run) {
+            u64 first = run * run_length;
+            u32 length = (u32)min(count - first, (u64)run_length);
+            sort_entry* chunk = chunks[run % 3];
+            
+            if(run > 0) {
+                  sort_external_io_push(io, dst, chunks[(run + 2) % 3], run_length, first - run_length, true);
+            }
+            
+            if((run + 1) < run_count) {
+                  sort_external_io_push(io, src, chunks[(run + 1) % 3], min(count - first - length, (u64)run_length), first + length, false);
+            }
+            
+            sort_external_io_start(io);
+            sort_radix(chunk, length, temp);
+            ok = sort_external_io_wait(io);
+            
+            if(ok && ((run + 1) == run_count)) {
+                  sort_external_io_push(io, dst, chunk, length, first, true);
+                  sort_external_io_start(io);
+                  ok = sort_external_io_wait(io);
+            }
+      }
+      
+      return ok;
+}
+
+internal b8x sort_external_less(sort_external_merge* m, u32 a, u32 b) {
+      // Exhausted runs always lose and ties go to the earlier run, which keeps the sort stable.
+      b8x less = false;
+      b8x a_live = (a < m->run_count) && (m->runs[a].at != m->runs[a].end);
+      b8x b_live = (b < m->run_count) && (m->runs[b].at != m->runs[b].end);
+      if(a_live && b_live) {
+            u32 a_key = m->runs[a].at->key;
+            u32 b_key = m->runs[b].at->key;
+            less = (a_key < b_key) || ((a_key == b_key) && (a < b));
+      } else {
+            less = a_live;
+      }
+      
+      return less;
+}
+
+internal u32 sort_external_build(sort_external_merge* m, u32 node) {
+      u32 winner = 0;
+      if(node >= m->leaf_count) {
+            winner = node - m->leaf_count;
+      } else {
+            u32 left = sort_external_build(m, node * 2);
+            u32 right = sort_external_build(m, node * 2 + 1);
+            b8x left_wins = sort_external_less(m, left, right);
+            m->tree[node] = left_wins ? right : left;
+            winner = left_wins ? left : right;
+      }
+      
+      return winner;
+}
+
+// Forecasting: the run whose block ends on the smallest key is the next to run dry.
+internal u32 sort_external_forecast(sort_external_merge* m) {
+      u32 result = U32_MAX;
+      for(u32 i = 0; i < m->run_count; ++i) {
+            sort_external_run* run = m->runs + i;
+            if(run->next < run->last) {
+                  if((result == U32_MAX) || (run->end[-1].key < m->runs[result].end[-1].key)) {
+                        result = i;
+                  }
+            }
+      }
+      
+      return result;
+}
+
+// Merges run_count consecutive runs into one, blocks has room for run_count + 3 blocks.
+internal b8x sort_external_merge_runs(file* src, file* dst, u64 first, u64 count, u64 run_length, u32 run_count,
+                                      sort_external_run* runs, u32* tree, sort_entry* blocks, u32 block_length,
+                                      sort_external_io* reader, sort_external_io* writer) {
+      sort_external_merge m = {runs, tree, run_count, 1};
+      while(m.leaf_count < run_count) m.leaf_count <<= 1;
+      
+      b8x ok = true;
+      for(u32 i = 0; i < run_count; ++i) {
+            sort_external_run* run = runs + i;
+            run->next = first + i * run_length;
+            run->last = min(run->next + run_length, first + count);
+            u32 length = (u32)min(run->last - run->next, (u64)block_length);
+            run->block = blocks + (sz)i * block_length;
+            run->at = run->block;
+            run->end = run->block + length;
+            ok = ok && (read_file(src, run->block, length * sizeof(sort_entry), run->next * sizeof(sort_entry)) == length * sizeof(sort_entry));
+            run->next += length;
+      }
+      
+      // One spare block is always being filled for the forecast run, two output blocks alternate.
+      sort_entry* spare = blocks + (sz)run_count * block_length;
+      sort_entry* out_blocks[2] = {spare + block_length, spare + block_length * 2};
+      sort_entry* out = out_blocks[0];
+      u32 out_count = 0;
+      u64 out_first = first;
+      u32 prefetch = sort_external_forecast(&m);
+      u32 prefetch_length = 0;
+      if(ok && (prefetch != U32_MAX)) {
+            prefetch_length = (u32)min(runs[prefetch].last - runs[prefetch].next, (u64)block_length);
+            sort_external_io_push(reader, src, spare, prefetch_length, runs[prefetch].next, false);
+            sort_external_io_start(reader);
+      }
+      
+      tree[0] = sort_external_build(&m, 1);
+      while(ok && (tree[0] < run_count) && (runs[tree[0]].at != runs[tree[0]].end)) {
+            u32 winner = tree[0];
+            sort_external_run* run = runs + winner;
+            out[out_count++] = *run->at++;
+            
+            if(out_count == block_length) {
+                  ok = sort_external_io_wait(writer);
+                  sort_external_io_push(writer, dst, out, out_count, out_first, true);
+                  sort_external_io_start(writer);
+                  out_first += out_count;
+                  out_count = 0;
+                  out = (out == out_blocks[0]) ? out_blocks[1] : out_blocks[0];
+            }
+            
+            if(run->at == run->end) {
+                  if(prefetch == winner) {
+                        ok = ok && sort_external_io_wait(reader);
+                        swap(run->block, spare);
+                        run->at = run->block;
+                        run->end = run->block + prefetch_length;
+                        run->next += prefetch_length;
+                        
+                        prefetch = sort_external_forecast(&m);
+                        if(ok && (prefetch != U32_MAX)) {
+                              prefetch_length = (u32)min(runs[prefetch].last - runs[prefetch].next, (u64)block_length);
+                              sort_external_io_push(reader, src, spare, prefetch_length, runs[prefetch].next, false);
+                              sort_external_io_start(reader);
+                        }
+                  } else {
+                        assert(run->next == run->last);
+                  }
+            }
+            
+            for(u32 node = (winner + m.leaf_count) / 2; node > 0; node /= 2) {
+                  if(sort_external_less(&m, tree[node], winner)) {
+                        swap(tree[node], winner);
+                  }
+            }
+            
+            tree[0] = winner;
+      }
+      
+      ok = sort_external_io_wait(reader) && ok;
+      ok = sort_external_io_wait(writer) && ok;
+      if(ok && out_count) {
+            ok = write_file(dst, out, out_count * sizeof(sort_entry), out_first * sizeof(sort_entry)) == out_count * sizeof(sort_entry);
+      }
+      
+      return ok;
+}
+
+internal b8x sort_external_internal(file* src, file* dst, file* temp, void* memory, sz memory_size) {
+      u8* memory_start = (u8*)align(memory, 64);
+      u8* memory_end = (u8*)memory + memory_size;
+      sz usable = (sz)(memory_end - memory_start);
+      u64 count = get_file_size(src) / sizeof(sort_entry);
+      
+      // Run generation keeps three chunks in flight plus the radix sort scratch.
+      u64 run_length = min(usable / (4 * sizeof(sort_entry)), (sz)U32_MAX);
+      u64 run_count = (count + run_length - 1) / run_length;
+      
+      // Every merged run costs a block and its bookkeeping, on top of the spare and the two output blocks.
+      sz per_run = SORT_EXTERNAL_MIN_BLOCK * sizeof(sort_entry) + sizeof(sort_external_run) + 2 * sizeof(u32);
+      u64 fan_in = (usable / per_run) - 3;
+      
+      u32 passes = 0;
+      for(u64 runs = run_count; runs > 1; runs = (runs + fan_in - 1) / fan_in) {
+            passes++;
+      }
+      
+      // Passes ping-pong between the two files so that the last one lands in the destination.
+      file* files[2] = {dst, temp};
+      sort_external_io reader, writer;
+      sort_external_io_open(&reader);
+      sort_external_io_open(&writer);
+      b8x ok = sort_external_runs(src, files[passes & 1], count, (u32)run_length, (sort_entry*)memory_start, &reader);
+      for(u32 pass = 1; ok && (pass <= passes); ++pass) {
+            file* in = files[(passes - pass + 1) & 1];
+            file* out = files[(passes - pass) & 1];
+            u64 merged_length = run_length * fan_in;
+            u32 merged_count = (u32)min(run_count, fan_in);
+            
+            sort_external_run* runs = (sort_external_run*)memory_start;
+            u32* tree = (u32*)(runs + merged_count);
+            sort_entry* blocks = (sort_entry*)align(tree + merged_count * 2, 64);
+            u32 block_length = (u32)min((sz)(memory_end - (u8*)blocks) / ((merged_count + 3) * sizeof(sort_entry)), (sz)U32_MAX);
+            
+            for(u64 first = 0; ok && (first < count); first += merged_length) {
+                  u64 length = min(count - first, merged_length);
+                  u32 merging = (u32)((length + run_length - 1) / run_length);
+                  ok = sort_external_merge_runs(in, out, first, length, run_length, merging, runs, tree, blocks, block_length, &reader, &writer);
+            }
+            
+            run_length = merged_length;
+            run_count = (run_count + fan_in - 1) / fan_in;
+      }
+      
+      sort_external_io_close(&reader);
+      sort_external_io_close(&writer);
+      return ok;
+}
+
+b8x sort_external(char* src_path, char* dst_path, char* temp_path, void* memory, sz memory_size) {
+      b8x ok = false;
+      file src = {};
+      file dst = {};
+      file temp = {};
+      if((memory_size >= SORT_EXTERNAL_MIN_MEMORY) && open_file(&src, src_path, FILE_MODE_READ)) {
+            if(open_file(&dst, dst_path, FILE_MODE_WRITE)) {
+                  if(open_file(&temp, temp_path, FILE_MODE_WRITE)) {
+                        ok = sort_external_internal(&src, &dst, &temp, memory, memory_size);
+                        close_file(&temp);
+                  }
+                  
+                  close_file(&dst);
+            }
+            
+            close_file(&src);
+      }
+      
+      return ok;
+}
+
+// Index of the first entry from start whose (flipped) key is below the threshold, or count.
+internal u32 find_below(sort_entry* entries, u32 start, u32 count, u32 threshold, u32 flip) {
+      u32 i = start;
+#if SIMD >= AVX2
+      __m256i bias = _mm256_set1_epi32((s32)(flip ^ 0x80000000));
+      __m256i limit = _mm256_set1_epi32((s32)(threshold ^ 0x80000000));
+      for(; (i + 8) <= count; i += 8) {
+            __m256 a = _mm256_loadu_ps((f32*)(entries + i));
+            __m256 b = _mm256_loadu_ps((f32*)(entries + i + 4));
+            __m256i keys = _mm256_xor_si256(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), bias);
+            if(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, keys)))) break;
+      }
+#elif SIMD >= SSE2
+      __m128i bias = _mm_set1_epi32((s32)(flip ^ 0x80000000));
+      __m128i limit = _mm_set1_epi32((s32)(threshold ^ 0x80000000));
+      for(; (i + 4) <= count; i += 4) {
+            __m128 a = _mm_loadu_ps((f32*)(entries + i));
+            __m128 b = _mm_loadu_ps((f32*)(entries + i + 2));
+            __m128i keys = _mm_xor_si128(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), bias);
+            if(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(keys, limit)))) break;
+      }
+#endif
+      
+      while((i < count) && ((entries[i].key ^ flip) >= threshold)) {
+            ++i;
+      }
+      
+      return i;
+}
+
+internal void sift_up(sort_entry* entries, u32 child) {
+      while(child > 0) {
+            u32 parent = (child - 1) / 2;
+            if(entries[parent].key >= entries[child].key) break;
+            rswap(&entries[parent], &entries[child]);
+            child = parent;
+      }
+}
+
+internal u32 median_of_medians(sort_entry* entries, u32 count);
+
+internal void select_internal(sort_entry* entries, u32 count, u32 nth, u32 depth) {
+      while(count > SORT_NETWORK_MAX) {
+            u32 pivot = 0;
+            if(depth) {
+                  --depth;
+                  u32 step = count / 8;
+                  pivot = median_of_three(median_of_three(entries[0].key, entries[step].key, entries[step * 2].key),
+                                          median_of_three(entries[step * 3].key, entries[step * 4].key, entries[step * 5].key),
+                                          median_of_three(entries[step * 6].key, entries[step * 7].key, entries[count - 1].key));
+            } else {
+                  pivot = median_of_medians(entries, count);
+            }
+            
+            u32 split = partition(entries, count, pivot);
+            if(nth >= split) {
+                  entries += split;
+                  nth -= split;
+                  count -= split;
+            } else if(!depth || (split == count)) {
+                  // Peel off the keys equal to the pivot, this keeps median of medians linear with duplicates.
+                  u32 lower = pivot ? partition(entries, split, pivot - 1) : 0;
+                  count = (nth >= lower) ? 0 : lower;
+            } else {
+                  count = split;
+            }
+      }
+      
+      sort_network(entries, count);
+}
+
+internal u32 median_of_medians(sort_entry* entries, u32 count) {
+      // Medians of groups of five go to the front, then their own median is selected in place.
+      u32 group_count = count / 5;
+      for(u32 group = 0; group < group_count; ++group) {
+            sort_network(entries + group * 5, 5);
+            rswap(&entries[group], &entries[group * 5 + 2]);
+      }
+      
+      select_internal(entries, group_count, group_count / 2, 0);
+      return entries[group_count / 2].key;
+}
+
+void select_nth(sort_entry* entries, u32 count, u32 nth) {
+      assert(nth < count);
+      u32 depth = 0;
+      for(u32 n = count; n > 1; n >>= 1) depth += 2;
+      select_internal(entries, count, nth, depth);
+}
+
+void partial_sort_k(sort_entry* entries, u32 count, u32 k) {
+      if(k >= count) {
+            sort_intro(entries, count);
+      } else if(k) {
+            if((u64)k * 64 <= count) {
+                  // Small k: a heap of the best k, most candidates fail the threshold test and are skipped in bulk.
+                  for(u32 i = k / 2; i > 0; --i) {
+                        sift_down(entries, i - 1, k);
+                  }
+                  
+                  for(u32 i = find_below(entries, k, count, entries[0].key, 0); i < count; i = find_below(entries, i + 1, count, entries[0].key, 0)) {
+                        rswap(&entries[0], &entries[i]);
+                        sift_down(entries, 0, k);
+                  }
+                  
+                  sort_heap_internal(entries, k);
+            } else {
+                  select_nth(entries, count, k);
+                  sort_intro(entries, k);
+            }
+      }
+}
+
+void init_top_k(top_k* t, sort_entry* storage, u32 capacity, b8x largest) {
+      t->heap = storage;
+      t->capacity = capacity;
+      t->count = 0;
+      t->flip = largest ? U32_MAX : 0;
+}
+
+void push_top_k(top_k* t, sort_entry* entries, u32 count) {
+      // The heap keeps flipped keys so that both modes are a max-heap of the worst kept entry.
+      u32 i = 0;
+      for(; (i < count) && (t->count < t->capacity); ++i) {
+            t->heap[t->count] = {entries[i].key ^ t->flip, entries[i].value};
+            sift_up(t->heap, t->count++);
+      }
+      
+      if(t->count) {
+            for(i = find_below(entries, i, count, t->heap[0].key, t->flip); i < count; i = find_below(entries, i + 1, count, t->heap[0].key, t->flip)) {
+                  t->heap[0] = {entries[i].key ^ t->flip, entries[i].value};
+                  sift_down(t->heap, 0, t->count);
+            }
+      }
+}
+
+u32 finish_top_k(top_k* t) {
+      u32 count = t->count;
+      sort_heap_internal(t->heap, count);
+      for(u32 i = 0; i < count; ++i) {
+            t->heap[i].key ^= t->flip;
+      }
+      
+      t->count = 0;
+      return count;
+}
+
+#define PERMUTE_BLOCK 1024
+#define PERMUTE_PREFETCH 16
+
+// Copies one element, with fast paths for the common vector sizes.
+// Held rows and buffer slices start 8 byte aligned, but a column may be packed tighter than its size suggests, so both sides are checked.
+internal void permute_copy(u8* dst, u8* src, u32 size) {
+      up alignment = (up)dst | (up)src;
+      if((size == 4) && !(alignment & 3)) {
+            *(u32*)dst = *(u32*)src;
+      } else if((size == 8) && !(alignment & 7)) {
+            *(u64*)dst = *(u64*)src;
+      } else if((size == 8) && !(alignment & 3)) {
+            ((u32*)dst)[0] = ((u32*)src)[0]; ((u32*)dst)[1] = ((u32*)src)[1];
+      } else if((size == 12) && !(alignment & 3)) {
+            ((u32*)dst)[0] = ((u32*)src)[0]; ((u32*)dst)[1] = ((u32*)src)[1]; ((u32*)dst)[2] = ((u32*)src)[2];
+      } else if((size == 16) && !(alignment & 7)) {
+            ((u64*)dst)[0] = ((u64*)src)[0]; ((u64*)dst)[1] = ((u64*)src)[1];
+      } else {
+            copy(dst, src, size);
+      }
+}
+
+// Gathers every column into the buffer (slices rounded up to 8 bytes), then copies them back.
+internal void permute_gather(permute_column* columns, u32 column_count, u32* permutation, u32 count, u8* buffer) {
+      // Blocked so that the slice of the permutation stays in cache while each column is gathered.
+      for(u32 block = 0; block < count; block += PERMUTE_BLOCK) {
+            u32 end = min(block + PERMUTE_BLOCK, count);
+            u8* dst = buffer;
+            for(u32 c = 0; c < column_count; ++c) {
+                  u8* src = (u8*)columns[c].data;
+                  u32 size = columns[c].size;
+                  for(u32 i = block; i < end; ++i) {
+                        prefetch(src + (sz)permutation[min(i + PERMUTE_PREFETCH, count - 1)] * size);
+                        permute_copy(dst + (sz)i * size, src + (sz)permutation[i] * size, size);
+                  }
+                  
+                  dst += align8((sz)count * size);
+            }
+      }
+      
+      u8* src = buffer;
+      for(u32 c = 0; c < column_count; ++c) {
+            copy(columns[c].data, src, (sz)count * columns[c].size);
+            src += align8((sz)count * columns[c].size);
+      }
+}
+
+permute_column mk_permute_column(void* data, u32 size) {
+      return {data, size};
+}
+
+void argsort(u32* keys, u32 count, u32* permutation, sort_entry* scratch) {
+      for(u32 i = 0; i < count; ++i) {
+            scratch[i] = {keys[i], i};
+      }
+      
+      sort_radix(scratch, count, scratch + count);
+      for(u32 i = 0; i < count; ++i) {
+            permutation[i] = scratch[i].value;
+      }
+}
+
+void permute(permute_column* columns, u32 column_count, u32* permutation, u32 count, void* buffer, sz buffer_size) {
+      u32 first = 0;
+      while(first < column_count) {
+            // As many columns as the buffer fits go in one pass, a column too large for it is cycled in place.
+            sz used = 0;
+            u32 last = first;
+            while((last < column_count) && ((used + align8((sz)count * columns[last].size)) <= buffer_size)) {
+                  used += align8((sz)count * columns[last].size);
+                  ++last;
+            }
+            
+            if(last == first) {
+                  permute_in_place(columns + first, 1, permutation, count);
+                  ++first;
+            } else {
+                  permute_gather(columns + first, last - first, permutation, count, (u8*)buffer);
+                  first = last;
+            }
+      }
+}
+
+void permute_in_place(permute_column* columns, u32 column_count, u32* permutation, u32 count) {
+      assert(count <= (u32)S32_MAX);
+      
+      // Held elements are rounded up to 8 bytes so that the word moves stay aligned.
+      u32 row_size = 0;
+      for(u32 c = 0; c < column_count; ++c) {
+            row_size += align8(columns[c].size);
+      }
+      assert(row_size <= PERMUTE_MAX_ROW);
+      
+      // Visited slots are marked in the top bit of the permutation, which is cleared again at the end.
+      u32 visited = 0x80000000;
+      alignas(16) u8 hold[PERMUTE_MAX_ROW];
+      for(u32 start = 0; start < count; ++start) {
+            if(!(permutation[start] & visited) && (permutation[start] != start)) {
+                  u8* held = hold;
+                  for(u32 c = 0; c < column_count; ++c) {
+                        permute_copy(held, (u8*)columns[c].data + (sz)start * columns[c].size, columns[c].size);
+                        held += align8(columns[c].size);
+                  }
+                  
+                  // Walk the cycle once, every column moves along with it.
+                  u32 at = start;
+                  for(u32 next = permutation[at]; next != start; next = permutation[at]) {
+                        for(u32 c = 0; c < column_count; ++c) {
+                              u8* data = (u8*)columns[c].data;
+                              permute_copy(data + (sz)at * columns[c].size, data + (sz)next * columns[c].size, columns[c].size);
+                        }
+                        
+                        permutation[at] |= visited;
+                        at = next;
+                  }
+                  
+                  held = hold;
+                  for(u32 c = 0; c < column_count; ++c) {
+                        permute_copy((u8*)columns[c].data + (sz)at * columns[c].size, held, columns[c].size);
+                        held += align8(columns[c].size);
+                  }
+                  
+                  permutation[at] |= visited;
+            }
+      }
+      
+      for(u32 i = 0; i < count; ++i) {
+            permutation[i] &= ~visited;
+      }
+}
+
+// Count of the trailing set bits.
+internal u32 trailing_ones(u32 x) {
+      return count_trailing_zeros(~x);
+}
+
+u32 lower_bound(sort_entry* entries, u32 count, u32 key) {
+      u32 result = 0;
+      if(count) {
+            // Branchless: the comparison becomes a conditional move, both possible next probes are prefetched.
+            sort_entry* base = entries;
+            u32 length = count;
+            while(length > 1) {
+                  u32 half = length / 2;
+                  length -= half;
+                  prefetch(base + length / 2 - 1);
+                  prefetch(base + half + length / 2 - 1);
+                  base += (base[half - 1].key < key) ? half : 0;
+            }
+            
+            result = (u32)(base - entries) + (base->key < key);
+      }
+      
+      return result;
+}
+
+u32 range_query(sort_entry* entries, u32 count, u32 minimum, u32 maximum, u32* first) {
+      *first = lower_bound(entries, count, minimum);
+      u32 last = (maximum == U32_MAX) ? count : lower_bound(entries, count, maximum + 1);
+      return (last > *first) ? (last - *first) : 0;
+}
+
+sz get_eytzinger_size(u32 count) {
+      return ((sz)count + 1) * sizeof(sort_entry);
+}
+
+internal void build_eytzinger_internal(eytzinger* e, sort_entry* sorted, u32* rank, u32 node) {
+      if(node <= e->count) {
+            build_eytzinger_internal(e, sorted, rank, node * 2);
+            e->nodes[node] = {sorted[*rank].key, *rank};
+            (*rank)++;
+            build_eytzinger_internal(e, sorted, rank, node * 2 + 1);
+      }
+}
+
+void build_eytzinger(eytzinger* e, sort_entry* sorted, u32 count, void* storage) {
+      assert(are_sorted(sorted, count) && (count <= (u32)S32_MAX));
+      e->nodes = (sort_entry*)storage;
+      e->count = count;
+      e->nodes[0] = {0, count}; // Where searches past the last key end up.
+      
+      u32 rank = 0;
+      build_eytzinger_internal(e, sorted, &rank, 1);
+}
+
+u32 lower_bound(eytzinger* e, u32 key) {
+      u32 node = 1;
+      while(node <= e->count) {
+            // Eight nodes of the same line are the great-grandchildren, three levels ahead.
+            prefetch(e->nodes + (sz)node * 8);
+            node = node * 2 + (e->nodes[node].key < key);
+      }
+      
+      // Undo the right turns taken after the last left one.
+      node = (u32)((u64)node >> (trailing_ones(node) + 1));
+      return e->nodes[node].value;
+}
+
+u32 range_query(eytzinger* e, u32 minimum, u32 maximum, u32* first) {
+      *first = lower_bound(e, minimum);
+      u32 last = (maximum == U32_MAX) ? e->count : lower_bound(e, maximum + 1);
+      return (last > *first) ? (last - *first) : 0;
+}
+
+sz get_static_btree_size(u32 count) {
+      sz node_count = ((sz)count + STATIC_BTREE_KEYS - 1) / STATIC_BTREE_KEYS;
+      return node_count * STATIC_BTREE_KEYS * sizeof(u32) * 2;
+}
+
+internal void build_static_btree_internal(static_btree* t, sort_entry* sorted, u32* rank, u64 node) {
+      if(node < t->node_count) {
+            for(u32 i = 0; i < STATIC_BTREE_KEYS; ++i) {
+                  build_static_btree_internal(t, sorted, rank, node * (STATIC_BTREE_KEYS + 1) + i + 1);
+                  
+                  // Padding sorts after every real key, so searches never stop on it before a real one.
+                  sz slot = (sz)node * STATIC_BTREE_KEYS + i;
+                  t->keys[slot] = (*rank < t->count) ? sorted[*rank].key : U32_MAX;
+                  t->ranks[slot] = min(*rank, t->count);
+                  (*rank)++;
+            }
+            
+            build_static_btree_internal(t, sorted, rank, node * (STATIC_BTREE_KEYS + 1) + STATIC_BTREE_KEYS + 1);
+      }
+}
+
+void build_static_btree(static_btree* t, sort_entry* sorted, u32 count, void* storage) {
+      assert(are_sorted(sorted, count));
+      t->count = count;
+      t->node_count = (count + STATIC_BTREE_KEYS - 1) / STATIC_BTREE_KEYS;
+      t->keys = (u32*)storage;
+      t->ranks = t->keys + (sz)t->node_count * STATIC_BTREE_KEYS;
+      
+      u32 rank = 0;
+      build_static_btree_internal(t, sorted, &rank, 0);
+}
+
+// Amount of keys in the node below the searched one.
+internal u32 static_btree_rank(u32* keys, u32 key) {
+      u32 below = 0;
+#if SIMD >= AVX2
+      __m256i bias = _mm256_set1_epi32(S32_MIN);
+      __m256i x = _mm256_xor_si256(_mm256_set1_epi32((s32)key), bias);
+      __m256i a = _mm256_xor_si256(_mm256_load_si256((__m256i*)keys), bias);
+      __m256i b = _mm256_xor_si256(_mm256_load_si256((__m256i*)(keys + 8)), bias);
+      u32 mask = (u32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, a))) |
+                ((u32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, b))) << 8);
+      below = trailing_ones(mask);
+#elif SIMD >= SSE2
+      __m128i bias = _mm_set1_epi32(S32_MIN);
+      __m128i x = _mm_xor_si128(_mm_set1_epi32((s32)key), bias);
+      u32 mask = 0;
+      for(u32 i = 0; i < STATIC_BTREE_KEYS; i += 4) {
+            __m128i k = _mm_xor_si128(_mm_load_si128((__m128i*)(keys + i)), bias);
+            mask |= (u32)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(k, x))) << i;
+      }
+      below = trailing_ones(mask);
+#else
+      for(u32 i = 0; i < STATIC_BTREE_KEYS; ++i) {
+            below += (keys[i] < key);
+      }
+#endif
+      
+      return below;
+}
+
+u32 lower_bound(static_btree* t, u32 key) {
+      u32 result = t->count;
+      u64 node = 0;
+      while(node < t->node_count) {
+            u32 below = static_btree_rank(t->keys + (sz)node * STATIC_BTREE_KEYS, key);
+            if(below < STATIC_BTREE_KEYS) {
+                  result = t->ranks[(sz)node * STATIC_BTREE_KEYS + below];
+            }
+            
+            node = node * (STATIC_BTREE_KEYS + 1) + below + 1;
+      }
+      
+      return result;
+}
+
+u32 range_query(static_btree* t, u32 minimum, u32 maximum, u32* first) {
+      *first = lower_bound(t, minimum);
+      u32 last = (maximum == U32_MAX) ? t->count : lower_bound(t, maximum + 1);
+      return (last > *first) ? (last - *first) : 0;
+}
+
+// High 64 bits of the full 128 bit product.
+internal u64 mul_high_u64(u64 a, u64 b) {
+#if COMPILER == MSVC && ARCHITECTURE == X64
+      return __umulh(a, b);
+#elif COMPILER != MSVC && (ARCHITECTURE == X64 || ARCHITECTURE == ARM64)
+      return (u64)(((unsigned __int128)a * b) >> 64);
+#else
+      u64 a_lo = a & U32_MAX, a_hi = a >> 32;
+      u64 b_lo = b & U32_MAX, b_hi = b >> 32;
+      u64 lo_lo = a_lo * b_lo;
+      u64 hi_lo = a_hi * b_lo;
+      u64 cross = (lo_lo >> 32) + (hi_lo & U32_MAX) + a_lo * b_hi;
+      return (hi_lo >> 32) + (cross >> 32) + a_hi * b_hi;
+#endif
+}
+
+// Expands a 64 bit seed into well mixed state words.
+internal u64 rng_splitmix64(u64* x) {
+      u64 z = (*x += 0x9E3779B97F4A7C15ull);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+}
+
+// Pcg64 keeps a 128 bit state in state[0] (low) and state[1] (high), and the odd increment in state[2] and state[3].
+#define RNG_PCG64_MULTIPLIER_LOW 0x4385DF649FCCF645ull
+#define RNG_PCG64_MULTIPLIER_HIGH 0x2360ED051FC65DA4ull
+
+// Low 128 bits of a * b + c, all values are {low, high}.
+internal void rng_mul_add_u128(u64* out, u64* a, u64* b, u64* c) {
+      u64 low = a[0] * b[0];
+      u64 high = mul_high_u64(a[0], b[0]) + a[0] * b[1] + a[1] * b[0];
+      out[0] = low + c[0];
+      out[1] = high + c[1] + (out[0] < low);
+}
+
+internal void rng_pcg64_step(rng* rn) {
+      u64 multiplier[2] = {RNG_PCG64_MULTIPLIER_LOW, RNG_PCG64_MULTIPLIER_HIGH};
+      rng_mul_add_u128(rn->state, rn->state, multiplier, rn->state + 2);
+}
+
+// Advances the lcg by 2^exponent steps in O(exponent), see Brown, "Random number generation with arbitrary strides".
+internal void rng_pcg64_advance(rng* rn, u32 exponent) {
+      u64 multiplier[2] = {RNG_PCG64_MULTIPLIER_LOW, RNG_PCG64_MULTIPLIER_HIGH};
+      u64 increment[2] = {rn->state[2], rn->state[3]};
+      u64 zero[2] = {};
+      u64 one[2] = {1, 0};
+      for(u32 i = 0; i < exponent; ++i) {
+            // (m, c) -> (m * m, (m + 1) * c).
+            u64 next_multiplier[2];
+            u64 next_factor[2];
+            rng_mul_add_u128(next_multiplier, multiplier, multiplier, zero);
+            rng_mul_add_u128(next_factor, multiplier, one, one);
+            rng_mul_add_u128(increment, next_factor, increment, zero);
+            multiplier[0] = next_multiplier[0];
+            multiplier[1] = next_multiplier[1];
+      }
+      
+      rng_mul_add_u128(rn->state, rn->state, multiplier, increment);
+}
+
+internal void rng_xoshiro256_jump(rng* rn, const u64* polynomial) {
+      u64 s[4] = {};
+      for(u32 i = 0; i < 4; ++i) {
+            for(u32 b = 0; b < 64; ++b) {
+                  if(polynomial[i] & (1ull << b)) {
+                        s[0] ^= rn->state[0];
+                        s[1] ^= rn->state[1];
+                        s[2] ^= rn->state[2];
+                        s[3] ^= rn->state[3];
+                  }
+                  
+                  next_u64(rn);
+            }
+      }
+      
+      rn->state[0] = s[0];
+      rn->state[1] = s[1];
+      rn->state[2] = s[2];
+      rn->state[3] = s[3];
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+philox_block philox(u64 key, u64 counter, u64 stream) {
+      philox_block block = {{(u32)counter, (u32)(counter >> 32), (u32)stream, (u32)(stream >> 32)}};
+      u32* c = block.x;
+      u32 k0 = (u32)key;
+      u32 k1 = (u32)(key >> 32);
+      for(u32 round = 0; round < 10; ++round) {
+            u64 p0 = (u64)PHILOX_M0 * c[0];
+            u64 p1 = (u64)PHILOX_M1 * c[2];
+            c[0] = (u32)(p1 >> 32) ^ c[1] ^ k0;
+            c[1] = (u32)p1;
+            c[2] = (u32)(p0 >> 32) ^ c[3] ^ k1;
+            c[3] = (u32)p0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+      }
+      
+      return block;
+}
+
+void seed(rng* rn, u32 seed) {
+      rn->kind = RNG_XORSHIFT32;
+      rn->buffered = 0;
+      rn->seed = seed;
+      clear(rn);
+}
+
+void seed(rng* rn, u64 seed, u32 kind) {
+      rn->kind = kind;
+      rn->buffered = 0;
+      rn->seed = seed;
+      clear(rn);
+}
+
+void clear(rng* rn) {
+      u64 x = rn->seed;
+      switch(rn->kind) {
+            case RNG_XORSHIFT32: {
+                  rn->state[0] = (u32)rn->seed;
+            } break;
+            
+            case RNG_XOSHIRO256PP:
+            case RNG_XOSHIRO256SS: {
+                  // Splitmix64 never yields four zero words in a row, so the state is always valid.
+                  for(u32 i = 0; i < 4; ++i) rn->state[i] = rng_splitmix64(&x);
+            } break;
+            
+            case RNG_PCG64: {
+                  // Same as pcg's srandom: the stream selects the increment, then the initial state is mixed in.
+                  u64 initial[2] = {rng_splitmix64(&x), rng_splitmix64(&x)};
+                  u64 stream[2] = {rng_splitmix64(&x), rng_splitmix64(&x)};
+                  rn->state[0] = 0;
+                  rn->state[1] = 0;
+                  rn->state[2] = (stream[0] << 1) | 1;
+                  rn->state[3] = (stream[1] << 1) | (stream[0] >> 63);
+                  rng_pcg64_step(rn);
+                  rn->state[0] += initial[0];
+                  rn->state[1] += initial[1] + (rn->state[0] < initial[0]);
+                  rng_pcg64_step(rn);
+            } break;
+            
+            case RNG_PHILOX: {
+                  // Seed is the key, state[0] and state[1] are the 128 bit block counter.
+                  for(u32 i = 0; i < 4; ++i) rn->state[i] = 0;
+                  rn->buffered = 0;
+            } break;
+            
+            invalid_default_case;
+      }
+}
+
+void seek(rng* rn, u64 stream, u64 counter) {
+      assert(rn->kind == RNG_PHILOX);
+      rn->state[0] = counter;
+      rn->state[1] = stream;
+      rn->buffered = 0;
+}
+
+void jump(rng* rn) {
+      local_persist const u64 polynomial[4] = {0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull};
+      assert(rn->kind != RNG_XORSHIFT32);
+      if(rn->kind == RNG_PCG64) rng_pcg64_advance(rn, 64);
+      else if(rn->kind == RNG_PHILOX) seek(rn, rn->state[1] + 1, rn->state[0]);
+      else rng_xoshiro256_jump(rn, polynomial);
+}
+
+void long_jump(rng* rn) {
+      local_persist const u64 polynomial[4] = {0x76E15D3EFEFDCBBFull, 0xC5004E441C522FB3ull, 0x77710069854EE241ull, 0x39109BB02ACBE635ull};
+      assert(rn->kind != RNG_XORSHIFT32);
+      if(rn->kind == RNG_PCG64) rng_pcg64_advance(rn, 96);
+      else if(rn->kind == RNG_PHILOX) seek(rn, rn->state[1] + (1ull << 32), rn->state[0]);
+      else rng_xoshiro256_jump(rn, polynomial);
+}
+
+u32 next_u32(rng* rn) {
+      if(rn->kind == RNG_PHILOX) {
+            // Words of the current block are handed out in order, state[2] and state[3] hold the block.
+            if(rn->buffered == 0) {
+                  philox_block block = philox(rn->seed, rn->state[0], rn->state[1]);
+                  rn->state[0]++;
+                  rn->state[1] += (rn->state[0] == 0);
+                  rn->state[2] = pack_u64_x2(block.x[0], block.x[1]);
+                  rn->state[3] = pack_u64_x2(block.x[2], block.x[3]);
+                  rn->buffered = 4;
+            }
+            
+            u32 word = 4 - rn->buffered--;
+            return (u32)(rn->state[2 + word / 2] >> ((word & 1) * 32));
+      }
+      
+      if(rn->kind != RNG_XORSHIFT32) {
+            return (u32)(next_u64(rn) >> 32);
+      }
+      
+      u32 x = (u32)rn->state[0];
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      rn->state[0] = x;
+      return x;
+}
+
+u64 next_u64(rng* rn) {
+      u64* s = rn->state;
+      switch(rn->kind) {
+            case RNG_XORSHIFT32:
+            case RNG_PHILOX: {
+                  u32 a = next_u32(rn);
+                  u32 b = next_u32(rn);
+                  return pack_u64_x2(a, b);
+            }
+            
+            case RNG_XOSHIRO256PP:
+            case RNG_XOSHIRO256SS: {
+                  u64 result = (rn->kind == RNG_XOSHIRO256PP) ? (rotate_left(s[0] + s[3], 23) + s[0]) : (rotate_left(s[1] * 5, 7) * 9);
+                  u64 t = s[1] << 17;
+                  s[2] ^= s[0];
+                  s[3] ^= s[1];
+                  s[1] ^= s[2];
+                  s[0] ^= s[3];
+                  s[2] ^= t;
+                  s[3] = rotate_left(s[3], 45);
+                  return result;
+            }
+            
+            case RNG_PCG64: {
+                  rng_pcg64_step(rn);
+                  return rotate_right(s[1] ^ s[0], s[1] >> 58);
+            }
+            
+            invalid_default_case;
+      }
+      
+      return 0;
+}
+
+s32 next_s32(rng* rn) {
+      return (s32)next_u32(rn);
+}
+
+s64 next_s64(rng* rn) {
+      return (s64)next_u64(rn);
+}
+
+f32 next_f32(rng* rn) {
+      // Redraw the 1 in 256 patterns that are inf or nan.
+      u32 x = next_u32(rn);
+      while((x & 0x7F800000) == 0x7F800000) x = next_u32(rn);
+      return f32_from_u32(x);
+}
+
+f64 next_f64(rng* rn) {
+      u64 x = next_u64(rn);
+      while((x & 0x7FF0000000000000ull) == 0x7FF0000000000000ull) x = next_u64(rn);
+      return f64_from_u64(x);
+}
+
+// Lemire's multiply-shift: the high half of x * span is uniform once the few low halves below 2^n % span are redrawn.
+// A span of zero stands for the full range.
+internal u32 bounded_u32(rng* rn, u32 span) {
+      if(span == 0) return next_u32(rn);
+      u64 m = (u64)next_u32(rn) * span;
+      if((u32)m < span) {
+            u32 threshold = (0u - span) % span;
+            while((u32)m < threshold) m = (u64)next_u32(rn) * span;
+      }
+      
+      return (u32)(m >> 32);
+}
+
+internal u64 bounded_u64(rng* rn, u64 span) {
+      if(span == 0) return next_u64(rn);
+      u64 x = next_u64(rn);
+      u64 low = x * span;
+      if(low < span) {
+            u64 threshold = (0ull - span) % span;
+            while(low < threshold) {
+                  x = next_u64(rn);
+                  low = x * span;
+            }
+      }
+      
+      return mul_high_u64(x, span);
+}
+
+u32 range_u32(rng* rn, u32 minimum, u32 maximum) {
+      return bounded_u32(rn, (maximum - minimum) + 1) + minimum;
+}
+
+u64 range_u64(rng* rn, u64 minimum, u64 maximum) {
+      return bounded_u64(rn, (maximum - minimum) + 1) + minimum;
+}
+
+s32 range_s32(rng* rn, s32 minimum, s32 maximum) {
+      return (s32)(bounded_u32(rn, ((u32)maximum - (u32)minimum) + 1) + (u32)minimum);
+}
+
+s64 range_s64(rng* rn, s64 minimum, s64 maximum) {
+      return (s64)(bounded_u64(rn, ((u64)maximum - (u64)minimum) + 1) + (u64)minimum);
+}
+
+f32 range_f32(rng* rn, f32 minimum, f32 maximum) {
+      return minimum + (unilateral_closed_f32(rn) * (maximum - minimum));
+}
+
+f64 range_f64(rng* rn, f64 minimum, f64 maximum) {
+      return minimum + (unilateral_closed_f64(rn) * (maximum - minimum));
+}
+
+b8x chance(rng* rn, u32 chance) {
+      return bounded_u32(rn, chance) == 0;
+}
+
+void init_bounded_sampler(bounded_sampler* b, u32 minimum, u32 maximum) {
+      b->minimum = minimum;
+      b->span = (maximum - minimum) + 1;
+      b->threshold = b->span ? ((0u - b->span) % b->span) : 0;
+}
+
+u32 next_bounded(rng* rn, bounded_sampler* b) {
+      if(b->span == 0) return next_u32(rn) + b->minimum;
+      u64 m = (u64)next_u32(rn) * b->span;
+      while((u32)m < b->threshold) m = (u64)next_u32(rn) * b->span;
+      return (u32)(m >> 32) + b->minimum;
+}
+
+// The top bits become the mantissa of a float in [1, 2), subtracting one leaves an exact multiple of 2^-23 (2^-52).
+#define RNG_F32_ONE 0x3F800000u
+#define RNG_F64_ONE 0x3FF0000000000000ull
+
+f32 unilateral_f32(rng* rn) {
+      return f32_from_u32((next_u32(rn) >> 9) | RNG_F32_ONE) - 1.0f;
+}
+
+f32 bilateral_f32(rng* rn) {
+      return unilateral_f32(rn) * 2.0f - 1.0f;
+}
+
+f64 unilateral_f64(rng* rn) {
+      return f64_from_u64((next_u64(rn) >> 12) | RNG_F64_ONE) - 1.0;
+}
+
+f64 bilateral_f64(rng* rn) {
+      return unilateral_f64(rn) * 2.0 - 1.0;
+}
+
+f32 unilateral_open_f32(rng* rn) {
+      // Shifted by half a step, (2k + 1) * 2^-24 still fits the 24 bit significand.
+      return unilateral_f32(rn) + (1.0f / 16777216.0f);
+}
+
+f64 unilateral_open_f64(rng* rn) {
+      return unilateral_f64(rn) + (1.0 / 9007199254740992.0);
+}
+
+f32 unilateral_closed_f32(rng* rn) {
+      // 2^24 + 1 evenly spaced values including both ends.
+      return (f32)bounded_u32(rn, (1u << 24) + 1) * (1.0f / 16777216.0f);
+}
+
+f64 unilateral_closed_f64(rng* rn) {
+      return (f64)bounded_u64(rn, (1ull << 53) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// Four xoshiro256++ generators, state word w of lane l is s[w][l] so one word of every lane fills one avx2 register.
+// Every step yields one u64 per lane, stored as 8 u32 in lane order.
+struct rng_lanes {
+      u64 s[4][4];
+};
+
+// Values produced per chunk, the bulk APIs convert each chunk while it is still in l1.
+#define RNG_FILL_CHUNK 1024
+
+internal void seed_rng_lanes(rng_lanes* lanes, rng* rn) {
+      u64 x = next_u64(rn);
+      for(u32 lane = 0; lane < 4; ++lane) {
+            for(u32 word = 0; word < 4; ++word) lanes->s[word][lane] = rng_splitmix64(&x);
+      }
+}
+
+internal void fill_rng_lanes_blocks(rng_lanes* lanes, u32* out, sz blocks) {
+#if SIMD >= AVX2
+      __m256i s0 = _mm256_loadu_si256((__m256i*)lanes->s[0]);
+      __m256i s1 = _mm256_loadu_si256((__m256i*)lanes->s[1]);
+      __m256i s2 = _mm256_loadu_si256((__m256i*)lanes->s[2]);
+      __m256i s3 = _mm256_loadu_si256((__m256i*)lanes->s[3]);
+      for(sz i = 0; i < blocks; ++i) {
+            __m256i sum = _mm256_add_epi64(s0, s3);
+            __m256i result = _mm256_add_epi64(_mm256_or_si256(_mm256_slli_epi64(sum, 23), _mm256_srli_epi64(sum, 41)), s0);
+            __m256i t = _mm256_slli_epi64(s1, 17);
+            s2 = _mm256_xor_si256(s2, s0);
+            s3 = _mm256_xor_si256(s3, s1);
+            s1 = _mm256_xor_si256(s1, s2);
+            s0 = _mm256_xor_si256(s0, s3);
+            s2 = _mm256_xor_si256(s2, t);
+            s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+            _mm256_storeu_si256((__m256i*)(out + i * 8), result);
+      }
+      
+      _mm256_storeu_si256((__m256i*)lanes->s[0], s0);
+      _mm256_storeu_si256((__m256i*)lanes->s[1], s1);
+      _mm256_storeu_si256((__m256i*)lanes->s[2], s2);
+      _mm256_storeu_si256((__m256i*)lanes->s[3], s3);
+#elif SIMD >= SSE2
+      // Lanes 0-1 and 2-3 in two registers per state word.
+      for(u32 half = 0; half < 2; ++half) {
+            __m128i s0 = _mm_loadu_si128((__m128i*)(lanes->s[0] + half * 2));
+            __m128i s1 = _mm_loadu_si128((__m128i*)(lanes->s[1] + half * 2));
+            __m128i s2 = _mm_loadu_si128((__m128i*)(lanes->s[2] + half * 2));
+            __m128i s3 = _mm_loadu_si128((__m128i*)(lanes->s[3] + half * 2));
+            for(sz i = 0; i < blocks; ++i) {
+                  __m128i sum = _mm_add_epi64(s0, s3);
+                  __m128i result = _mm_add_epi64(_mm_or_si128(_mm_slli_epi64(sum, 23), _mm_srli_epi64(sum, 41)), s0);
+                  __m128i t = _mm_slli_epi64(s1, 17);
+                  s2 = _mm_xor_si128(s2, s0);
+                  s3 = _mm_xor_si128(s3, s1);
+                  s1 = _mm_xor_si128(s1, s2);
+                  s0 = _mm_xor_si128(s0, s3);
+                  s2 = _mm_xor_si128(s2, t);
+                  s3 = _mm_or_si128(_mm_slli_epi64(s3, 45), _mm_srli_epi64(s3, 19));
+                  _mm_storeu_si128((__m128i*)(out + i * 8 + half * 4), result);
+            }
+            
+            _mm_storeu_si128((__m128i*)(lanes->s[0] + half * 2), s0);
+            _mm_storeu_si128((__m128i*)(lanes->s[1] + half * 2), s1);
+            _mm_storeu_si128((__m128i*)(lanes->s[2] + half * 2), s2);
+            _mm_storeu_si128((__m128i*)(lanes->s[3] + half * 2), s3);
+      }
+#else
+      for(sz i = 0; i < blocks; ++i) {
+            for(u32 lane = 0; lane < 4; ++lane) {
+                  u64 s0 = lanes->s[0][lane], s1 = lanes->s[1][lane], s2 = lanes->s[2][lane], s3 = lanes->s[3][lane];
+                  u64 result = rotate_left(s0 + s3, 23) + s0;
+                  u64 t = s1 << 17;
+                  s2 ^= s0;
+                  s3 ^= s1;
+                  s1 ^= s2;
+                  s0 ^= s3;
+                  s2 ^= t;
+                  lanes->s[0][lane] = s0;
+                  lanes->s[1][lane] = s1;
+                  lanes->s[2][lane] = s2;
+                  lanes->s[3][lane] = rotate_left(s3, 45);
+                  out[i * 8 + lane * 2 + 0] = (u32)result;
+                  out[i * 8 + lane * 2 + 1] = (u32)(result >> 32);
+            }
+      }
+#endif
+}
+
+internal void fill_rng_lanes(rng_lanes* lanes, u32* out, sz count) {
+      sz blocks = count / 8;
+      fill_rng_lanes_blocks(lanes, out, blocks);
+      if(count % 8) {
+            u32 tail[8];
+            fill_rng_lanes_blocks(lanes, tail, 1);
+            copy_array(out + blocks * 8, tail, count % 8);
+      }
+}
+
+void fill_u32(rng* rn, u32* out, sz count) {
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      fill_rng_lanes(&lanes, out, count);
+}
+
+// Same construction as unilateral_f32, in place is fine.
+internal void unilateral_f32_from_bits(u32* bits, f32* out, sz count) {
+      sz i = 0;
+#if SIMD >= AVX2
+      __m256i one_bits = _mm256_set1_epi32((s32)RNG_F32_ONE);
+      __m256 one = _mm256_set1_ps(1.0f);
+      for(; i + 8 <= count; i += 8) {
+            __m256i x = _mm256_or_si256(_mm256_srli_epi32(_mm256_loadu_si256((__m256i*)(bits + i)), 9), one_bits);
+            _mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_castsi256_ps(x), one));
+      }
+#elif SIMD >= SSE2
+      __m128i one_bits = _mm_set1_epi32((s32)RNG_F32_ONE);
+      __m128 one = _mm_set1_ps(1.0f);
+      for(; i + 4 <= count; i += 4) {
+            __m128i x = _mm_or_si128(_mm_srli_epi32(_mm_loadu_si128((__m128i*)(bits + i)), 9), one_bits);
+            _mm_storeu_ps(out + i, _mm_sub_ps(_mm_castsi128_ps(x), one));
+      }
+#endif
+      for(; i < count; ++i) {
+            out[i] = f32_from_u32((bits[i] >> 9) | RNG_F32_ONE) - 1.0f;
+      }
+}
+
+void fill_f32_unit(rng* rn, f32* out, sz count) {
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK) {
+            // Generate into the output, then rebuild the values in place.
+            sz n = min(count - at, (sz)RNG_FILL_CHUNK);
+            fill_rng_lanes(&lanes, (u32*)(out + at), n);
+            unilateral_f32_from_bits((u32*)(out + at), out + at, n);
+      }
+}
+
+void fill_f64_unit(rng* rn, f64* out, sz count) {
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK / 2) {
+            // Each value takes one lane output (two u32 in lane order).
+            u64* bits = (u64*)(out + at);
+            sz n = min(count - at, (sz)RNG_FILL_CHUNK / 2);
+            fill_rng_lanes(&lanes, (u32*)bits, n * 2);
+            
+            sz i = 0;
+#if SIMD >= AVX2
+            __m256i one_bits = _mm256_set1_epi64x((s64)RNG_F64_ONE);
+            __m256d one = _mm256_set1_pd(1.0);
+            for(; i + 4 <= n; i += 4) {
+                  __m256i x = _mm256_or_si256(_mm256_srli_epi64(_mm256_loadu_si256((__m256i*)(bits + i)), 12), one_bits);
+                  _mm256_storeu_pd(out + at + i, _mm256_sub_pd(_mm256_castsi256_pd(x), one));
+            }
+#elif SIMD >= SSE2
+            __m128i one_bits = _mm_set1_epi64x((s64)RNG_F64_ONE);
+            __m128d one = _mm_set1_pd(1.0);
+            for(; i + 2 <= n; i += 2) {
+                  __m128i x = _mm_or_si128(_mm_srli_epi64(_mm_loadu_si128((__m128i*)(bits + i)), 12), one_bits);
+                  _mm_storeu_pd(out + at + i, _mm_sub_pd(_mm_castsi128_pd(x), one));
+            }
+#endif
+            for(; i < n; ++i) {
+                  out[at + i] = f64_from_u64((bits[i] >> 12) | RNG_F64_ONE) - 1.0;
+            }
+      }
+}
+
+// One chunk of fill_range_u32: multiply-shift in lanes, lanes whose low half is below the threshold are redrawn from rn.
+internal void fill_bounded_lanes(rng_lanes* lanes, rng* rn, bounded_sampler* b, u32* x, sz n) {
+      u32 span = b->span;
+      u32 threshold = b->threshold;
+      u32 minimum = b->minimum;
+      fill_rng_lanes(lanes, x, n);
+      
+      sz i = 0;
+#if SIMD >= AVX2
+      __m256i bias = _mm256_set1_epi32(S32_MIN);
+      __m256i spans = _mm256_set1_epi32((s32)span);
+      __m256i limit = _mm256_xor_si256(_mm256_set1_epi32((s32)threshold), bias);
+      __m256i base = _mm256_set1_epi32((s32)minimum);
+      for(; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256((__m256i*)(x + i));
+            __m256i even = _mm256_mul_epu32(v, spans);
+            __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), spans);
+            __m256i high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+            __m256i low = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+            u32 rejected = (u32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, _mm256_xor_si256(low, bias))));
+            _mm256_storeu_si256((__m256i*)(x + i), _mm256_add_epi32(high, base));
+            for(; rejected; rejected &= rejected - 1) {
+                  x[i + trailing_ones(~rejected)] = next_bounded(rn, b);
+            }
+      }
+#elif SIMD >= SSE2
+      __m128i bias = _mm_set1_epi32(S32_MIN);
+      __m128i spans = _mm_set1_epi32((s32)span);
+      __m128i limit = _mm_xor_si128(_mm_set1_epi32((s32)threshold), bias);
+      __m128i base = _mm_set1_epi32((s32)minimum);
+      __m128i odd_mask = _mm_set_epi32(-1, 0, -1, 0);
+      for(; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((__m128i*)(x + i));
+            __m128i even = _mm_mul_epu32(v, spans);
+            __m128i odd = _mm_mul_epu32(_mm_srli_epi64(v, 32), spans);
+            __m128i high = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_and_si128(odd, odd_mask));
+            __m128i low = _mm_or_si128(_mm_andnot_si128(odd_mask, even), _mm_slli_epi64(odd, 32));
+            u32 rejected = (u32)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_xor_si128(low, bias), limit)));
+            _mm_storeu_si128((__m128i*)(x + i), _mm_add_epi32(high, base));
+            for(; rejected; rejected &= rejected - 1) {
+                  x[i + trailing_ones(~rejected)] = next_bounded(rn, b);
+            }
+      }
+#endif
+      for(; i < n; ++i) {
+            u64 m = (u64)x[i] * span;
+            x[i] = ((u32)m < threshold) ? next_bounded(rn, b) : (u32)(m >> 32) + minimum;
+      }
+}
+
+void fill_range_u32(rng* rn, u32* out, sz count, u32 minimum, u32 maximum) {
+      bounded_sampler b;
+      init_bounded_sampler(&b, minimum, maximum);
+      if(b.span == 0) {
+            fill_u32(rn, out, count);
+            return;
+      }
+      
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK) {
+            fill_bounded_lanes(&lanes, rn, &b, out + at, min(count - at, (sz)RNG_FILL_CHUNK));
+      }
+}
+
+// Blocks counter .. counter + 7 (4 for sse2) are evaluated side by side, word w of every block in one register.
+internal void fill_philox_blocks(u64 key, u64 stream, u64 counter, u32* out, sz blocks) {
+      sz b = 0;
+#if SIMD >= AVX2
+      __m256i m0 = _mm256_set1_epi32((s32)PHILOX_M0);
+      __m256i m1 = _mm256_set1_epi32((s32)PHILOX_M1);
+      for(; b + 8 <= blocks; b += 8) {
+            u32 low[8], high[8];
+            for(u32 j = 0; j < 8; ++j) {
+                  u64 c = counter + b + j;
+                  low[j] = (u32)c;
+                  high[j] = (u32)(c >> 32);
+            }
+            
+            // Counters wrapping into the stream words is left out, it takes 2^64 blocks.
+            __m256i c0 = _mm256_loadu_si256((__m256i*)low);
+            __m256i c1 = _mm256_loadu_si256((__m256i*)high);
+            __m256i c2 = _mm256_set1_epi32((s32)(u32)stream);
+            __m256i c3 = _mm256_set1_epi32((s32)(u32)(stream >> 32));
+            u32 k0 = (u32)key;
+            u32 k1 = (u32)(key >> 32);
+            for(u32 round = 0; round < 10; ++round) {
+                  __m256i p0_even = _mm256_mul_epu32(c0, m0);
+                  __m256i p0_odd = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+                  __m256i p1_even = _mm256_mul_epu32(c2, m1);
+                  __m256i p1_odd = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+                  __m256i p0_high = _mm256_blend_epi32(_mm256_srli_epi64(p0_even, 32), p0_odd, 0xAA);
+                  __m256i p0_low = _mm256_blend_epi32(p0_even, _mm256_slli_epi64(p0_odd, 32), 0xAA);
+                  __m256i p1_high = _mm256_blend_epi32(_mm256_srli_epi64(p1_even, 32), p1_odd, 0xAA);
+                  __m256i p1_low = _mm256_blend_epi32(p1_even, _mm256_slli_epi64(p1_odd, 32), 0xAA);
+                  c0 = _mm256_xor_si256(_mm256_xor_si256(p1_high, c1), _mm256_set1_epi32((s32)k0));
+                  c1 = p1_low;
+                  c2 = _mm256_xor_si256(_mm256_xor_si256(p0_high, c3), _mm256_set1_epi32((s32)k1));
+                  c3 = p0_low;
+                  k0 += PHILOX_W0;
+                  k1 += PHILOX_W1;
+            }
+            
+            // 4x4 transposes inside each 128 bit half give blocks j and j + 4, then the halves are regrouped.
+            __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+            __m256i t1 = _mm256_unpacklo_epi32(c2, c3);
+            __m256i t2 = _mm256_unpackhi_epi32(c0, c1);
+            __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+            __m256i r0 = _mm256_unpacklo_epi64(t0, t1);
+            __m256i r1 = _mm256_unpackhi_epi64(t0, t1);
+            __m256i r2 = _mm256_unpacklo_epi64(t2, t3);
+            __m256i r3 = _mm256_unpackhi_epi64(t2, t3);
+            __m256i* at = (__m256i*)(out + b * 4);
+            _mm256_storeu_si256(at + 0, _mm256_permute2x128_si256(r0, r1, 0x20));
+            _mm256_storeu_si256(at + 1, _mm256_permute2x128_si256(r2, r3, 0x20));
+            _mm256_storeu_si256(at + 2, _mm256_permute2x128_si256(r0, r1, 0x31));
+            _mm256_storeu_si256(at + 3, _mm256_permute2x128_si256(r2, r3, 0x31));
+      }
+#elif SIMD >= SSE2
+      __m128i m0 = _mm_set1_epi32((s32)PHILOX_M0);
+      __m128i m1 = _mm_set1_epi32((s32)PHILOX_M1);
+      __m128i odd_mask = _mm_set_epi32(-1, 0, -1, 0);
+      for(; b + 4 <= blocks; b += 4) {
+            u64 c = counter + b;
+            __m128i c0 = _mm_set_epi32((s32)(u32)(c + 3), (s32)(u32)(c + 2), (s32)(u32)(c + 1), (s32)(u32)c);
+            __m128i c1 = _mm_set_epi32((s32)(u32)((c + 3) >> 32), (s32)(u32)((c + 2) >> 32), (s32)(u32)((c + 1) >> 32), (s32)(u32)(c >> 32));
+            __m128i c2 = _mm_set1_epi32((s32)(u32)stream);
+            __m128i c3 = _mm_set1_epi32((s32)(u32)(stream >> 32));
+            u32 k0 = (u32)key;
+            u32 k1 = (u32)(key >> 32);
+            for(u32 round = 0; round < 10; ++round) {
+                  __m128i p0_even = _mm_mul_epu32(c0, m0);
+                  __m128i p0_odd = _mm_mul_epu32(_mm_srli_epi64(c0, 32), m0);
+                  __m128i p1_even = _mm_mul_epu32(c2, m1);
+                  __m128i p1_odd = _mm_mul_epu32(_mm_srli_epi64(c2, 32), m1);
+                  __m128i p0_high = _mm_or_si128(_mm_srli_epi64(p0_even, 32), _mm_and_si128(p0_odd, odd_mask));
+                  __m128i p0_low = _mm_or_si128(_mm_andnot_si128(odd_mask, p0_even), _mm_slli_epi64(p0_odd, 32));
+                  __m128i p1_high = _mm_or_si128(_mm_srli_epi64(p1_even, 32), _mm_and_si128(p1_odd, odd_mask));
+                  __m128i p1_low = _mm_or_si128(_mm_andnot_si128(odd_mask, p1_even), _mm_slli_epi64(p1_odd, 32));
+                  c0 = _mm_xor_si128(_mm_xor_si128(p1_high, c1), _mm_set1_epi32((s32)k0));
+                  c1 = p1_low;
+                  c2 = _mm_xor_si128(_mm_xor_si128(p0_high, c3), _mm_set1_epi32((s32)k1));
+                  c3 = p0_low;
+                  k0 += PHILOX_W0;
+                  k1 += PHILOX_W1;
+            }
+            
+            __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+            __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+            __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+            __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+            __m128i* at = (__m128i*)(out + b * 4);
+            _mm_storeu_si128(at + 0, _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128(at + 1, _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128(at + 2, _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128(at + 3, _mm_unpackhi_epi64(t2, t3));
+      }
+#endif
+      for(; b < blocks; ++b) {
+            philox_block block = philox(key, counter + b, stream);
+            copy_array(out + b * 4, block.x, 4);
+      }
+}
+
+void fill_philox_u32(u64 key, u64 stream, u64 first, u32* out, sz count) {
+      // A start inside a block takes the rest of that block first.
+      u64 counter = first / 4;
+      u32 skip = (u32)(first % 4);
+      if(skip && count) {
+            philox_block block = philox(key, counter++, stream);
+            sz n = min(count, (sz)(4 - skip));
+            copy_array(out, block.x + skip, n);
+            out += n;
+            count -= n;
+      }
+      
+      fill_philox_blocks(key, stream, counter, out, count / 4);
+      if(count % 4) {
+            philox_block block = philox(key, counter + count / 4, stream);
+            copy_array(out + (count & ~(sz)3), block.x, count % 4);
+      }
+}
+
+void fill_philox_f32_unit(u64 key, u64 stream, u64 first, f32* out, sz count) {
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK) {
+            sz n = min(count - at, (sz)RNG_FILL_CHUNK);
+            fill_philox_u32(key, stream, first + at, (u32*)(out + at), n);
+            unilateral_f32_from_bits((u32*)(out + at), out + at, n);
+      }
+}
+
+// Double precision math for the samplers, the f32 helpers above are too coarse for the tails.
+#define SAMPLE_LN2 0.69314718055994530942
+#define SAMPLE_LN2_HIGH 6.93147180369123816490e-01
+#define SAMPLE_LN2_LOW 1.90821492927058770002e-10
+#define SAMPLE_SQRT2 1.41421356237309504880
+
+internal f64 sample_sqrt(f64 x) {
+#if SIMD >= SSE2
+      return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(x)));
+#else
+      if(x <= 0.0) return 0.0;
+      f64 y = f64_from_u64((f64_to_u64(x) >> 1) + 0x1FF8000000000000ull);
+      for(u32 i = 0; i < 5; ++i) y = 0.5 * (y + x / y);
+      return y;
+#endif
+}
+
+// Positive normal inputs only, x = m * 2^e with m around 1 and log(m) = 2 * atanh((m - 1) / (m + 1)).
+internal f64 sample_log(f64 x) {
+      u64 bits = f64_to_u64(x);
+      f64 e = (f64)((s32)((bits >> 52) & 0x7FF) - 1023);
+      f64 m = f64_from_u64((bits & 0x000FFFFFFFFFFFFFull) | RNG_F64_ONE);
+      if(m > SAMPLE_SQRT2) {
+            m *= 0.5;
+            e += 1.0;
+      }
+      
+      f64 s = (m - 1.0) / (m + 1.0);
+      f64 s2 = s * s;
+      f64 series = 1.0 / 21.0;
+      for(s32 k = 9; k >= 0; --k) series = series * s2 + 1.0 / (f64)(2 * k + 1);
+      return e * SAMPLE_LN2 + 2.0 * s * series;
+}
+
+// Range reduction to |r| <= ln(2) / 2 then a degree 13 taylor series.
+internal f64 sample_exp(f64 x) {
+      if(x > 709.0) return F64_MAX;
+      if(x < -708.0) return 0.0;
+      
+      s64 k = (s64)(x * (1.0 / SAMPLE_LN2) + ((x >= 0.0) ? 0.5 : -0.5));
+      f64 r = (x - (f64)k * SAMPLE_LN2_HIGH) - (f64)k * SAMPLE_LN2_LOW;
+      f64 series = 1.0;
+      for(s32 n = 13; n >= 1; --n) series = 1.0 + series * r / (f64)n;
+      return series * f64_from_u64((u64)(k + 1023) << 52);
+}
+
+internal f64 sample_floor(f64 x) {
+      f64 t = (f64)(s64)x;
+      return (t > x) ? t - 1.0 : t;
+}
+
+// Log of the gamma function, stirling series with the argument shifted up to 7 first.
+internal f64 sample_log_gamma(f64 x) {
+      local_persist const f64 a[10] = {
+            8.333333333333333e-02, -2.777777777777778e-03, 7.936507936507937e-04, -5.952380952380952e-04, 8.417508417508418e-04,
+            -1.917526917526918e-03, 6.410256410256410e-03, -2.955065359477124e-02, 1.796443723688307e-01, -1.39243221690590e+00,
+      };
+      
+      if((x == 1.0) || (x == 2.0)) return 0.0;
+      s32 shift = (x < 7.0) ? (7 - (s32)x) : 0;
+      f64 x0 = x + shift;
+      f64 x2 = 1.0 / (x0 * x0);
+      f64 series = a[9];
+      for(s32 k = 8; k >= 0; --k) series = series * x2 + a[k];
+      
+      f64 result = series / x0 + 0.91893853320467274178 + (x0 - 0.5) * sample_log(x0) - x0;
+      for(s32 k = 0; k < shift; ++k) {
+            x0 -= 1.0;
+            result -= sample_log(x0);
+      }
+      
+      return result;
+}
+
+// Ziggurats with 256 layers (Marsaglia and Tsang, table layout as in Doornik's zignor).
+// Layer edges x[i] shrink towards x[256] = 0, x[0] is the width of the base strip that also covers the tail past x[1] = r.
+// The low 8 bits of a draw pick the layer, the top 52 bits the position, so most draws cost one multiply and one compare.
+#define ZIGGURAT_NORMAL_R 3.654152885361008796
+#define ZIGGURAT_EXPONENTIAL_R 7.697117470131050077
+
+global_variable const f64 ziggurat_normal_x[257] = {
+      3.9107579595249167, 3.654152885361009, 3.449278298561431, 3.320244733839825,
+      3.224575052047801, 3.147889289518, 3.0835261320021425, 3.027837791769593,
+      2.9786032798818427, 2.934366867208887, 2.894121053613412, 2.857138730873224,
+      2.8228773968264425, 2.790921174001927, 2.7609440052799856, 2.732685359044011,
+      2.7059336561230616, 2.6805146432857443, 2.6562830375767423, 2.633116393631582,
+      2.6109105184888226, 2.5895759867082857, 2.5690354526818426, 2.549221550324782,
+      2.5300752321598527, 2.5115444416266928, 2.4935830412710454, 2.4761499396705218,
+      2.4592083743347035, 2.4427253182003628, 2.4266709849371453, 2.411018413901118,
+      2.395743119781926, 2.3808227951720844, 2.36623705671729, 2.351967227379144,
+      2.337996148796528, 2.324308018871132, 2.3108882506013715, 2.297723348902863,
+      2.2848008027244915, 2.2721089902283813, 2.259637095173787, 2.2473750329473887,
+      2.2353133849299205, 2.2234433400925098, 2.21175664288416, 2.2002455466112756,
+      2.18890277162636, 2.177721467740292, 2.1666951803543073, 2.155817819876736,
+      2.1450836340478876, 2.1344871828460157, 2.1240233156895223, 2.1136871506866517,
+      2.1034740557148757, 2.09337963113879, 2.083399693998303, 2.0735302635187414,
+      2.0637675478117306, 2.0541079316506505, 2.04454796521753, 2.0350843537296175,
+      2.025713947863853, 2.0164337349062027, 2.0072408305605274, 1.9981324713584183,
+      1.9891060076174367, 1.9801588969004753, 1.971288697933658, 1.9624930649443617,
+      1.9537697423846454, 1.9451165600086768, 1.9365314282756931, 1.928012334052664,
+      1.9195573365931864, 1.9111645637712515, 1.9028322085504275, 1.894558525670703,
+      1.886341828536781, 1.878180486292994, 1.870072921071265, 1.8620176053996724,
+      1.8540130597602003, 1.8460578502851839, 1.838150586582805, 1.8302899196827553,
+      1.8224745400938844, 1.8147031759662813, 1.8069745913508195, 1.7992875845497187,
+      1.791640986552161, 1.78403365954944, 1.7764644955245215, 1.7689324149112673,
+      1.7614363653189091, 1.7539753203176704, 1.7465482782817214, 1.7391542612859108,
+      1.7317923140529623, 1.7244615029480441, 1.7171609150178224, 1.7098896570713011,
+      1.7026468547999223, 1.6954316519345607, 1.6882432094371944, 1.681080704725173,
+      1.6739433309261242, 1.6668302961616648, 1.6597408228581818, 1.6526741470830553,
+      1.6456295179047817, 1.638606196775547, 1.6316034569348727, 1.624620582833034,
+      1.617656869573015, 1.6107116223698297, 1.6037841560260941, 1.5968737944227878,
+      1.5899798700241905, 1.583101723396029, 1.576238702735906, 1.5693901634151233,
+      1.5625554675310445, 1.5557339834691761, 1.5489250854741732, 1.5421281532290017,
+      1.5353425714415139, 1.528567729437712, 1.5218030207609978, 1.5150478427767144,
+      1.5083015962813113, 1.5015636851154637, 1.4948335157804935, 1.4881104970574472,
+      1.481394039628187, 1.4746835556978553, 1.4679784586180793, 1.4612781625102753,
+      1.45458208188841, 1.4478896312805758, 1.4412002248487237, 1.4345132760058918,
+      1.4278281970302555, 1.4211443986753085, 1.4144612897754707, 1.4077782768463982,
+      1.4010947636792503, 1.3944101509281404, 1.3877238356899755, 1.3810352110758548,
+      1.3743436657731656, 1.3676485835974754, 1.3609493430332822, 1.354245316762634,
+      1.3475358711805863, 1.340820365896403, 1.334098153219359, 1.3273685776279247,
+      1.3206309752210552, 1.3138846731502194, 1.30712898903073, 1.3003632303308361,
+      1.2935866937369467, 1.2867986644932425, 1.279998415713817, 1.2731852076653554,
+      1.2663582870182284, 1.2595168860637131, 1.2526602218948961, 1.2457874955486261,
+      1.2388978911056863, 1.231990574746135, 1.2250646937565297, 1.2181193754854807,
+      1.2111537262436982, 1.2041668301443804, 1.1971577478794404, 1.190125515426691,
+      1.1830691426826856, 1.1759876120154509, 1.1688798767308322, 1.1617448594456106,
+      1.1545814503599268, 1.1473885054208481, 1.1401648443681505, 1.132909248652533,
+      1.1256204592155323, 1.1182971741193437, 1.1109380460135743, 1.1035416794246382,
+      1.09610662785202, 1.0886313906539782, 1.0811144097034022, 1.0735540657924345,
+      1.0659486747621207, 1.0582964833306734, 1.0505956645909282, 1.0428443131441474,
+      1.0350404398334394, 1.0271819660356445, 1.019266717465483, 1.0112924174399947,
+      1.003256679544672, 0.9951569996350901, 0.9869907470990615, 0.9787551552942237,
+      0.9704473110642236, 0.9620641432230397, 0.9536024098810852, 0.9450586844681645,
+      0.9364293402865742, 0.9277105334019992, 0.9188981836495896, 0.9099879534967176,
+      0.9009752244612208, 0.8918550707329405, 0.8826222295851646, 0.8732710680888597,
+      0.8637955455533078, 0.8541891710081628, 0.844444954909153, 0.834555354086381,
+      0.8245122087522911, 0.8143066701352142, 0.8039291169899702, 0.7933690588406223,
+      0.782615023307232, 0.7716544242245669, 0.7604734064301069, 0.7490566620178141,
+      0.7373872114342944, 0.7254461409099985, 0.7132122851909748, 0.7006618411068138,
+      0.6877678927957872, 0.6744998228372925, 0.6608225742444183, 0.6466957148949922,
+      0.6320722363860595, 0.6168969900077496, 0.6011046177559908, 0.5846167661063775,
+      0.5673382570538168, 0.549151702327163, 0.529909720661556, 0.5094233296020896,
+      0.4874439661392335, 0.4636343367908794, 0.4375184022078686, 0.40838913461198767,
+      0.3751213328783766, 0.33573751921442047, 0.2861745917920662, 0.21524189598487156,
+      0.0,
+};
+
+global_variable const f64 ziggurat_exponential_x[257] = {
+      8.697117470131051, 7.69711747013105, 6.941033629377213, 6.47837849383257,
+      6.144164665772473, 5.8821443157954, 5.666410167454034, 5.4828906275260625,
+      5.323090505754398, 5.1814872813015, 5.054288489981304, 4.9387770859012505,
+      4.832939741025112, 4.735242996601741, 4.644491885420085, 4.559737061707351,
+      4.480211746528422, 4.405287693473573, 4.334443680317273, 4.267242480277366,
+      4.203313713735184, 4.1423408656640515, 4.084051310408298, 4.028208544647937,
+      3.974606066673789, 3.9230625001354897, 3.873417670399509, 3.8255294185223367,
+      3.779270992411668, 3.7345288940397974, 3.691201090237419, 3.6491955157608538,
+      3.6084288131289095, 3.568825265648337, 3.5303158891293434, 3.4928376547740596,
+      3.45633282113276, 3.42074835725112, 3.386035442460301, 3.3521490309001094,
+      3.319047470970748, 3.2866921715990687, 3.25504730857045, 3.224079565286264,
+      3.1937579032122403, 3.164053358025973, 3.1349388580844404, 3.1063890623398245,
+      3.0783802152540902, 3.050890016615455, 3.0238975044556766, 2.9973829495161306,
+      2.9713277599210897, 2.9457143948950457, 2.920526286512741, 2.895747768600142,
+      2.8713640120155364, 2.847360965635189, 2.8237253024500353, 2.800444370250738,
+      2.7775061464397566, 2.7548991965623446, 2.7326126361947, 2.7106360958679288,
+      2.6889596887418037, 2.6675739807732666, 2.646469963151809, 2.6256390267977885,
+      2.6050729387408356, 2.5847638202141408, 2.5647041263169053, 2.54488662711187,
+      2.525304390037828, 2.505950763528594, 2.4868193617402095, 2.467904050297365,
+      2.4491989329782498, 2.4306983392644197, 2.4123968126888706, 2.394289099921458,
+      2.3763701405361406, 2.3586350574093373, 2.3410791477030344, 2.3236978743901964,
+      2.30648685828358, 2.2894418705322694, 2.272558825553155, 2.255833774367219,
+      2.239262898312909, 2.222842503111037, 2.206569013257664, 2.19043896672322,
+      2.1744490099377747, 2.158595893043886, 2.142876465399842, 2.1272876713173683,
+      2.111826546019042, 2.096490211801715, 2.081275874393225, 2.0661808194905755,
+      2.051202409468585, 2.0363380802487696, 2.021585338318926, 2.0069417578945186,
+      1.9924049782135766, 1.9779727009573604, 1.9636426877895483, 1.949412758007185,
+      1.9352807862970514, 1.921244700591528, 1.9073024800183875, 1.8934521529393082,
+      1.8796917950722112, 1.866019527692828, 1.8524335159111756, 1.83893196701888,
+      1.8255131289035198, 1.8121752885263906, 1.7989167704602909, 1.785735935484126,
+      1.7726311792313056, 1.7596009308890748, 1.7466436519460744, 1.7337578349855716,
+      1.7209420025219353, 1.7081947058780578, 1.695514524101538, 1.682900062917554,
+      1.6703499537164521, 1.6578628525741728, 1.6454374393037237, 1.6330724165359913,
+      1.620766508828258, 1.6085184617988584, 1.5963270412864834, 1.584191032532689,
+      1.5721092393862297, 1.560080483527888, 1.5481036037145135, 1.536177455041032,
+      1.5243009082192263, 1.512472848872117, 1.5006921768428167, 1.488957805516746,
+      1.4772686611561339, 1.4656236822457454, 1.4540218188487934, 1.4424620319720125,
+      1.4309432929388797, 1.4194645827699832, 1.4080248915695357, 1.3966232179170421,
+      1.3852585682631222, 1.3739299563284908, 1.362636402505087, 1.3513769332583354,
+      1.340150580529505, 1.328956381137117, 1.3177933761763252, 1.3066606104151746,
+      1.2955571316866015, 1.284481990275013, 1.2734342382962416, 1.2624129290696158,
+      1.251417116480853, 1.240445854334407, 1.2294981956938498, 1.218573192208791,
+      1.2076698934267622, 1.196787346088404, 1.185924593404203, 1.1750806743109123,
+      1.1642546227056796, 1.1534454666557754, 1.1426522275816735, 1.1318739194110792,
+      1.121109547701331, 1.110358108727412, 1.0996185885325982, 1.088889961938548,
+      1.0781711915113732, 1.0674612264799688, 1.0567590016025523, 1.046063435977045,
+      1.0353734317905294, 1.0246878730026183, 1.0140056239570978, 1.003325527915698,
+      0.9926464055072772, 0.9819670530850639, 0.9712862409839048, 0.960602711668668,
+      0.9499151777640774, 0.9392223199552638, 0.928522784747212, 0.9178151820700458,
+      0.9070980827156918, 0.8963700155898915, 0.8856294647617531, 0.8748748662910267,
+      0.864104604811006, 0.8533170098423749, 0.84251035181037, 0.8316828377342746,
+      0.8208326065544134, 0.80995772405742, 0.7990561773554887, 0.7881258688694941,
+      0.7771646097591313, 0.7661701127354362, 0.7551399841819838, 0.7440717155005095,
+      0.732962673584367, 0.7218100903087578, 0.7106110509096565, 0.6993624811032334,
+      0.6880611327737494, 0.6767035680295241, 0.6652861413926794, 0.6538049798476665,
+      0.6422559604245379, 0.630634684933492, 0.6189364513948777, 0.6071562216203017,
+      0.5952885842915044, 0.5833277127487712, 0.5712673165325899, 0.5591005855115422,
+      0.5468201251633121, 0.534417881237167, 0.5218850515921366, 0.509211982443656,
+      0.4963880455186726, 0.4834014916534633, 0.47023927508217045, 0.4568868409314218,
+      0.4433278660735541, 0.4295439402254126, 0.41551416960035825, 0.4012146788962796,
+      0.3866179779411214, 0.3716921453299192, 0.3563997602583957, 0.3406964810648512,
+      0.32452911701691145, 0.30783295467493427, 0.2905279554912326, 0.27251318547846703,
+      0.25365836338591446, 0.23379048305967726, 0.21267151063096923, 0.18995868962243467,
+      0.16512762256419042, 0.13730498094001628, 0.10483850756582322, 0.0638521638150076,
+      0.0,
+};
+
+internal f64 ziggurat_normal_pdf(f64 x) {
+      return sample_exp(-0.5 * x * x);
+}
+
+// One ziggurat attempt on the given draw, retried with fresh draws from rn until accepted.
+internal f64 ziggurat_normal(rng* rn, u64 bits) {
+      for(;;) {
+            u32 layer = (u32)(bits & 0xFF);
+            f64 u = f64_from_u64((bits >> 12) | 0x4000000000000000ull) - 3.0;
+            f64 x = u * ziggurat_normal_x[layer];
+            if(((x < 0.0) ? -x : x) < ziggurat_normal_x[layer + 1]) return x;
+            
+            if(layer == 0) {
+                  // Tail past r (Marsaglia 1964).
+                  f64 tail_x, tail_y;
+                  do {
+                        tail_x = sample_log(unilateral_open_f64(rn)) / ZIGGURAT_NORMAL_R;
+                        tail_y = sample_log(unilateral_open_f64(rn));
+                  } while(-2.0 * tail_y < tail_x * tail_x);
+                  return (u < 0.0) ? (tail_x - ZIGGURAT_NORMAL_R) : (ZIGGURAT_NORMAL_R - tail_x);
+            }
+            
+            f64 low = ziggurat_normal_pdf(ziggurat_normal_x[layer]);
+            f64 high = ziggurat_normal_pdf(ziggurat_normal_x[layer + 1]);
+            if(low + (high - low) * unilateral_f64(rn) < ziggurat_normal_pdf(x)) return x;
+            bits = next_u64(rn);
+      }
+}
+
+internal f64 ziggurat_exponential(rng* rn, u64 bits) {
+      for(;;) {
+            u32 layer = (u32)(bits & 0xFF);
+            f64 x = (f64_from_u64((bits >> 12) | RNG_F64_ONE) - 1.0) * ziggurat_exponential_x[layer];
+            if(x < ziggurat_exponential_x[layer + 1]) return x;
+            
+            if(layer == 0) {
+                  // The tail past r is the same distribution shifted by r.
+                  return ZIGGURAT_EXPONENTIAL_R - sample_log(unilateral_open_f64(rn));
+            }
+            
+            f64 low = sample_exp(-ziggurat_exponential_x[layer]);
+            f64 high = sample_exp(-ziggurat_exponential_x[layer + 1]);
+            if(low + (high - low) * unilateral_f64(rn) < sample_exp(-x)) return x;
+            bits = next_u64(rn);
+      }
+}
+
+f32 normal_f32(rng* rn, f32 mean, f32 deviation) {
+      return (f32)(normal_f64(rn) * deviation + mean);
+}
+
+f64 normal_f64(rng* rn, f64 mean, f64 deviation) {
+      return ziggurat_normal(rn, next_u64(rn)) * deviation + mean;
+}
+
+f32 exponential_f32(rng* rn, f32 rate) {
+      return (f32)(exponential_f64(rn) / rate);
+}
+
+f64 exponential_f64(rng* rn, f64 rate) {
+      return ziggurat_exponential(rn, next_u64(rn)) / rate;
+}
+
+// Constants that only depend on the mean, so batches compute them once.
+struct poisson_params {
+      f64 mean;
+      f64 limit; // Knuth: exp(-mean).
+      f64 log_mean; // Ptrs (Hormann 1993) for means of 10 and up.
+      f64 a, b, inverse_alpha, v_r;
+};
+
+internal void init_poisson_params(poisson_params* p, f64 mean) {
+      p->mean = mean;
+      p->limit = sample_exp(-mean);
+      p->log_mean = sample_log(mean);
+      p->b = 0.931 + 2.53 * sample_sqrt(mean);
+      p->a = -0.059 + 0.02483 * p->b;
+      p->inverse_alpha = 1.1239 + 1.1328 / (p->b - 3.4);
+      p->v_r = 0.9277 - 3.6224 / (p->b - 2.0);
+}
+
+internal u32 poisson_internal(rng* rn, poisson_params* p) {
+      if(p->mean < 10.0) {
+            u32 k = 0;
+            f64 product = unilateral_f64(rn);
+            while(product > p->limit) {
+                  product *= unilateral_f64(rn);
+                  k++;
+            }
+            
+            return k;
+      }
+      
+      for(;;) {
+            f64 u = unilateral_f64(rn) - 0.5;
+            f64 v = unilateral_open_f64(rn);
+            f64 us = 0.5 - ((u < 0.0) ? -u : u);
+            f64 k = sample_floor((2.0 * p->a / us + p->b) * u + p->mean + 0.43);
+            if((us >= 0.07) && (v <= p->v_r)) return (u32)k;
+            if((k < 0.0) || ((us < 0.013) && (v > us))) continue;
+            
+            f64 lhs = sample_log(v) + sample_log(p->inverse_alpha) - sample_log(p->a / (us * us) + p->b);
+            f64 rhs = -p->mean + k * p->log_mean - sample_log_gamma(k + 1.0);
+            if(lhs <= rhs) return (u32)k;
+      }
+}
+
+u32 poisson_u32(rng* rn, f64 mean) {
+      poisson_params p;
+      init_poisson_params(&p, mean);
+      return poisson_internal(rn, &p);
+}
+
+// Marsaglia and Tsang, shapes below one are boosted by u^(1 / shape).
+struct gamma_params {
+      f64 shape;
+      f64 d, c;
+};
+
+internal void init_gamma_params(gamma_params* g, f64 shape) {
+      assert(shape > 0.0);
+      g->shape = shape;
+      g->d = ((shape < 1.0) ? (shape + 1.0) : shape) - 1.0 / 3.0;
+      g->c = 1.0 / sample_sqrt(9.0 * g->d);
+}
+
+internal f64 gamma_internal(rng* rn, gamma_params* g) {
+      f64 result = 0.0;
+      for(;;) {
+            f64 x = normal_f64(rn);
+            f64 v = 1.0 + g->c * x;
+            if(v <= 0.0) continue;
+            
+            v = v * v * v;
+            f64 u = unilateral_open_f64(rn);
+            f64 x2 = x * x;
+            if((u < 1.0 - 0.0331 * x2 * x2) || (sample_log(u) < 0.5 * x2 + g->d * (1.0 - v + sample_log(v)))) {
+                  result = g->d * v;
+                  break;
+            }
+      }
+      
+      if(g->shape < 1.0) {
+            result *= sample_exp(sample_log(unilateral_open_f64(rn)) / g->shape);
+      }
+      
+      return result;
+}
+
+f64 gamma_f64(rng* rn, f64 shape, f64 scale) {
+      gamma_params g;
+      init_gamma_params(&g, shape);
+      return gamma_internal(rn, &g) * scale;
+}
+
+f64 beta_f64(rng* rn, f64 a, f64 b) {
+      gamma_params ga, gb;
+      init_gamma_params(&ga, a);
+      init_gamma_params(&gb, b);
+      f64 x = gamma_internal(rn, &ga);
+      f64 y = gamma_internal(rn, &gb);
+      return x / (x + y);
+}
+
+// Ziggurat fast path over a chunk of lane draws, lanes that miss finish in scalar (in index order).
+internal void fill_ziggurat_f32(rng* rn, f32* out, sz count, f64 scale, f64 offset, b8x normal) {
+      u64 bits[RNG_FILL_CHUNK / 2];
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz at = 0; at < count; at += countof(bits)) {
+            sz n = min(count - at, (sz)countof(bits));
+            fill_rng_lanes(&lanes, (u32*)bits, n * 2);
+            
+            sz i = 0;
+#if SIMD >= AVX2
+            const f64* table = normal ? ziggurat_normal_x : ziggurat_exponential_x;
+            __m256i layer_mask = _mm256_set1_epi64x(0xFF);
+            __m256i exponent = _mm256_set1_epi64x(normal ? 0x4000000000000000ll : (s64)RNG_F64_ONE);
+            __m256d shift = _mm256_set1_pd(normal ? 3.0 : 1.0);
+            __m256d magnitude = _mm256_castsi256_pd(_mm256_set1_epi64x(S64_MAX));
+            __m256d scales = _mm256_set1_pd(scale);
+            __m256d offsets = _mm256_set1_pd(offset);
+            for(; i + 4 <= n; i += 4) {
+                  __m256i b = _mm256_loadu_si256((__m256i*)(bits + i));
+                  __m256i layer = _mm256_and_si256(b, layer_mask);
+                  __m256d width = _mm256_i64gather_pd(table, layer, 8);
+                  __m256d inner = _mm256_i64gather_pd(table + 1, layer, 8);
+                  __m256d u = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(b, 12), exponent)), shift);
+                  __m256d x = _mm256_mul_pd(u, width);
+                  u32 accepted = (u32)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(x, magnitude), inner, _CMP_LT_OQ));
+                  _mm_storeu_ps(out + at + i, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(x, scales), offsets)));
+                  for(u32 missed = ~accepted & 0xF; missed; missed &= missed - 1) {
+                        u32 lane = trailing_ones(~missed);
+                        f64 y = normal ? ziggurat_normal(rn, bits[i + lane]) : ziggurat_exponential(rn, bits[i + lane]);
+                        out[at + i + lane] = (f32)(y * scale + offset);
+                  }
+            }
+#endif
+            for(; i < n; ++i) {
+                  f64 y = normal ? ziggurat_normal(rn, bits[i]) : ziggurat_exponential(rn, bits[i]);
+                  out[at + i] = (f32)(y * scale + offset);
+            }
+      }
+}
+
+void fill_normal_f32(rng* rn, f32* out, sz count, f32 mean, f32 deviation) {
+      fill_ziggurat_f32(rn, out, count, deviation, mean, true);
+}
+
+void fill_exponential_f32(rng* rn, f32* out, sz count, f32 rate) {
+      fill_ziggurat_f32(rn, out, count, 1.0 / rate, 0.0, false);
+}
+
+void fill_poisson_u32(rng* rn, u32* out, sz count, f64 mean) {
+      poisson_params p;
+      init_poisson_params(&p, mean);
+      for(sz i = 0; i < count; ++i) out[i] = poisson_internal(rn, &p);
+}
+
+void fill_gamma_f32(rng* rn, f32* out, sz count, f32 shape, f32 scale) {
+      gamma_params g;
+      init_gamma_params(&g, shape);
+      for(sz i = 0; i < count; ++i) out[i] = (f32)(gamma_internal(rn, &g) * scale);
+}
+
+void fill_beta_f32(rng* rn, f32* out, sz count, f32 a, f32 b) {
+      gamma_params ga, gb;
+      init_gamma_params(&ga, a);
+      init_gamma_params(&gb, b);
+      for(sz i = 0; i < count; ++i) {
+            f64 x = gamma_internal(rn, &ga);
+            f64 y = gamma_internal(rn, &gb);
+            out[i] = (f32)(x / (x + y));
+      }
+}
+
+// Uniform index below bound (a bound of 2^32 is a u32 span of zero, the full range).
+internal sz shuffle_draw(rng* rn, sz bound) {
+      return (bound <= ((sz)1 << 32)) ? (sz)bounded_u32(rn, (u32)bound) : (sz)bounded_u64(rn, (u64)bound);
+}
+
+// Items are only as aligned as their type (a v2 is 8 bytes on 4 byte alignment), so the word swaps check both sides.
+internal void shuffle_swap(u8* a, u8* b, u32 size) {
+      up alignment = (up)a | (up)b;
+      if((size == 4) && !(alignment & 3)) {
+            u32 t = *(u32*)a; *(u32*)a = *(u32*)b; *(u32*)b = t;
+      } else if((size == 8) && !(alignment & 7)) {
+            u64 t = *(u64*)a; *(u64*)a = *(u64*)b; *(u64*)b = t;
+      } else if((size == 8) && !(alignment & 3)) {
+            u32* x = (u32*)a;
+            u32* y = (u32*)b;
+            u32 t0 = x[0]; x[0] = y[0]; y[0] = t0;
+            u32 t1 = x[1]; x[1] = y[1]; y[1] = t1;
+      } else {
+            for(u32 i = 0; i < size; ++i) {
+                  u8 t = a[i];
+                  a[i] = b[i];
+                  b[i] = t;
+            }
+      }
+}
+
+// Targets are drawn this many steps ahead (same draws, same order) so their lines can be prefetched.
+#define SHUFFLE_PREFETCH 16
+
+void shuffle(rng* rn, void* items, sz count, u32 size) {
+      if(count < 2) return;
+      
+      u8* base = (u8*)items;
+      sz steps = count - 1;
+      sz targets[SHUFFLE_PREFETCH];
+      for(sz k = 0; k < min(steps, (sz)SHUFFLE_PREFETCH); ++k) {
+            targets[k] = shuffle_draw(rn, count - k);
+      }
+      
+      // Step k swaps item count - 1 - k with a uniform pick from [0, count - 1 - k].
+      for(sz k = 0; k < steps; ++k) {
+            sz target = targets[k % SHUFFLE_PREFETCH];
+            if(k + SHUFFLE_PREFETCH < steps) {
+                  sz next = shuffle_draw(rn, count - (k + SHUFFLE_PREFETCH));
+                  targets[k % SHUFFLE_PREFETCH] = next;
+                  prefetch(base + next * size);
+            }
+            
+            shuffle_swap(base + (count - 1 - k) * size, base + target * size, size);
+      }
+}
+
+// Bucket size the blocked shuffle aims for (fits l2), and the most buckets it scatters to (a wider fan-out costs the scatter more than it saves).
+#define SHUFFLE_BUCKET_BYTES mb(1)
+#define SHUFFLE_MAX_BUCKETS 64
+
+void shuffle_blocked(rng* rn, void* items, sz count, u32 size, void* temp) {
+      // Rao-Sandelius: scatter every item to a uniform random bucket, then shuffle each bucket on its own.
+      sz bucket_count = min(((sz)count * size) / SHUFFLE_BUCKET_BYTES, (sz)SHUFFLE_MAX_BUCKETS);
+      if(bucket_count < 2) {
+            shuffle(rn, items, count, size);
+            return;
+      }
+      
+      // Bucket picks come from the bulk lanes, the second pass replays them from copies instead of storing them.
+      bounded_sampler b;
+      init_bounded_sampler(&b, 0, (u32)bucket_count - 1);
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      rng_lanes replay_lanes = lanes;
+      rng replay = *rn;
+      
+      u32 picks[RNG_FILL_CHUNK];
+      sz offsets[SHUFFLE_MAX_BUCKETS + 1] = {};
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK) {
+            sz n = min(count - at, (sz)RNG_FILL_CHUNK);
+            fill_bounded_lanes(&lanes, rn, &b, picks, n);
+            for(sz i = 0; i < n; ++i) offsets[picks[i] + 1]++;
+      }
+      for(sz i = 0; i < bucket_count; ++i) {
+            offsets[i + 1] += offsets[i];
+      }
+      
+      sz cursors[SHUFFLE_MAX_BUCKETS];
+      copy_array((sz*)cursors, offsets, bucket_count);
+      u8* src = (u8*)items;
+      u8* dst = (u8*)temp;
+      for(sz at = 0; at < count; at += RNG_FILL_CHUNK) {
+            sz n = min(count - at, (sz)RNG_FILL_CHUNK);
+            fill_bounded_lanes(&replay_lanes, &replay, &b, picks, n);
+            for(sz i = 0; i < n; ++i) {
+                  permute_copy(dst + cursors[picks[i]]++ * size, src + (at + i) * size, size);
+            }
+      }
+      
+      for(sz i = 0; i < bucket_count; ++i) {
+            sz first = offsets[i];
+            sz n = offsets[i + 1] - first;
+            copy(src + first * size, dst + first * size, n * size);
+            shuffle(rn, src + first * size, n, size);
+      }
+}
+
+void init_reservoir(reservoir* r, void* storage, u32 capacity, u32 size) {
+      assert(capacity > 0);
+      r->items = (u8*)storage;
+      r->size = size;
+      r->capacity = capacity;
+      r->count = 0;
+      r->seen = 0;
+      r->next = 0;
+      r->w = 0.0;
+}
+
+// Li's algorithm L: the gap to the next kept item is geometric, so skipped items cost no random draws.
+internal void reservoir_skip(reservoir* r, rng* rn) {
+      r->w *= sample_exp(sample_log(unilateral_open_f64(rn)) / r->capacity);
+      f64 gap = sample_floor(sample_log(unilateral_open_f64(rn)) / sample_log(1.0 - r->w));
+      r->next = r->seen + ((gap < 4e18) ? (u64)gap : (u64)4e18);
+}
+
+b8x push_reservoir(reservoir* r, rng* rn, void* item) {
+      u64 index = r->seen++;
+      if(r->count < r->capacity) {
+            permute_copy(r->items + (sz)r->count++ * r->size, (u8*)item, r->size);
+            if(r->count == r->capacity) {
+                  r->w = 1.0;
+                  reservoir_skip(r, rn);
+            }
+            
+            return true;
+      }
+      
+      if(index < r->next) return false;
+      permute_copy(r->items + (sz)bounded_u32(rn, r->capacity) * r->size, (u8*)item, r->size);
+      reservoir_skip(r, rn);
+      return true;
+}
+
+sz get_alias_table_size(u32 count) {
+      return (sz)count * sizeof(alias_entry);
+}
+
+sz get_alias_scratch_size(u32 count) {
+      return (sz)count * (sizeof(f64) + sizeof(u32));
+}
+
+void build_alias_table(alias_table* t, f32* weights, u32 count, void* storage, void* scratch) {
+      t->entries = (alias_entry*)storage;
+      t->count = count;
+      
+      f64 total = 0.0;
+      for(u32 i = 0; i < count; ++i) total += weights[i];
+      assert(total > 0.0);
+      
+      // Vose: scaled weights below one (small, stacked from the front) borrow from ones above (large, from the back).
+      f64* scaled = (f64*)scratch;
+      u32* work = (u32*)(scaled + count);
+      u32 small = 0;
+      u32 large = count;
+      for(u32 i = 0; i < count; ++i) {
+            scaled[i] = weights[i] * (count / total);
+            if(scaled[i] < 1.0) work[small++] = i;
+            else work[--large] = i;
+      }
+      
+      while(small && (large < count)) {
+            u32 s = work[--small];
+            u32 l = work[large++];
+            t->entries[s].threshold = (u32)(scaled[s] * 4294967296.0);
+            t->entries[s].alias = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if(scaled[l] < 1.0) work[small++] = l;
+            else work[--large] = l;
+      }
+      
+      // Whatever is left is one up to rounding, it always keeps its own column.
+      while(small) {
+            u32 i = work[--small];
+            t->entries[i] = {U32_MAX, i};
+      }
+      
+      while(large < count) {
+            u32 i = work[large++];
+            t->entries[i] = {U32_MAX, i};
+      }
+}
+
+u32 next_alias(rng* rn, alias_table* t) {
+      u32 column = bounded_u32(rn, t->count);
+      alias_entry e = t->entries[column];
+      return (next_u32(rn) < e.threshold) ? column : e.alias;
+}
+
+void eswap(s16* x) {
+      *x = eswap(*x);
+}
+
+void eswap(u16* x) {
+      *x = eswap(*x);
+}
+
+void eswap(s32* x) {
+      *x = eswap(*x);
+}
+
+void eswap(u32* x) {
+      *x = eswap(*x);
+}
+
+void eswap(s64* x) {
+      *x = eswap(*x);
+}
+
+void eswap(u64* x) {
+      *x = eswap(*x);
+}
+
+// AVX2 reorders the bytes with one pshufb, SSE2 has none so it reorders the 16 bit words and then swaps the bytes inside them.
+#if (SIMD >= SSE2) && (SIMD < AVX2)
+internal __m128i eswap_words(__m128i x) {
+      return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+#endif
+
+void eswap_copy16(u16* dst, u16* src, sz count) {
+      sz i = 0;
+#if SIMD >= AVX2
+      __m256i order = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+      for(; i + 32 <= count; i += 32) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(src + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(src + i + 16));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(a, order));
+            _mm256_storeu_si256((__m256i*)(dst + i + 16), _mm256_shuffle_epi8(b, order));
+      }
+#elif SIMD >= SSE2
+      for(; i + 16 <= count; i += 16) {
+            __m128i a = _mm_loadu_si128((__m128i*)(src + i));
+            __m128i b = _mm_loadu_si128((__m128i*)(src + i + 8));
+            _mm_storeu_si128((__m128i*)(dst + i), eswap_words(a));
+            _mm_storeu_si128((__m128i*)(dst + i + 8), eswap_words(b));
+      }
+#endif
+      for(; i < count; ++i) {
+            dst[i] = eswap(src[i]);
+      }
+}
+
+void eswap_copy32(u32* dst, u32* src, sz count) {
+      sz i = 0;
+#if SIMD >= AVX2
+      __m256i order = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+      for(; i + 16 <= count; i += 16) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(src + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(src + i + 8));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(a, order));
+            _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_shuffle_epi8(b, order));
+      }
+#elif SIMD >= SSE2
+      for(; i + 8 <= count; i += 8) {
+            __m128i a = _mm_loadu_si128((__m128i*)(src + i));
+            __m128i b = _mm_loadu_si128((__m128i*)(src + i + 4));
+            a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+            b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_si128((__m128i*)(dst + i), eswap_words(a));
+            _mm_storeu_si128((__m128i*)(dst + i + 4), eswap_words(b));
+      }
+#endif
+      for(; i < count; ++i) {
+            dst[i] = eswap(src[i]);
+      }
+}
+
+void eswap_copy64(u64* dst, u64* src, sz count) {
+      sz i = 0;
+#if SIMD >= AVX2
+      __m256i order = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+      for(; i + 8 <= count; i += 8) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(src + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(src + i + 4));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(a, order));
+            _mm256_storeu_si256((__m256i*)(dst + i + 4), _mm256_shuffle_epi8(b, order));
+      }
+#elif SIMD >= SSE2
+      for(; i + 4 <= count; i += 4) {
+            __m128i a = _mm_loadu_si128((__m128i*)(src + i));
+            __m128i b = _mm_loadu_si128((__m128i*)(src + i + 2));
+            a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+            b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+            _mm_storeu_si128((__m128i*)(dst + i), eswap_words(a));
+            _mm_storeu_si128((__m128i*)(dst + i + 2), eswap_words(b));
+      }
+#endif
+      for(; i < count; ++i) {
+            dst[i] = eswap(src[i]);
+      }
+}
+
+void eswap_array16(u16* x, sz count) {
+      eswap_copy16(x, x, count);
+}
+
+void eswap_array32(u32* x, sz count) {
+      eswap_copy32(x, x, count);
+}
+
+void eswap_array64(u64* x, sz count) {
+      eswap_copy64(x, x, count);
+}
+
+s16 int_increment(volatile s16* x) {
+#if COMPILER == MSVC
+      return _InterlockedIncrement16((volatile short*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u16 int_increment(volatile u16* x) {
+#if COMPILER == MSVC
+      return (u16)_InterlockedIncrement16((volatile short*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s32 int_increment(volatile s32* x) {
+#if COMPILER == MSVC
+      return _InterlockedIncrement((volatile long*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u32 int_increment(volatile u32* x) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedIncrement((volatile long*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s64 int_increment(volatile s64* x) {
+#if COMPILER == MSVC
+      return _InterlockedIncrement64((volatile __int64*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u64 int_increment(volatile u64* x) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedIncrement64((volatile __int64*)x) - 1;
+#else
+      return __atomic_fetch_add(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s16 int_decrement(volatile s16* x) {
+#if COMPILER == MSVC
+      return _InterlockedDecrement16((volatile short*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u16 int_decrement(volatile u16* x) {
+#if COMPILER == MSVC
+      return (u16)_InterlockedDecrement16((volatile short*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s32 int_decrement(volatile s32* x) {
+#if COMPILER == MSVC
+      return _InterlockedDecrement((volatile long*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u32 int_decrement(volatile u32* x) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedDecrement((volatile long*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s64 int_decrement(volatile s64* x) {
+#if COMPILER == MSVC
+      return _InterlockedDecrement64((volatile __int64*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u64 int_decrement(volatile u64* x) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedDecrement64((volatile __int64*)x) + 1;
+#else
+      return __atomic_fetch_sub(x, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s16 int_compare_exchange(volatile s16* x, s16 compare_to, s16 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedCompareExchange16((volatile short*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+u16 int_compare_exchange(volatile u16* x, u16 compare_to, u16 exchange_value) {
+#if COMPILER == MSVC
+      return (u16)_InterlockedCompareExchange16((volatile short*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+s32 int_compare_exchange(volatile s32* x, s32 compare_to, s32 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedCompareExchange((volatile long*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+u32 int_compare_exchange(volatile u32* x, u32 compare_to, u32 exchange_value) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedCompareExchange((volatile long*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+s64 int_compare_exchange(volatile s64* x, s64 compare_to, s64 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedCompareExchange64((volatile __int64*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+u64 int_compare_exchange(volatile u64* x, u64 compare_to, u64 exchange_value) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedCompareExchange64((volatile __int64*)x, exchange_value, compare_to);
+#else
+      __atomic_compare_exchange_n(x, &compare_to, exchange_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+      return compare_to;
+#endif
+}
+
+s16 int_exchange(volatile s16* x, s16 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedExchange16((volatile short*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u16 int_exchange(volatile u16* x, u16 exchange_value) {
+#if COMPILER == MSVC
+      return (u16)_InterlockedExchange16((volatile short*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s32 int_exchange(volatile s32* x, s32 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedExchange((volatile long*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u32 int_exchange(volatile u32* x, u32 exchange_value) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedExchange((volatile long*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+s64 int_exchange(volatile s64* x, s64 exchange_value) {
+#if COMPILER == MSVC
+      return _InterlockedExchange64((volatile __int64*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+u64 int_exchange(volatile u64* x, u64 exchange_value) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedExchange64((volatile __int64*)x, exchange_value);
+#else
+      return __atomic_exchange_n(x, exchange_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+b8x atomic_compare_exchange(volatile atomic_pair* x, atomic_pair* expected, atomic_pair desired) {
+#if COMPILER == MSVC
+      return _InterlockedCompareExchange128((volatile __int64*)x, (__int64)desired.hi, (__int64)desired.lo, (__int64*)expected);
+#elif ARCHITECTURE == X64
+      // Spelled out so it does not depend on -mcx16 or libatomic.
+      u8 result;
+      __asm__ __volatile__("lock cmpxchg16b %1" : "=@ccz"(result), "+m"(*x), "+a"(expected->lo), "+d"(expected->hi) : "b"(desired.lo), "c"(desired.hi) : "memory");
+      return result;
+#else
+      return __atomic_compare_exchange((volatile unsigned __int128*)x, (unsigned __int128*)expected, (unsigned __int128*)&desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// The halves are read one at a time, a torn head only makes the first exchange fail and reload it.
+internal atomic_pair load_tagged_head(tagged_stack* s) {
+      atomic_pair head;
+      head.hi = atomic_load(&s->head.hi, MEMORY_ACQUIRE);
+      head.lo = atomic_load(&s->head.lo, MEMORY_ACQUIRE);
+      return head;
+}
+
+void push_tagged_stack(tagged_stack* s, stack_node* node) {
+      atomic_pair head = load_tagged_head(s);
+      do {
+            atomic_store((void* volatile*)&node->next, (void*)head.lo, MEMORY_RELAXED);
+      } while(!atomic_compare_exchange(&s->head, &head, {(u64)node, head.hi + 1}));
+}
+
+stack_node* pop_tagged_stack(tagged_stack* s) {
+      atomic_pair head = load_tagged_head(s);
+      while(head.lo) {
+            // The node may be popped and pushed back meanwhile, then its next is stale but the tag fails the exchange.
+            stack_node* node = (stack_node*)head.lo;
+            u64 next = (u64)atomic_load((void* volatile*)&node->next, MEMORY_RELAXED);
+            if(atomic_compare_exchange(&s->head, &head, {next, head.hi + 1})) return node;
+      }
+      
+      return 0;
+}
+
+stack_node* pop_all_tagged_stack(tagged_stack* s) {
+      atomic_pair head = load_tagged_head(s);
+      while(head.lo && !atomic_compare_exchange(&s->head, &head, {0, head.hi + 1}));
+      return (stack_node*)head.lo;
+}
+
+void init_index_stack(index_stack* s, u32* next) {
+      s->head = pack_u64_x2(U32_MAX, 0);
+      s->next = next;
+}
+
+void push_index_stack(index_stack* s, u32 index) {
+      u64 head = atomic_load(&s->head, MEMORY_RELAXED);
+      do {
+            atomic_store(&s->next[index], (u32)head, MEMORY_RELAXED);
+      } while(!atomic_compare_exchange_weak(&s->head, &head, pack_u64_x2(index, (head >> 32) + 1), MEMORY_RELEASE));
+}
+
+u32 pop_index_stack(index_stack* s) {
+      u64 head = atomic_load(&s->head, MEMORY_ACQUIRE);
+      while((u32)head != U32_MAX) {
+            u32 next = atomic_load(&s->next[(u32)head], MEMORY_RELAXED);
+            if(atomic_compare_exchange_weak(&s->head, &head, pack_u64_x2(next, (head >> 32) + 1), MEMORY_ACQUIRE)) break;
+      }
+      
+      return (u32)head;
+}
+
+u32 pop_all_index_stack(index_stack* s) {
+      u64 head = atomic_load(&s->head, MEMORY_ACQUIRE);
+      while(((u32)head != U32_MAX) && !atomic_compare_exchange_weak(&s->head, &head, pack_u64_x2(U32_MAX, (head >> 32) + 1), MEMORY_ACQUIRE));
+      return (u32)head;
+}
+
+// Announced epochs carry this bit while the thread is inside a critical section.
+#define EPOCH_ACTIVE 1
+
+internal void reclaim_limbo(epoch_thread* t, u32 bucket) {
+      stack_node* nodes = t->limbo[bucket];
+      t->limbo[bucket] = 0;
+      t->limbo_count[bucket] = 0;
+      if(nodes) t->domain->reclaim(t->domain->param, nodes);
+}
+
+internal void collect_epoch(epoch_thread* t) {
+      // The epoch moves on once every active thread has announced the current one, whatever is two epochs old goes back.
+      epoch_domain* d = t->domain;
+      u64 epoch = atomic_load(&d->epoch);
+      b8x quiet = true;
+      for(u32 i = 0; (i < d->thread_count) && quiet; ++i) {
+            u64 state = atomic_load(&d->threads[i].state);
+            quiet = !(state & EPOCH_ACTIVE) || ((state >> 1) == epoch);
+      }
+      if(quiet) {
+            u64 next = epoch + 1;
+            if(atomic_compare_exchange(&d->epoch, &epoch, next)) epoch = next;
+      }
+      for(u32 i = 0; i < 3; ++i) {
+            if(t->limbo[i] && (t->limbo_epoch[i] + 2 <= epoch)) reclaim_limbo(t, i);
+      }
+}
+
+sz get_epoch_domain_size(u32 thread_count) {
+      return CACHE_LINE + (sz)thread_count * sizeof(epoch_thread);
+}
+
+void init_epoch_domain(epoch_domain* d, void* storage, u32 thread_count, reclaim_proc* reclaim, void* param) {
+      assert(thread_count && reclaim);
+      zero_obj(d);
+      d->threads = (epoch_thread*)align(storage, CACHE_LINE);
+      d->thread_count = thread_count;
+      d->reclaim = reclaim;
+      d->param = param;
+      zero_array(d->threads, thread_count);
+      for(u32 i = 0; i < thread_count; ++i) d->threads[i].domain = d;
+}
+
+epoch_thread* join_epoch_domain(epoch_domain* d) {
+      for(u32 i = 0; i < d->thread_count; ++i) {
+            u32 used = 0;
+            if(atomic_compare_exchange(&d->threads[i].used, &used, 1u, MEMORY_ACQUIRE)) return &d->threads[i];
+      }
+      return 0;
+}
+
+void leave_epoch_domain(epoch_thread* t) {
+      assert(!t->depth);
+      atomic_store(&t->used, 0u, MEMORY_RELEASE);
+}
+
+void enter_epoch(epoch_thread* t) {
+      if(t->depth++) return;
+      u64 epoch = atomic_load(&t->domain->epoch, MEMORY_RELAXED);
+      atomic_store(&t->state, (epoch << 1) | EPOCH_ACTIVE, MEMORY_RELAXED);
+      atomic_fence(MEMORY_SEQ_CST); // Announced before any shared node is read.
+}
+
+void exit_epoch(epoch_thread* t) {
+      assert(t->depth);
+      if(--t->depth) return;
+      atomic_store(&t->state, 0ull, MEMORY_RELEASE);
+}
+
+void retire_epoch(epoch_thread* t, stack_node* node) {
+      // Stamped with the epoch read after the unlink, a reader that can still hold the node announced that epoch or an older one.
+      u64 epoch = atomic_load(&t->domain->epoch);
+      u32 bucket = (u32)(epoch % 3);
+      if(t->limbo[bucket] && (t->limbo_epoch[bucket] != epoch)) reclaim_limbo(t, bucket); // Three or more epochs old.
+      atomic_store((void* volatile*)&node->next, (void*)t->limbo[bucket], MEMORY_RELAXED); // Stale readers may still load the link.
+      t->limbo[bucket] = node;
+      t->limbo_epoch[bucket] = epoch;
+      ++t->limbo_count[bucket];
+      if(((t->limbo_count[0] + t->limbo_count[1] + t->limbo_count[2]) % EPOCH_BATCH) == 0) collect_epoch(t);
+}
+
+void flush_epoch_domain(epoch_domain* d) {
+      for(u32 i = 0; i < d->thread_count; ++i) {
+            for(u32 j = 0; j < 3; ++j) reclaim_limbo(&d->threads[i], j);
+      }
+}
+
+internal u32 get_hazard_scan_size(u32 thread_count) {
+      u32 size = 1;
+      while(size < 4 * thread_count * HAZARD_SLOTS) size <<= 1;
+      return size;
+}
+
+internal u32 hash_hazard(void* p, u32 mask) {
+      return (u32)(((u64)(up)p * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+internal void scan_hazards(hazard_thread* t) {
+      // Every published pointer goes into a hash set, retired nodes found in it wait for the next scan.
+      hazard_domain* d = t->domain;
+      u32 mask = d->scan_size - 1;
+      zero_array(t->scan, d->scan_size);
+      atomic_fence(MEMORY_SEQ_CST); // The unlinks are visible before the hazards are read.
+      for(u32 i = 0; i < d->thread_count; ++i) {
+            for(u32 j = 0; j < HAZARD_SLOTS; ++j) {
+                  void* p = atomic_load(&d->threads[i].hazards[j], MEMORY_ACQUIRE);
+                  if(!p) continue;
+                  u32 h = hash_hazard(p, mask);
+                  while(t->scan[h] && (t->scan[h] != p)) h = (h + 1) & mask;
+                  t->scan[h] = p;
+            }
+      }
+      
+      stack_node* kept = 0;
+      stack_node* freed = 0;
+      u32 kept_count = 0;
+      for(stack_node* node = t->retired; node;) {
+            stack_node* next = node->next;
+            u32 h = hash_hazard(node, mask);
+            while(t->scan[h] && (t->scan[h] != node)) h = (h + 1) & mask;
+            if(t->scan[h]) {
+                  atomic_store((void* volatile*)&node->next, (void*)kept, MEMORY_RELAXED); // Still protected, readers may load the link.
+                  kept = node;
+                  ++kept_count;
+            } else {
+                  node->next = freed;
+                  freed = node;
+            }
+            node = next;
+      }
+      t->retired = kept;
+      t->retired_count = kept_count;
+      if(freed) d->reclaim(d->param, freed);
+}
+
+sz get_hazard_domain_size(u32 thread_count) {
+      return CACHE_LINE + (sz)thread_count * (sizeof(hazard_thread) + get_hazard_scan_size(thread_count) * sizeof(void*));
+}
+
+void init_hazard_domain(hazard_domain* d, void* storage, u32 thread_count, reclaim_proc* reclaim, void* param) {
+      assert(thread_count && reclaim);
+      zero_obj(d);
+      d->threads = (hazard_thread*)align(storage, CACHE_LINE);
+      d->thread_count = thread_count;
+      d->scan_size = get_hazard_scan_size(thread_count);
+      d->reclaim = reclaim;
+      d->param = param;
+      zero_array(d->threads, thread_count);
+      void** scan = (void**)(d->threads + thread_count);
+      for(u32 i = 0; i < thread_count; ++i) {
+            d->threads[i].scan = scan + (sz)i * d->scan_size;
+            d->threads[i].domain = d;
+      }
+}
+
+hazard_thread* join_hazard_domain(hazard_domain* d) {
+      for(u32 i = 0; i < d->thread_count; ++i) {
+            u32 used = 0;
+            if(atomic_compare_exchange(&d->threads[i].used, &used, 1u, MEMORY_ACQUIRE)) return &d->threads[i];
+      }
+      return 0;
+}
+
+void leave_hazard_domain(hazard_thread* t) {
+      for(u32 i = 0; i < HAZARD_SLOTS; ++i) clear_hazard(t, i);
+      atomic_store(&t->used, 0u, MEMORY_RELEASE);
+}
+
+void* protect_hazard(hazard_thread* t, u32 slot, void* volatile* source) {
+      assert(slot < HAZARD_SLOTS);
+      void* p = atomic_load(source, MEMORY_RELAXED);
+      for(;;) {
+            // Published before the reload, so a scan either sees the hazard or the node was still linked afterwards.
+            atomic_store(&t->hazards[slot], p, MEMORY_RELAXED);
+            atomic_fence(MEMORY_SEQ_CST);
+            void* current = atomic_load(source, MEMORY_ACQUIRE);
+            if(current == p) return p;
+            p = current;
+      }
+}
+
+void clear_hazard(hazard_thread* t, u32 slot) {
+      assert(slot < HAZARD_SLOTS);
+      atomic_store(&t->hazards[slot], (void*)0, MEMORY_RELEASE);
+}
+
+void retire_hazard(hazard_thread* t, stack_node* node) {
+      atomic_store((void* volatile*)&node->next, (void*)t->retired, MEMORY_RELAXED); // Protected readers may still load the link.
+      t->retired = node;
+      if(++t->retired_count >= t->domain->scan_size / 2) scan_hazards(t);
+}
+
+void flush_hazard_domain(hazard_domain* d) {
+      for(u32 i = 0; i < d->thread_count; ++i) {
+            hazard_thread* t = &d->threads[i];
+            stack_node* nodes = t->retired;
+            t->retired = 0;
+            t->retired_count = 0;
+            if(nodes) d->reclaim(d->param, nodes);
+      }
+}
+
+// Backoff doubles the pauses up to this many, beyond that a waiter yields its time slice.
+#define LOCK_BACKOFF_MAX 1024
+
+// Attempts at the mutex before it sleeps.
+#define LOCK_SPINS 100
+
+// Rw lock state bits above the reader count.
+#define RW_LOCK_WRITER  0x80000000
+#define RW_LOCK_WAITING 0x40000000
+
+internal void lock_backoff(u32* pauses) {
+      if(*pauses <= LOCK_BACKOFF_MAX) {
+            for(u32 i = 0; i < *pauses; ++i) spin_pause();
+            *pauses *= 2;
+      } else {
+            yield_thread();
+      }
+}
+
+// Started is zero for an acquire that did not wait.
+internal void count_lock(lock_stats* stats, u64 started) {
+      atomic_fetch_add(&stats->acquires, 1ull, MEMORY_RELAXED);
+      if(started) {
+            atomic_fetch_add(&stats->contended, 1ull, MEMORY_RELAXED);
+            atomic_fetch_add(&stats->wait_cycles, read_timestamp() - started, MEMORY_RELAXED);
+      }
+}
+
+b8x try_lock(spin_lock* l) {
+      b8x acquired = !atomic_load(&l->locked, MEMORY_RELAXED) && !atomic_exchange(&l->locked, 1u, MEMORY_ACQUIRE);
+      if(acquired && l->stats) count_lock(l->stats, 0);
+      return acquired;
+}
+
+void lock(spin_lock* l) {
+      if(atomic_exchange(&l->locked, 1u, MEMORY_ACQUIRE)) {
+            // Wait on plain loads so the line stays shared, only try the exchange once it looks free.
+            u64 started = read_timestamp();
+            u32 pauses = 1;
+            do {
+                  while(atomic_load(&l->locked, MEMORY_RELAXED)) lock_backoff(&pauses);
+            } while(atomic_exchange(&l->locked, 1u, MEMORY_ACQUIRE));
+            if(l->stats) count_lock(l->stats, started);
+      } else if(l->stats) {
+            count_lock(l->stats, 0);
+      }
+}
+
+void unlock(spin_lock* l) {
+      atomic_store(&l->locked, 0u, MEMORY_RELEASE);
+}
+
+b8x try_lock(ticket_lock* l) {
+      u32 serving = atomic_load(&l->serving, MEMORY_RELAXED);
+      u32 next = serving;
+      b8x acquired = atomic_compare_exchange(&l->next, &next, serving + 1, MEMORY_ACQUIRE);
+      if(acquired && l->stats) count_lock(l->stats, 0);
+      return acquired;
+}
+
+void lock(ticket_lock* l) {
+      u32 ticket = atomic_fetch_add(&l->next, 1u, MEMORY_RELAXED);
+      u32 serving = atomic_load(&l->serving, MEMORY_ACQUIRE);
+      if(serving != ticket) {
+            // Pause in proportion to the queue ahead, each holder takes roughly the same time.
+            u64 started = read_timestamp();
+            u32 waits = 0;
+            do {
+                  if(++waits > LOCK_SPINS) yield_thread();
+                  for(u32 i = (ticket - serving) * 16; i; --i) spin_pause();
+                  serving = atomic_load(&l->serving, MEMORY_ACQUIRE);
+            } while(serving != ticket);
+            if(l->stats) count_lock(l->stats, started);
+      } else if(l->stats) {
+            count_lock(l->stats, 0);
+      }
+}
+
+void unlock(ticket_lock* l) {
+      atomic_store(&l->serving, atomic_load(&l->serving, MEMORY_RELAXED) + 1, MEMORY_RELEASE);
+}
+
+void lock_read(rw_lock* l) {
+      u32 state = atomic_load(&l->state, MEMORY_RELAXED);
+      u64 started = 0;
+      u32 pauses = 1;
+      while((state & (RW_LOCK_WRITER | RW_LOCK_WAITING)) || !atomic_compare_exchange_weak(&l->state, &state, state + 1, MEMORY_ACQUIRE)) {
+            if(state & (RW_LOCK_WRITER | RW_LOCK_WAITING)) {
+                  if(!started) started = read_timestamp();
+                  lock_backoff(&pauses);
+                  state = atomic_load(&l->state, MEMORY_RELAXED);
+            }
+      }
+      if(l->stats) count_lock(l->stats, started);
+}
+
+void unlock_read(rw_lock* l) {
+      atomic_fetch_add(&l->state, U32_MAX, MEMORY_RELEASE);
+}
+
+void lock_write(rw_lock* l) {
+      u32 state = 0;
+      if(atomic_compare_exchange(&l->state, &state, RW_LOCK_WRITER, MEMORY_ACQUIRE)) {
+            if(l->stats) count_lock(l->stats, 0);
+            return;
+      }
+      
+      // Flag the wait so no new readers get in, taking the lock clears the flag (other waiting writers raise it again).
+      u64 started = read_timestamp();
+      u32 pauses = 1;
+      for(;;) {
+            if(!(state & ~RW_LOCK_WAITING)) {
+                  if(atomic_compare_exchange_weak(&l->state, &state, RW_LOCK_WRITER, MEMORY_ACQUIRE)) break;
+                  continue;
+            }
+            
+            if(!(state & RW_LOCK_WAITING)) atomic_fetch_or(&l->state, RW_LOCK_WAITING, MEMORY_RELAXED);
+            lock_backoff(&pauses);
+            state = atomic_load(&l->state, MEMORY_RELAXED);
+      }
+      if(l->stats) count_lock(l->stats, started);
+}
+
+void unlock_write(rw_lock* l) {
+      atomic_fetch_and(&l->state, ~RW_LOCK_WRITER, MEMORY_RELEASE);
+}
+
+b8x try_lock(mutex* l) {
+      u32 state = 0;
+      b8x acquired = atomic_compare_exchange(&l->state, &state, 1u, MEMORY_ACQUIRE);
+      if(acquired && l->stats) count_lock(l->stats, 0);
+      return acquired;
+}
+
+// Drepper's three state mutex, unlock only makes the wake call when someone may be asleep.
+void lock(mutex* l) {
+      u32 state = 0;
+      if(atomic_compare_exchange(&l->state, &state, 1u, MEMORY_ACQUIRE)) {
+            if(l->stats) count_lock(l->stats, 0);
+            return;
+      }
+      
+      u64 started = read_timestamp();
+      for(u32 i = 0; i < LOCK_SPINS; ++i) {
+            spin_pause();
+            state = atomic_load(&l->state, MEMORY_RELAXED);
+            if(!state && atomic_compare_exchange(&l->state, &state, 1u, MEMORY_ACQUIRE)) {
+                  if(l->stats) count_lock(l->stats, started);
+                  return;
+            }
+      }
+      
+      if(state != 2) state = atomic_exchange(&l->state, 2u, MEMORY_ACQUIRE);
+      while(state) {
+            futex_wait(&l->state, 2);
+            state = atomic_exchange(&l->state, 2u, MEMORY_ACQUIRE);
+      }
+      if(l->stats) count_lock(l->stats, started);
 }
 
-u32 rotate_left(u32 x, u32 shift) {
-#if COMPILER == MSVC
-      return _rotl(x, shift);
-#endif
+void unlock(mutex* l) {
+      if(atomic_fetch_add(&l->state, U32_MAX, MEMORY_RELEASE) != 1) {
+            atomic_store(&l->state, 0u, MEMORY_RELEASE);
+            futex_wake(&l->state, 1);
+      }
 }
 
-u32 rotate_right(u32 x, u32 shift) {
-#if COMPILER == MSVC
-      return _rotr(x, shift);
-#endif
+internal u32 get_shard(u32 mask) {
+      return get_current_processor() & mask;
 }
 
-u64 rotate_left(u64 x, u64 shift) {
-#if COMPILER == MSVC
-      return _rotl64(x, shift);
-#endif
+u32 get_shard_count(void) {
+      u32 count = 1;
+      while(count < get_processor_count()) count <<= 1;
+      return count;
 }
 
-u64 rotate_right(u64 x, u64 shift) {
-#if COMPILER == MSVC
-      return _rotr64(x, shift);
-#endif
+sz get_sharded_counter_size(u32 shards) {
+      return CACHE_LINE + (sz)shards * sizeof(counter_shard);
 }
 
-s16 eswap(s16 x) {
-#if COMPILER == MSVC
-      return (s16)eswap((u16)x);
-#endif
+void init_sharded_counter(sharded_counter* c, void* storage, u32 shards) {
+      assert(shards && is_pow2(shards));
+      c->shards = (counter_shard*)align(storage, CACHE_LINE);
+      c->mask = shards - 1;
+      zero_array(c->shards, shards);
 }
 
-u16 eswap(u16 x) {
-#if COMPILER == MSVC
-      return _byteswap_ushort(x);
-#endif
+void add_sharded_counter(sharded_counter* c, u64 amount) {
+      atomic_fetch_add(&c->shards[get_shard(c->mask)].value, amount, MEMORY_RELAXED);
 }
 
-s32 eswap(s32 x) {
-#if COMPILER == MSVC
-      return (s32)eswap((u32)x);
-#endif
+u64 read_sharded_counter(sharded_counter* c) {
+      u64 sum = 0;
+      for(u32 i = 0; i <= c->mask; ++i) sum += atomic_load(&c->shards[i].value, MEMORY_RELAXED);
+      return sum;
 }
 
-u32 eswap(u32 x) {
-#if COMPILER == MSVC
-      return _byteswap_ulong(x);
-#endif
+u64 take_sharded_counter(sharded_counter* c) {
+      u64 sum = 0;
+      for(u32 i = 0; i <= c->mask; ++i) sum += atomic_exchange(&c->shards[i].value, 0ull, MEMORY_RELAXED);
+      return sum;
 }
 
-s64 eswap(s64 x) {
-#if COMPILER == MSVC
-      return (s64)eswap((u64)x);
-#endif
+sz get_sharded_min_max_size(u32 shards) {
+      return CACHE_LINE + (sz)shards * sizeof(min_max_shard);
 }
 
-u64 eswap(u64 x) {
-#if COMPILER == MSVC
-      return _byteswap_uint64(x);
-#endif
+void init_sharded_min_max(sharded_min_max* m, void* storage, u32 shards) {
+      assert(shards && is_pow2(shards));
+      m->shards = (min_max_shard*)align(storage, CACHE_LINE);
+      m->mask = shards - 1;
+      reset_sharded_min_max(m);
 }
 
-void eswap(s16* x) {
-      *x = eswap(*x);
+void add_sharded_min_max(sharded_min_max* m, u64 x) {
+      // Most samples move neither bound, so the common case is two loads and no write.
+      min_max_shard* shard = &m->shards[get_shard(m->mask)];
+      u64 min = atomic_load(&shard->min, MEMORY_RELAXED);
+      while(x < min && !atomic_compare_exchange_weak(&shard->min, &min, x, MEMORY_RELAXED));
+      u64 max = atomic_load(&shard->max, MEMORY_RELAXED);
+      while(x > max && !atomic_compare_exchange_weak(&shard->max, &max, x, MEMORY_RELAXED));
 }
 
-void eswap(u16* x) {
-      *x = eswap(*x);
+void read_sharded_min_max(sharded_min_max* m, u64* min, u64* max) {
+      *min = U64_MAX;
+      *max = 0;
+      for(u32 i = 0; i <= m->mask; ++i) {
+            *min = min(*min, atomic_load(&m->shards[i].min, MEMORY_RELAXED));
+            *max = max(*max, atomic_load(&m->shards[i].max, MEMORY_RELAXED));
+      }
 }
 
-void eswap(s32* x) {
-      *x = eswap(*x);
+void reset_sharded_min_max(sharded_min_max* m) {
+      for(u32 i = 0; i <= m->mask; ++i) {
+            atomic_store(&m->shards[i].min, U64_MAX, MEMORY_RELAXED);
+            atomic_store(&m->shards[i].max, 0ull, MEMORY_RELAXED);
+      }
 }
 
-void eswap(u32* x) {
-      *x = eswap(*x);
+sz get_sharded_histogram_size(u32 shards, u32 bin_count) {
+      return CACHE_LINE + (sz)shards * align_pow2(bin_count * sizeof(u64), CACHE_LINE);
 }
 
-void eswap(s64* x) {
-      *x = eswap(*x);
+void init_sharded_histogram(sharded_histogram* h, void* storage, u32 shards, u32 bin_count) {
+      assert(shards && is_pow2(shards) && bin_count);
+      h->bins = (volatile u64*)align(storage, CACHE_LINE); // Rows start on their own lines.
+      h->bin_count = bin_count;
+      h->stride = (u32)(align_pow2(bin_count * sizeof(u64), CACHE_LINE) / sizeof(u64));
+      h->mask = shards - 1;
+      zero((void*)h->bins, (sz)shards * h->stride * sizeof(u64));
 }
 
-void eswap(u64* x) {
-      *x = eswap(*x);
+void add_sharded_histogram(sharded_histogram* h, u32 bin, u64 amount) {
+      assert(bin < h->bin_count);
+      atomic_fetch_add(&h->bins[(sz)get_shard(h->mask) * h->stride + bin], amount, MEMORY_RELAXED);
 }
 
-s16 int_increment(volatile s16* x) {
-#if COMPILER == MSVC
-      return _InterlockedIncrement16((volatile short*)x) - 1;
-#endif
+void read_sharded_histogram(sharded_histogram* h, u64* bins) {
+      zero_array(bins, h->bin_count);
+      for(u32 i = 0; i <= h->mask; ++i) {
+            volatile u64* row = h->bins + (sz)i * h->stride;
+            for(u32 j = 0; j < h->bin_count; ++j) bins[j] += atomic_load(&row[j], MEMORY_RELAXED);
+      }
 }
 
-u16 int_increment(volatile u16* x) {
-#if COMPILER == MSVC
-      return (u16)_InterlockedIncrement16((volatile short*)x) - 1;
-#endif
+void take_sharded_histogram(sharded_histogram* h, u64* bins) {
+      zero_array(bins, h->bin_count);
+      for(u32 i = 0; i <= h->mask; ++i) {
+            volatile u64* row = h->bins + (sz)i * h->stride;
+            for(u32 j = 0; j < h->bin_count; ++j) bins[j] += atomic_exchange(&row[j], 0ull, MEMORY_RELAXED);
+      }
 }
 
-s32 int_increment(volatile s32* x) {
-#if COMPILER == MSVC
-      return _InterlockedIncrement((volatile long*)x) - 1;
-#endif
+sz get_spsc_ring_size(u32 capacity, u32 size) {
+      return (sz)capacity * size;
 }
 
-u32 int_increment(volatile u32* x) {
-#if COMPILER == MSVC
-      return (u32)_InterlockedIncrement((volatile long*)x) - 1;
-#endif
+void init_spsc_ring(spsc_ring* r, void* storage, u32 capacity, u32 size) {
+      assert(capacity && !(capacity & (capacity - 1)));
+      zero_obj(r);
+      r->items = (u8*)storage;
+      r->size = size;
+      r->mask = capacity - 1;
 }
 
-s64 int_increment(volatile s64* x) {
-#if COMPILER == MSVC
-      return _InterlockedIncrement64((volatile __int64*)x) - 1;
-#endif
+u32 reserve_spsc_write(spsc_ring* r, u32 count, void** items) {
+      u64 tail = atomic_load(&r->tail, MEMORY_RELAXED);
+      u64 capacity = (u64)r->mask + 1;
+      if(capacity - (tail - r->head_cache) < count) {
+            r->head_cache = atomic_load(&r->head, MEMORY_ACQUIRE);
+      }
+      
+      u32 offset = (u32)tail & r->mask;
+      u64 available = min(capacity - (tail - r->head_cache), capacity - offset);
+      *items = r->items + (sz)offset * r->size;
+      return (u32)min((u64)count, available);
 }
 
-u64 int_increment(volatile u64* x) {
-#if COMPILER == MSVC
-      return (u64)_InterlockedIncrement64((volatile __int64*)x) - 1;
-#endif
+void commit_spsc_write(spsc_ring* r, u32 count) {
+      atomic_store(&r->tail, atomic_load(&r->tail, MEMORY_RELAXED) + count, MEMORY_RELEASE);
 }
 
-s16 int_decrement(volatile s16* x) {
-#if COMPILER == MSVC
-      return _InterlockedDecrement16((volatile short*)x) + 1;
-#endif
+u32 reserve_spsc_read(spsc_ring* r, u32 count, void** items) {
+      u64 head = atomic_load(&r->head, MEMORY_RELAXED);
+      if(r->tail_cache - head < count) {
+            r->tail_cache = atomic_load(&r->tail, MEMORY_ACQUIRE);
+      }
+      
+      u32 offset = (u32)head & r->mask;
+      u64 available = min(r->tail_cache - head, (u64)r->mask + 1 - offset);
+      *items = r->items + (sz)offset * r->size;
+      return (u32)min((u64)count, available);
 }
 
-u16 int_decrement(volatile u16* x) {
-#if COMPILER == MSVC
-      return (u16)_InterlockedDecrement16((volatile short*)x) + 1;
-#endif
+void commit_spsc_read(spsc_ring* r, u32 count) {
+      atomic_store(&r->head, atomic_load(&r->head, MEMORY_RELAXED) + count, MEMORY_RELEASE);
 }
 
-s32 int_decrement(volatile s32* x) {
-#if COMPILER == MSVC
-      return _InterlockedDecrement((volatile long*)x) + 1;
-#endif
+b8x push_spsc_ring(spsc_ring* r, void* item) {
+      void* slot;
+      if(!reserve_spsc_write(r, 1, &slot)) return false;
+      copy(slot, item, r->size);
+      commit_spsc_write(r, 1);
+      return true;
 }
 
-u32 int_decrement(volatile u32* x) {
-#if COMPILER == MSVC
-      return (u32)_InterlockedDecrement((volatile long*)x) + 1;
-#endif
+b8x pop_spsc_ring(spsc_ring* r, void* item) {
+      void* slot;
+      if(!reserve_spsc_read(r, 1, &slot)) return false;
+      copy(item, slot, r->size);
+      commit_spsc_read(r, 1);
+      return true;
 }
 
-s64 int_decrement(volatile s64* x) {
-#if COMPILER == MSVC
-      return _InterlockedDecrement64((volatile __int64*)x) + 1;
-#endif
-}
+// Spins before a blocked push or pop goes to sleep.
+#define MPMC_SPINS 256
 
-u64 int_decrement(volatile u64* x) {
-#if COMPILER == MSVC
-      return (u64)_InterlockedDecrement64((volatile __int64*)x) + 1;
-#endif
+sz get_mpmc_queue_size(u32 capacity, u32 size) {
+      return (sz)capacity * align8(sizeof(u64) + size);
 }
 
-s16 int_compare_exchange(volatile s16* x, s16 compare_to, s16 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedCompareExchange16((volatile short*)x, exchange_value, compare_to);
-#endif
+void init_mpmc_queue(mpmc_queue* q, void* storage, u32 capacity, u32 size) {
+      assert(capacity && !(capacity & (capacity - 1)));
+      zero_obj(q);
+      q->cells = (u8*)storage;
+      q->mask = capacity - 1;
+      q->size = size;
+      q->stride = align8(sizeof(u64) + size);
+      
+      // Cell i is free for the push at position i.
+      for(u32 i = 0; i < capacity; ++i) *(u64*)(q->cells + (sz)i * q->stride) = i;
+}
+
+// The fence orders the cell update before the waiter check, a waiter does the opposite (counts itself, then retries).
+// Each notify takes one waiter off the count and wakes one thread, so a burst does not wake the whole herd.
+internal void notify_waiter(volatile u32* signal, volatile u32* waiters) {
+      atomic_fence(MEMORY_SEQ_CST);
+      u32 count = atomic_load(waiters, MEMORY_RELAXED);
+      while(count && !atomic_compare_exchange_weak(waiters, &count, count - 1, MEMORY_RELAXED));
+      if(count) {
+            atomic_fetch_add(signal, 1, MEMORY_RELEASE);
+            futex_wake(signal, 1);
+      }
 }
 
-u16 int_compare_exchange(volatile u16* x, u16 compare_to, u16 exchange_value) {
-#if COMPILER == MSVC
-      return (u16)_InterlockedCompareExchange16((volatile short*)x, exchange_value, compare_to);
-#endif
+// Takes back a waiter registration after the retry succeeded (unless a notifier already took it).
+internal void cancel_waiter(volatile u32* waiters) {
+      u32 count = atomic_load(waiters, MEMORY_RELAXED);
+      while(count && !atomic_compare_exchange_weak(waiters, &count, count - 1, MEMORY_RELAXED));
 }
 
-s32 int_compare_exchange(volatile s32* x, s32 compare_to, s32 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedCompareExchange((volatile long*)x, exchange_value, compare_to);
-#endif
+b8x try_push_mpmc_queue(mpmc_queue* q, void* item) {
+      u64 position = atomic_load(&q->tail, MEMORY_RELAXED);
+      u8* cell;
+      for(;;) {
+            cell = q->cells + (sz)(position & q->mask) * q->stride;
+            s64 difference = (s64)(atomic_load((volatile u64*)cell, MEMORY_ACQUIRE) - position);
+            if(difference == 0) {
+                  if(atomic_compare_exchange_weak(&q->tail, &position, position + 1, MEMORY_RELAXED)) break;
+            } else if(difference < 0) {
+                  return false;
+            } else {
+                  position = atomic_load(&q->tail, MEMORY_RELAXED);
+            }
+      }
+      
+      copy(cell + sizeof(u64), item, q->size);
+      atomic_store((volatile u64*)cell, position + 1, MEMORY_RELEASE);
+      notify_waiter(&q->pushed, &q->pop_waiters);
+      return true;
 }
 
-u32 int_compare_exchange(volatile u32* x, u32 compare_to, u32 exchange_value) {
-#if COMPILER == MSVC
-      return (u32)_InterlockedCompareExchange((volatile long*)x, exchange_value, compare_to);
-#endif
+b8x try_pop_mpmc_queue(mpmc_queue* q, void* item) {
+      u64 position = atomic_load(&q->head, MEMORY_RELAXED);
+      u8* cell;
+      for(;;) {
+            cell = q->cells + (sz)(position & q->mask) * q->stride;
+            s64 difference = (s64)(atomic_load((volatile u64*)cell, MEMORY_ACQUIRE) - (position + 1));
+            if(difference == 0) {
+                  if(atomic_compare_exchange_weak(&q->head, &position, position + 1, MEMORY_RELAXED)) break;
+            } else if(difference < 0) {
+                  return false;
+            } else {
+                  position = atomic_load(&q->head, MEMORY_RELAXED);
+            }
+      }
+      
+      copy(item, cell + sizeof(u64), q->size);
+      atomic_store((volatile u64*)cell, position + q->mask + 1, MEMORY_RELEASE);
+      notify_waiter(&q->popped, &q->push_waiters);
+      return true;
 }
 
-s64 int_compare_exchange(volatile s64* x, s64 compare_to, s64 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedCompareExchange64((volatile __int64*)x, exchange_value, compare_to);
-#endif
+void push_mpmc_queue(mpmc_queue* q, void* item) {
+      for(u32 spins = 0; !try_push_mpmc_queue(q, item); ++spins) {
+            if(spins < MPMC_SPINS) {
+                  spin_pause();
+                  continue;
+            }
+            
+            u32 signal = atomic_load(&q->popped, MEMORY_ACQUIRE);
+            atomic_fetch_add(&q->push_waiters, 1);
+            if(try_push_mpmc_queue(q, item)) {
+                  cancel_waiter(&q->push_waiters);
+                  break;
+            }
+            futex_wait(&q->popped, signal);
+      }
 }
 
-u64 int_compare_exchange(volatile u64* x, u64 compare_to, u64 exchange_value) {
-#if COMPILER == MSVC
-      return (u64)_InterlockedCompareExchange64((volatile __int64*)x, exchange_value, compare_to);
-#endif
+void pop_mpmc_queue(mpmc_queue* q, void* item) {
+      for(u32 spins = 0; !try_pop_mpmc_queue(q, item); ++spins) {
+            if(spins < MPMC_SPINS) {
+                  spin_pause();
+                  continue;
+            }
+            
+            u32 signal = atomic_load(&q->pushed, MEMORY_ACQUIRE);
+            atomic_fetch_add(&q->pop_waiters, 1);
+            if(try_pop_mpmc_queue(q, item)) {
+                  cancel_waiter(&q->pop_waiters);
+                  break;
+            }
+            futex_wait(&q->pushed, signal);
+      }
 }
 
-s16 int_exchange(volatile s16* x, s16 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedExchange16((volatile short*)x, exchange_value);
-#endif
-}
+// Worker of the calling thread (zero outside of a job system).
+thread_variable job_worker* job_current_worker;
 
-u16 int_exchange(volatile u16* x, u16 exchange_value) {
-#if COMPILER == MSVC
-      return (u16)_InterlockedExchange16((volatile short*)x, exchange_value);
-#endif
+// Failed rounds of stealing before an idle worker goes to sleep (or a waiting thread yields).
+#define JOB_SPINS 64
+
+internal b8x push_job_deque(job_deque* d, job* j) {
+      u64 bottom = atomic_load(&d->bottom, MEMORY_RELAXED);
+      u64 top = atomic_load(&d->top, MEMORY_ACQUIRE);
+      if(bottom - top >= JOB_DEQUE_CAPACITY) return false;
+      
+      atomic_store((void* volatile*)&d->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], (void*)j, MEMORY_RELAXED);
+      atomic_store(&d->bottom, bottom + 1, MEMORY_RELEASE);
+      return true;
 }
 
-s32 int_exchange(volatile s32* x, s32 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedExchange((volatile long*)x, exchange_value);
-#endif
+internal job* pop_job_deque(job_deque* d) {
+      u64 bottom = atomic_load(&d->bottom, MEMORY_RELAXED) - 1;
+      atomic_store(&d->bottom, bottom, MEMORY_RELAXED);
+      atomic_fence(MEMORY_SEQ_CST);
+      u64 top = atomic_load(&d->top, MEMORY_RELAXED);
+      
+      job* result = 0;
+      if((s64)(bottom - top) >= 0) {
+            result = (job*)atomic_load((void* volatile*)&d->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], MEMORY_RELAXED);
+            if(top == bottom) {
+                  // The last job, race the thieves for it.
+                  if(!atomic_compare_exchange(&d->top, &top, top + 1)) result = 0;
+                  atomic_store(&d->bottom, bottom + 1, MEMORY_RELAXED);
+            }
+      } else {
+            atomic_store(&d->bottom, bottom + 1, MEMORY_RELAXED);
+      }
+      
+      return result;
 }
 
-u32 int_exchange(volatile u32* x, u32 exchange_value) {
-#if COMPILER == MSVC
-      return (u32)_InterlockedExchange((volatile long*)x, exchange_value);
-#endif
+internal job* steal_job_deque(job_deque* d) {
+      u64 top = atomic_load(&d->top, MEMORY_ACQUIRE);
+      atomic_fence(MEMORY_SEQ_CST);
+      u64 bottom = atomic_load(&d->bottom, MEMORY_ACQUIRE);
+      if((s64)(bottom - top) <= 0) return 0;
+      
+      // The slot can not be reused before top moves past it, so reading it ahead of the exchange is safe.
+      job* result = (job*)atomic_load((void* volatile*)&d->jobs[top & (JOB_DEQUE_CAPACITY - 1)], MEMORY_RELAXED);
+      if(!atomic_compare_exchange(&d->top, &top, top + 1)) return 0;
+      return result;
 }
 
-s64 int_exchange(volatile s64* x, s64 exchange_value) {
-#if COMPILER == MSVC
-      return _InterlockedExchange64((volatile __int64*)x, exchange_value);
-#endif
+internal void execute_job(job* j) {
+      j->proc(j->param);
+      volatile u32* counter = j->counter;
+      atomic_store(&j->busy, 0u, MEMORY_RELEASE);
+      if(counter) atomic_fetch_add(counter, U32_MAX, MEMORY_ACQ_REL);
 }
 
-u64 int_exchange(volatile u64* x, u64 exchange_value) {
-#if COMPILER == MSVC
-      return (u64)_InterlockedExchange64((volatile __int64*)x, exchange_value);
-#endif
+// Own deque first, then random victims (in order for threads outside the system).
+internal job* find_job(job_system* s, job_worker* w) {
+      job* result = w ? pop_job_deque(&w->deque) : 0;
+      for(u32 attempt = 0; !result && (attempt < s->worker_count); ++attempt) {
+            u32 victim = w ? bounded_u32(&w->rn, s->worker_count) : attempt;
+            if(!w || (victim != w->index)) result = steal_job_deque(&s->workers[victim].deque);
+      }
+      
+      return result;
 }
 
-u8 least_significant_bit(u32 mask) {
-#if COMPILER == MSVC
-      u8 index = U8_MAX;
-      if(!_BitScanForward((unsigned long*)&index, mask)) {
-            index = U8_MAX;
+internal void job_worker_proc(void* param) {
+      job_worker* w = (job_worker*)param;
+      job_system* s = w->system;
+      job_current_worker = w;
+      u32 idle = 0;
+      while(atomic_load(&s->running, MEMORY_ACQUIRE)) {
+            job* j = find_job(s, w);
+            if(j) {
+                  execute_job(j);
+                  idle = 0;
+            } else if(++idle < JOB_SPINS) {
+                  spin_pause();
+            } else {
+                  // Same handshake as the queue, count in as a sleeper, look once more, then wait for a push.
+                  u32 signal = atomic_load(&s->signal, MEMORY_ACQUIRE);
+                  atomic_fetch_add(&s->sleepers, 1);
+                  j = find_job(s, w);
+                  if(j) {
+                        cancel_waiter(&s->sleepers);
+                        execute_job(j);
+                  } else if(atomic_load(&s->running, MEMORY_ACQUIRE)) {
+                        futex_wait(&s->signal, signal);
+                  }
+                  idle = 0;
+            }
       }
-      return index;
-#endif
+      
+      job_current_worker = 0;
+}
+
+internal void stop_job_workers(job_system* s, u32 thread_count) {
+      atomic_store(&s->running, 0u, MEMORY_RELEASE);
+      atomic_fetch_add(&s->signal, 1, MEMORY_RELEASE);
+      futex_wake(&s->signal, U32_MAX);
+      for(u32 i = 1; i < thread_count; ++i) join_thread(&s->workers[i].t);
+      job_current_worker = 0;
+}
+
+sz get_job_system_size(u32 worker_count) {
+      return CACHE_LINE + (sz)worker_count * (sizeof(job_worker) + JOB_DEQUE_CAPACITY * sizeof(job*) + JOB_POOL_CAPACITY * sizeof(job));
+}
+
+b8x start_job_system(job_system* s, void* storage, u32 worker_count, b8x pin) {
+      assert(worker_count);
+      zero_obj(s);
+      u8* at = (u8*)align(storage, CACHE_LINE);
+      s->workers = (job_worker*)at;
+      s->worker_count = worker_count;
+      s->running = true;
+      at += (sz)worker_count * sizeof(job_worker);
+      for(u32 i = 0; i < worker_count; ++i) {
+            job_worker* w = &s->workers[i];
+            zero_obj(w);
+            w->deque.jobs = (job**)at;
+            at += JOB_DEQUE_CAPACITY * sizeof(job*);
+            w->pool = (job*)at;
+            at += JOB_POOL_CAPACITY * sizeof(job);
+            zero_array(w->pool, JOB_POOL_CAPACITY);
+            w->index = i;
+            w->system = s;
+            seed(&w->rn, 0x9E3779B97F4A7C15ull * (i + 1), RNG_XOSHIRO256PP);
+      }
+      
+      job_current_worker = &s->workers[0];
+      u32 processors = get_processor_count();
+      for(u32 i = 1; i < worker_count; ++i) {
+            if(!start_thread(&s->workers[i].t, job_worker_proc, &s->workers[i])) {
+                  stop_job_workers(s, i);
+                  return false;
+            }
+            if(pin) pin_thread(&s->workers[i].t, i % processors);
+      }
+      
+      return true;
 }
 
-u8 most_significant_bit(u32 mask) {
-#if COMPILER == MSVC
-      u8 index = U8_MAX;
-      if(!_BitScanReverse((unsigned long*)&index, mask)) {
-            index = U8_MAX;
+void stop_job_system(job_system* s) {
+      stop_job_workers(s, s->worker_count);
+}
+
+void run_job(job_system* s, job_proc* proc, void* param, volatile u32* counter) {
+      if(counter) atomic_fetch_add(counter, 1, MEMORY_RELAXED);
+      job_worker* w = job_current_worker;
+      
+      // Round robin over the pool, skipping records whose jobs are still queued or running.
+      job* j = 0;
+      for(u32 i = 0; w && (w->system == s) && !j && (i < JOB_POOL_CAPACITY); ++i) {
+            job* candidate = &w->pool[w->pool_next++ & (JOB_POOL_CAPACITY - 1)];
+            if(!atomic_load(&candidate->busy, MEMORY_ACQUIRE)) j = candidate;
+      }
+      
+      if(!j) {
+            proc(param);
+            if(counter) atomic_fetch_add(counter, U32_MAX, MEMORY_ACQ_REL);
+            return;
+      }
+      
+      j->proc = proc;
+      j->param = param;
+      j->counter = counter;
+      j->busy = true;
+      if(!push_job_deque(&w->deque, j)) {
+            execute_job(j);
+            return;
+      }
+      
+      notify_waiter(&s->signal, &s->sleepers);
+}
+
+void wait_counter(job_system* s, volatile u32* counter) {
+      job_worker* w = (job_current_worker && (job_current_worker->system == s)) ? job_current_worker : 0;
+      u32 idle = 0;
+      while(atomic_load(counter, MEMORY_ACQUIRE)) {
+            job* j = find_job(s, w);
+            if(j) {
+                  execute_job(j);
+                  idle = 0;
+            } else if(++idle < JOB_SPINS) {
+                  spin_pause();
+            } else {
+                  yield_thread();
+            }
       }
-      return index;
-#endif
 }
 
-u8 least_significant_bit(u64 mask) {
-#if COMPILER == MSVC
-      u8 index = U8_MAX;
-      if(!_BitScanForward64((unsigned long*)&index, mask)) {
-            index = U8_MAX;
+// Parallel loop modes.
+#define PARALLEL_FOR    0x00
+#define PARALLEL_REDUCE 0x01
+#define PARALLEL_SCAN   0x02
+
+struct parallel_context {
+      job_system* system;
+      u32 mode;
+      u32 size;
+      u64 begin;
+      u64 end;
+      u64 grain;
+      range_proc* proc;
+      reduce_proc* reduce;
+      scan_proc* scan;
+      void* param;
+      u8* partials;
+};
+
+struct parallel_task {
+      parallel_context* context;
+      u64 first; // Blocks [first, last).
+      u64 last;
+};
+
+internal void run_parallel_block(parallel_context* c, u64 block) {
+      u64 begin = c->begin + block * c->grain;
+      u64 end = min(begin + c->grain, c->end);
+      switch(c->mode) {
+            case PARALLEL_FOR:    { c->proc(c->param, begin, end); } break;
+            case PARALLEL_REDUCE: { c->reduce(c->param, begin, end, c->partials + block * c->size); } break;
+            case PARALLEL_SCAN:   { c->scan(c->param, begin, end, block ? (c->partials + (block - 1) * c->size) : 0); } break;
+            invalid_default_case;
       }
-      return index;
-#endif
 }
 
-u8 most_significant_bit(u64 mask) {
-#if COMPILER == MSVC
-      u8 index = U8_MAX;
-      if(!_BitScanReverse64((unsigned long*)&index, mask)) {
-            index = U8_MAX;
+// Lazy binary splitting, while the local deque is empty (its last job was stolen or never existed) hand off the upper half.
+internal void parallel_task_proc(void* param) {
+      parallel_task* task = (parallel_task*)param;
+      parallel_context* c = task->context;
+      job_worker* w = job_current_worker;
+      b8x queueing = w && (w->system == c->system) && (c->system->worker_count > 1);
+      parallel_task halves[64]; // Every split halves the rest, so 64 is enough for any u64 range.
+      u32 half_count = 0;
+      volatile u32 counter = 0;
+      for(u64 block = task->first, last = task->last; block < last;) {
+            if(queueing && (last - block > 1) && (half_count < countof(halves))) {
+                  job_deque* d = &w->deque;
+                  if((s64)(atomic_load(&d->bottom, MEMORY_RELAXED) - atomic_load(&d->top, MEMORY_RELAXED)) <= 0) {
+                        u64 middle = block + (last - block) / 2;
+                        halves[half_count] = {c, middle, last};
+                        run_job(c->system, parallel_task_proc, &halves[half_count++], &counter);
+                        last = middle;
+                        continue;
+                  }
+            }
+            
+            run_parallel_block(c, block++);
       }
-      return index;
-#endif
+      
+      wait_counter(c->system, &counter);
+}
+
+internal void run_parallel(parallel_context* c) {
+      parallel_task task = {c, 0, get_parallel_block_count(c->begin, c->end, c->grain)};
+      parallel_task_proc(&task);
+}
+
+u64 get_parallel_block_count(u64 begin, u64 end, u64 grain) {
+      grain = max(grain, 1ull);
+      return (end > begin) ? ((end - begin + grain - 1) / grain) : 0;
+}
+
+void parallel_for(job_system* s, u64 begin, u64 end, u64 grain, range_proc* proc, void* param) {
+      parallel_context c = {};
+      c.system = s;
+      c.mode = PARALLEL_FOR;
+      c.begin = begin;
+      c.end = end;
+      c.grain = max(grain, 1ull);
+      c.proc = proc;
+      c.param = param;
+      run_parallel(&c);
+}
+
+void parallel_reduce(job_system* s, u64 begin, u64 end, u64 grain, reduce_proc* reduce, combine_proc* combine, void* param, void* partials, u32 size, void* result) {
+      parallel_context c = {};
+      c.system = s;
+      c.mode = PARALLEL_REDUCE;
+      c.size = size;
+      c.begin = begin;
+      c.end = end;
+      c.grain = max(grain, 1ull);
+      c.reduce = reduce;
+      c.param = param;
+      c.partials = (u8*)partials;
+      run_parallel(&c);
+      
+      // Pairwise tree over the blocks, the shape only depends on the block count.
+      u64 count = get_parallel_block_count(begin, end, grain);
+      for(u64 step = 1; step < count; step *= 2) {
+            for(u64 i = 0; i + step < count; i += step * 2) {
+                  u8* left = c.partials + i * size;
+                  combine(param, left, left, c.partials + (i + step) * size);
+            }
+      }
+      if(count) copy(result, c.partials, size);
+}
+
+void parallel_scan(job_system* s, u64 begin, u64 end, u64 grain, reduce_proc* reduce, combine_proc* combine, scan_proc* scan, void* param, void* partials, u32 size) {
+      parallel_context c = {};
+      c.system = s;
+      c.mode = PARALLEL_REDUCE;
+      c.size = size;
+      c.begin = begin;
+      c.end = end;
+      c.grain = max(grain, 1ull);
+      c.reduce = reduce;
+      c.scan = scan;
+      c.param = param;
+      c.partials = (u8*)partials;
+      run_parallel(&c);
+      
+      // Block totals become inclusive prefixes, then every block scans itself from the prefix before it.
+      u64 count = get_parallel_block_count(begin, end, grain);
+      for(u64 i = 1; i < count; ++i) {
+            u8* at = c.partials + i * size;
+            combine(param, at, at - size, at);
+      }
+      
+      c.mode = PARALLEL_SCAN;
+      run_parallel(&c);
 }
 
 b8x is_unilateral(f32 x) {
@@ -1920,4 +5635,168 @@ quat slerp(quat a, quat b, f32 t) {
       }
       
       return result;
+}
+
+// Candidates in [-1, 1) from the bulk lanes.
+internal void fill_bilateral_lanes(rng_lanes* lanes, f32* out, sz count) {
+      fill_rng_lanes(lanes, (u32*)out, count);
+      unilateral_f32_from_bits((u32*)out, out, count);
+      for(sz i = 0; i < count; ++i) out[i] = out[i] * 2.0f - 1.0f;
+}
+
+void fill_in_r2(rng* rn, v2* out, sz count, r2 bounds) {
+      // Both coordinates of a point are adjacent floats, so the array is filled as floats and scaled in place.
+      f32* values = (f32*)out;
+      v2 size = bounds.b - bounds.a;
+      fill_f32_unit(rn, values, count * 2);
+      for(sz i = 0; i < count; ++i) {
+            out[i].x = bounds.a.x + values[i * 2 + 0] * size.x;
+            out[i].y = bounds.a.y + values[i * 2 + 1] * size.y;
+      }
+}
+
+// The rejection samplers below write every candidate and only advance past accepted ones, so there is no branch to miss.
+void fill_in_disk(rng* rn, v2* out, sz count, v2 center, f32 radius) {
+      f32 candidates[RNG_FILL_CHUNK];
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz written = 0; written < count;) {
+            fill_bilateral_lanes(&lanes, candidates, RNG_FILL_CHUNK);
+            for(sz i = 0; (i < RNG_FILL_CHUNK) && (written < count); i += 2) {
+                  f32 x = candidates[i];
+                  f32 y = candidates[i + 1];
+                  out[written] = {center.x + x * radius, center.y + y * radius};
+                  written += (x * x + y * y) < 1.0f;
+            }
+      }
+}
+
+void fill_on_sphere(rng* rn, v3* out, sz count) {
+      // Marsaglia (1972): a point (x, y) in the unit disk with s = x^2 + y^2 lifts to (2x sqrt(1 - s), 2y sqrt(1 - s), 1 - 2s).
+      f32 candidates[RNG_FILL_CHUNK];
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz written = 0; written < count;) {
+            fill_bilateral_lanes(&lanes, candidates, RNG_FILL_CHUNK);
+            for(sz i = 0; (i < RNG_FILL_CHUNK) && (written < count); i += 2) {
+                  f32 x = candidates[i];
+                  f32 y = candidates[i + 1];
+                  f32 s = x * x + y * y;
+                  f32 f = 2.0f * (f32)sample_sqrt(max(1.0f - s, 0.0f));
+                  out[written] = {x * f, y * f, 1.0f - 2.0f * s};
+                  written += s < 1.0f;
+            }
+      }
+}
+
+void fill_in_sphere(rng* rn, v3* out, sz count) {
+      f32 candidates[RNG_FILL_CHUNK];
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz written = 0; written < count;) {
+            fill_bilateral_lanes(&lanes, candidates, RNG_FILL_CHUNK);
+            for(sz i = 0; (i + 3 <= RNG_FILL_CHUNK) && (written < count); i += 3) {
+                  v3 p = {candidates[i], candidates[i + 1], candidates[i + 2]};
+                  out[written] = p;
+                  written += (p.x * p.x + p.y * p.y + p.z * p.z) < 1.0f;
+            }
+      }
+}
+
+void fill_rotations(rng* rn, quat* out, sz count) {
+      // Shoemake's subgroup method, q = (sqrt(1 - u) * circle_a, sqrt(u) * circle_b) for uniform u and two uniform angles.
+      // The angles are points on the unit circle from disk rejection instead of trig, and the radius^2 of the first one is u.
+      f32 candidates[RNG_FILL_CHUNK];
+      rng_lanes lanes;
+      seed_rng_lanes(&lanes, rn);
+      for(sz written = 0; written < count;) {
+            fill_bilateral_lanes(&lanes, candidates, RNG_FILL_CHUNK);
+            for(sz i = 0; (i < RNG_FILL_CHUNK) && (written < count); i += 4) {
+                  f32 x1 = candidates[i + 0], y1 = candidates[i + 1];
+                  f32 x2 = candidates[i + 2], y2 = candidates[i + 3];
+                  f32 s1 = x1 * x1 + y1 * y1;
+                  f32 s2 = x2 * x2 + y2 * y2;
+                  b8x inside = (s1 < 1.0f) && (s2 < 1.0f) && (s2 > 0.0f);
+                  f32 k = inside ? (f32)sample_sqrt((1.0f - s1) / s2) : 0.0f;
+                  out[written] = mk_quat(x1, y1, x2 * k, y2 * k);
+                  written += inside;
+            }
+      }
+}
+
+// Bridson (2007), a grid of cells of radius / sqrt(2) holds at most one point each, so 5x5 cells cover every conflict.
+internal void poisson_disk_grid(r2 bounds, f32 radius, u32* width, u32* height) {
+      f32 cell = radius / (f32)SAMPLE_SQRT2;
+      *width = max(1u, (u32)ceil((bounds.b.x - bounds.a.x) / cell));
+      *height = max(1u, (u32)ceil((bounds.b.y - bounds.a.y) / cell));
+}
+
+sz get_poisson_disk_scratch_size(r2 bounds, f32 radius, u32 capacity) {
+      u32 width, height;
+      poisson_disk_grid(bounds, radius, &width, &height);
+      return ((sz)width * height + capacity) * sizeof(u32);
+}
+
+u32 poisson_disk(rng* rn, r2 bounds, f32 radius, v2* out, u32 capacity, void* scratch, u32 attempts) {
+      if(capacity == 0) return 0;
+      
+      u32 width, height;
+      poisson_disk_grid(bounds, radius, &width, &height);
+      f32 cell = radius / (f32)SAMPLE_SQRT2;
+      u32* grid = (u32*)scratch; // Point index + 1, zero when empty.
+      u32* active = grid + (sz)width * height;
+      zero_array(grid, (sz)width * height);
+      
+      u32 count = 0;
+      u32 active_count = 0;
+      v2 candidate = {range_f32(rn, bounds.a.x, bounds.b.x), range_f32(rn, bounds.a.y, bounds.b.y)};
+      for(;;) {
+            // Accept the candidate.
+            u32 cx = min((u32)((candidate.x - bounds.a.x) / cell), width - 1);
+            u32 cy = min((u32)((candidate.y - bounds.a.y) / cell), height - 1);
+            out[count] = candidate;
+            grid[(sz)cy * width + cx] = count + 1;
+            active[active_count++] = count++;
+            if(count == capacity) break;
+            
+            // Look for the next one around random active points, retiring those that have no room left.
+            b8x found = false;
+            while(active_count && !found) {
+                  u32 pick = bounded_u32(rn, active_count);
+                  v2 center = out[active[pick]];
+                  for(u32 attempt = 0; (attempt < attempts) && !found; ++attempt) {
+                        // Uniform over the annulus between radius and 2 * radius.
+                        f32 dx, dy, s;
+                        do {
+                              dx = bilateral_f32(rn);
+                              dy = bilateral_f32(rn);
+                              s = dx * dx + dy * dy;
+                        } while((s >= 1.0f) || (s == 0.0f));
+                        f32 distance = radius * (f32)sample_sqrt((1.0 + 3.0 * unilateral_f32(rn)) / s);
+                        candidate = {center.x + dx * distance, center.y + dy * distance};
+                        if(!in_range(candidate.x, bounds.a.x, bounds.b.x) || !in_range(candidate.y, bounds.a.y, bounds.b.y)) continue;
+                        
+                        s32 gx = (s32)min((u32)((candidate.x - bounds.a.x) / cell), width - 1);
+                        s32 gy = (s32)min((u32)((candidate.y - bounds.a.y) / cell), height - 1);
+                        found = true;
+                        for(s32 y = max(gy - 2, 0); found && (y <= min(gy + 2, (s32)height - 1)); ++y) {
+                              for(s32 x = max(gx - 2, 0); x <= min(gx + 2, (s32)width - 1); ++x) {
+                                    u32 other = grid[(sz)y * width + x];
+                                    if(!other) continue;
+                                    v2 d = out[other - 1] - candidate;
+                                    if(d.x * d.x + d.y * d.y < radius * radius) {
+                                          found = false;
+                                          break;
+                                    }
+                              }
+                        }
+                  }
+                  
+                  if(!found) active[pick] = active[--active_count];
+            }
+            
+            if(!found) break;
+      }
+      
+      return count;
 }
\ No newline at end of file
@@ -131,12 +131,53 @@
 #error Unknown architecture name!
 #endif
 
+// Byte order, every supported architecture runs little endian.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error Big endian targets are not supported!
+#endif
+
+// *********
+// *********
+
+// List of the supported instruction sets.
+#define SCALAR 0x01
+#define SSE2   0x02
+#define AVX2   0x03
+
+// Detect the widest available instruction set (define SIMD before including to force one).
+#if !defined(SIMD)
+#if defined(__AVX2__)
+#define SIMD AVX2
+#elif defined(__SSE2__) || defined(_M_AMD64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SIMD SSE2
+#else
+#define SIMD SCALAR
+#endif
+#endif
+
+#if SIMD == AVX2
+#define SIMD_NAME "AVX2"
+#elif SIMD == SSE2
+#define SIMD_NAME "SSE2"
+#elif SIMD == SCALAR
+#define SIMD_NAME "SCALAR"
+#endif
+
+#if !defined(SIMD_NAME)
+#error Unknown instruction set!
+#endif
+
 // *********
 // *********
 
 #include <float.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#if COMPILER == MSVC
+#include <intrin.h>
+#endif
+
 // Numeric types (unsigned fixed length).
 typedef uint8_t  u8;
 typedef uint16_t u16;
@@ -245,6 +286,7 @@ typedef s64x b64x;
 // Custom keywords.
 #define local_persist static
 #define global_variable static
+#define thread_variable static thread_local
 #define internal static
 #define entry_point
 #define unused
@@ -260,11 +302,52 @@ typedef s64x b64x;
 #define shared_export __attribute__((visibility("default")))
 #endif
 
+// Forced inlining (lets constant arguments such as memory orders fold at the call site).
+#if COMPILER == MSVC
+#define force_inline __forceinline
+#else
+#define force_inline inline __attribute__((always_inline))
+#endif
+
 // Compiler fence.
 #if COMPILER == MSVC
 #define fence { _ReadWriteBarrier(); _mm_mfence(); }
 #else
-#define fence
+#define fence __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+// Constant evaluation, lets constexpr functions keep run time intrinsics out of compile time code.
+#define constant_evaluated() __builtin_is_constant_evaluated()
+
+// BMI2 (pdep and pext), MSVC has no flag for it but every AVX2 processor supports it.
+#if defined(__BMI2__) || ((COMPILER == MSVC) && (SIMD >= AVX2))
+#define BMI2_ENABLED 1
+#else
+#define BMI2_ENABLED 0
+#endif
+
+// Cache prefetch (for reading, into every level).
+#if COMPILER == MSVC
+#if (ARCHITECTURE == X64) || (ARCHITECTURE == X86)
+#define prefetch(ptr) _mm_prefetch((char*)(ptr), _MM_HINT_T0)
+#else
+#define prefetch(ptr) __prefetch(ptr)
+#endif
+#else
+#define prefetch(ptr) __builtin_prefetch(ptr)
+#endif
+
+// Spin wait hint (lets the sibling hyperthread run while polling).
+#if COMPILER == MSVC
+#if (ARCHITECTURE == X64) || (ARCHITECTURE == X86)
+#define spin_pause() _mm_pause()
+#else
+#define spin_pause() __yield()
+#endif
+#elif (ARCHITECTURE == X64) || (ARCHITECTURE == X86)
+#define spin_pause() __builtin_ia32_pause()
+#else
+#define spin_pause() __asm__ __volatile__("yield")
 #endif
 
 // Preprocessor utilities.
@@ -275,6 +358,7 @@ typedef s64x b64x;
 #define expr(x) do { x; } while(0)
 #define countof(x) (sizeof(x)/sizeof((x)[0]))
 #define typeof(x) decltype(x)
+#undef offsetof // Replaces the standard one from stddef.h, this one returns a pointer (cast it to get the byte offset).
 #define offsetof(str, member) ((&(((str*)(0))->member)))
 #define sizeof_each(x) sizeof((x)[0])
 #define multiline_literal(...) stringify_exp(__VA_ARGS__)
@@ -325,7 +409,7 @@ typedef s64x b64x;
 
 // Assertions.
 #define assert(x) expr( if(!(x)) { debug_break(); } )
-#define cassert(x) typedef char concat_exp(__FILE__, __LINE__) [(x)?1:-1]
+#define cassert(x) typedef char concat_exp(cassert_, __LINE__) [(x)?1:-1]
 #define assert2(x, eA, eB) expr(if(x) { assert(eA); }; else { assert(eB); };)
 #define invalid_path assert(!"INVALID")
 #define invalid_default_case default: { invalid_path; } break
@@ -392,12 +476,12 @@ void* align(void* ptr, up padding, up alignment);
 bool  compare(void* a, void* b, sz size);
 
 // Macros for basic memory ops.
-#define zero_obj(x) (typeof(x))(zero(x, sizeof(*(x)))
+#define zero_obj(x) (typeof(x))(zero(x, sizeof(*(x))))
 #define copy_obj(dst, src) (typeof(dst))(copy(dst, src, sizeof(*(dst))))
 #define compare_objs(a, b) compare(a, b, sizeof(*(a)))
-#define zero_array(x, count) (typeof(x))(zero(x, sizeof(*(x))  * count)
-#define copy_array(dst, src, count) (typeof(dst))(copy(dst, src, sizeof(*(dst))  * count))
-#define compare_arrays(a, b, count) compare(a, b, sizeof(*(a)) * count)
+#define zero_array(x, count) (typeof(x))(zero(x, sizeof(*(x)) * (count)))
+#define copy_array(dst, src, count) (typeof(dst))(copy(dst, src, sizeof(*(dst)) * (count)))
+#define compare_arrays(a, b, count) compare(a, b, sizeof(*(a)) * (count))
 
 // Compression.
 sz compress_lz(void* dst, void* src, sz size);
@@ -408,6 +492,44 @@ void decompress_rle(void* dst, void* src, sz size, sz decompressed_size);
 // *********
 // *********
 
+// Threads.
+typedef void thread_proc(void* param);
+struct thread {
+      up handle;
+      thread_proc* proc;
+      void* param;
+};
+
+// Thread operations (the thread struct must stay alive until joined).
+b8x start_thread(thread* t, thread_proc* proc, void* param);
+void join_thread(thread* t);
+b8x pin_thread(thread* t, u32 processor); // Keeps the thread on one logical processor.
+void yield_thread(void); // Gives the rest of the time slice to another thread.
+void futex_wait(volatile u32* x, u32 value); // Sleeps while *x == value, may return spuriously.
+void futex_wake(volatile u32* x, u32 count = 1); // Wakes up to count threads waiting on x (U32_MAX for all).
+u32 get_processor_count(void);
+u32 get_current_processor(void); // Where the caller runs right now (a fixed per thread number where the OS does not say).
+u64 read_timestamp(void); // Cycle counter (a fixed frequency tick on ARM) for timing short waits.
+
+// File modes.
+#define FILE_MODE_READ  bit(0) // Existing file, read only.
+#define FILE_MODE_WRITE bit(1) // Created or truncated, readable too.
+
+// Files.
+struct file {
+      up handle;
+};
+
+// File operations (positional, one file can be shared between threads).
+b8x open_file(file* f, char* path, u32 mode);
+void close_file(file* f);
+u64 get_file_size(file* f);
+sz read_file(file* f, void* dst, sz size, u64 offset); // Returns the amount of bytes read.
+sz write_file(file* f, void* src, sz size, u64 offset); // Returns the amount of bytes written.
+
+// *********
+// *********
+
 struct sort_entry {
       u32 key;
       u32 value;
@@ -417,27 +539,128 @@ struct sort_entry {
 b8x are_sorted(sort_entry* entries, u32 count);
 void sort_bubble(sort_entry* entries, u32 count);
 void sort_quick(sort_entry* entries, u32 count);
-void sort_radix(sort_entry* entries, u32 count);
+void sort_radix(sort_entry* entries, u32 count, sort_entry* temp); // Temp must hold count entries.
+void sort_intro(sort_entry* entries, u32 count); // Quicksort with a heapsort fallback and sorting network leaves.
+
+// Sorting networks (count must not exceed SORT_NETWORK_MAX).
+#define SORT_NETWORK_MAX 64
+b8x are_sorted(u32* keys, u32 count);
+void sort_network(u32* keys, u32 count);
+void sort_network(sort_entry* entries, u32 count); // Equal keys are ordered by value.
+
+// Partitioning.
+u32 partition(sort_entry* entries, u32 count, u32 pivot); // Moves keys <= pivot to the front, returns their count.
+
+// External sorting of files made of raw sort_entry records (stable, source and destination must differ).
+// The temp file gets overwritten and is left behind for the caller to delete.
+#define SORT_EXTERNAL_MIN_MEMORY kb(64)
+b8x sort_external(char* src_path, char* dst_path, char* temp_path, void* memory, sz memory_size);
+
+// Selection.
+void select_nth(sort_entry* entries, u32 count, u32 nth); // Smaller keys end up before nth, larger ones after it.
+void partial_sort_k(sort_entry* entries, u32 count, u32 k); // Sorts the k smallest keys into the front, the rest is unordered.
+
+// Streaming selection of the k smallest (or largest) keys.
+struct top_k {
+      sort_entry* heap;
+      u32 capacity;
+      u32 count;
+      u32 flip;
+};
+
+// Streaming selection operations.
+void init_top_k(top_k* t, sort_entry* storage, u32 capacity, b8x largest = false);
+void push_top_k(top_k* t, sort_entry* entries, u32 count);
+u32 finish_top_k(top_k* t); // Sorts the kept entries best first into the storage, returns their count and resets.
+
+// Permutation column (parallel array of fixed size elements).
+struct permute_column {
+      void* data;
+      u32 size;
+};
+
+// Permutations (gather order: element i becomes the old element at permutation[i]).
+#define PERMUTE_MAX_ROW 256
+permute_column mk_permute_column(void* data, u32 size);
+void argsort(u32* keys, u32 count, u32* permutation, sort_entry* scratch); // Stable, scratch holds count * 2 entries.
+void permute(permute_column* columns, u32 column_count, u32* permutation, u32 count, void* buffer, sz buffer_size); // Gathers the columns the buffer fits (count * size each, rounded up to 8), cycles the rest in place.
+void permute_in_place(permute_column* columns, u32 column_count, u32* permutation, u32 count); // Count below 2^31, row up to PERMUTE_MAX_ROW bytes (each element rounded up to 8).
+
+// Eytzinger layout (breadth first order, node n has children 2n and 2n+1, keys carry their sorted rank).
+struct eytzinger {
+      sort_entry* nodes;
+      u32 count;
+};
+
+// Static B-tree (nodes of 16 keys compared at once, children are implicit).
+#define STATIC_BTREE_KEYS 16
+struct static_btree {
+      u32* keys;
+      u32* ranks;
+      u32 count;
+      u32 node_count;
+};
+
+// Searching sorted entries (results are ranks in the sorted array, count when past the end).
+// Range queries return how many keys are in [minimum, maximum] and the rank of the first one.
+u32 lower_bound(sort_entry* entries, u32 count, u32 key);
+u32 range_query(sort_entry* entries, u32 count, u32 minimum, u32 maximum, u32* first);
+
+// Searchable layouts (built from sorted entries into 64 byte aligned storage).
+sz get_eytzinger_size(u32 count);
+void build_eytzinger(eytzinger* e, sort_entry* sorted, u32 count, void* storage);
+u32 lower_bound(eytzinger* e, u32 key);
+u32 range_query(eytzinger* e, u32 minimum, u32 maximum, u32* first);
+sz get_static_btree_size(u32 count);
+void build_static_btree(static_btree* t, sort_entry* sorted, u32 count, void* storage);
+u32 lower_bound(static_btree* t, u32 key);
+u32 range_query(static_btree* t, u32 minimum, u32 maximum, u32* first);
 
 // *********
 // *********
 
+// Generator kinds (a zero initialized rng is xorshift32).
+#define RNG_XORSHIFT32 0x00 // Period 2^32-1, 4 bytes of state.
+#define RNG_XOSHIRO256PP 0x01 // xoshiro256++, period 2^256-1.
+#define RNG_XOSHIRO256SS 0x02 // xoshiro256**, period 2^256-1.
+#define RNG_PCG64 0x03 // 128 bit LCG with xsl-rr output, period 2^128.
+#define RNG_PHILOX 0x04 // Philox4x32-10 keyed by the seed, counter based (see seek).
+
 struct rng {
-      u32 seed;
-      u32 state;
+      u32 kind;
+      u32 buffered; // Philox words left in state[2] and state[3].
+      u64 seed;
+      u64 state[4];
 };
 
 // Random Number Generation.
-void seed(rng* rn, u32 seed);
+void seed(rng* rn, u32 seed); // Xorshift32.
+void seed(rng* rn, u64 seed, u32 kind);
 void clear(rng* rn); // Reset state to seed.
 
+// Substreams (not available for xorshift32, philox jumps move to the next stream).
+// Copy the generator for each thread and jump the original after every copy.
+void jump(rng* rn); // Skips 2^128 values (2^64 for pcg64).
+void long_jump(rng* rn); // Skips 2^192 values (2^96 for pcg64).
+
+// Counter based generation (Philox4x32-10), the 128 output bits only depend on key, stream and counter.
+// Give element i stream i (or word i of one stream) and its values no longer depend on how the work is split.
+struct philox_block {
+      u32 x[4];
+};
+
+philox_block philox(u64 key, u64 counter, u64 stream = 0);
+void seek(rng* rn, u64 stream, u64 counter = 0); // Philox only, position in blocks.
+void fill_philox_u32(u64 key, u64 stream, u64 first, u32* out, sz count); // Out[i] is word first + i of the stream.
+void fill_philox_f32_unit(u64 key, u64 stream, u64 first, f32* out, sz count); // Values in [0, 1), same as unilateral_f32.
+
 // Absolute values.
 u32 next_u32(rng* rn);
 u64 next_u64(rng* rn);
 s32 next_s32(rng* rn);
 s64 next_s64(rng* rn);
-f32 next_f32(rng* rn);
-f64 next_f64(rng* rn);
+f32 next_f32(rng* rn); // Any finite value, every bit pattern equally likely.
+f64 next_f64(rng* rn); // Any finite value, every bit pattern equally likely.
 
 // Range values.
 u32 range_u32(rng* rn, u32 minimum, u32 maximum); // Min and max are inclusive.
@@ -448,30 +671,310 @@ f32 range_f32(rng* rn, f32 minimum, f32 maximum); // Min and max are inclusive.
 f64 range_f64(rng* rn, f64 minimum, f64 maximum); // Min and max are inclusive.
 
 // Chance.
-b8x chance(rng* rn, u32 chance);
+b8x chance(rng* rn, u32 chance); // True once in chance draws.
 
-// Floats.
-f32 unilateral_f32(rng* rn); // Values between 0 and 1.
-f32 bilateral_f32(rng* rn); // Values between -1 and 1.
-f64 unilateral_f64(rng* rn); // Values between 0 and 1.
-f64 bilateral_f64(rng* rn); // Values between -1 and 1.
+// Bounded sampler (precomputed rejection threshold, no divide per draw).
+struct bounded_sampler {
+      u32 minimum;
+      u32 span; // Zero for the full 32 bit range.
+      u32 threshold;
+};
+
+void init_bounded_sampler(bounded_sampler* b, u32 minimum, u32 maximum); // Min and max are inclusive.
+u32 next_bounded(rng* rn, bounded_sampler* b);
+
+// Floats (built from random mantissa bits, no divide).
+f32 unilateral_f32(rng* rn); // Values in [0, 1).
+f32 bilateral_f32(rng* rn); // Values in [-1, 1).
+f64 unilateral_f64(rng* rn); // Values in [0, 1).
+f64 bilateral_f64(rng* rn); // Values in [-1, 1).
+f32 unilateral_open_f32(rng* rn); // Values in (0, 1).
+f64 unilateral_open_f64(rng* rn); // Values in (0, 1).
+f32 unilateral_closed_f32(rng* rn); // Values in [0, 1].
+f64 unilateral_closed_f64(rng* rn); // Values in [0, 1].
+
+// Bulk generation.
+// Runs four xoshiro256++ lanes seeded from a single draw of rn, the output is the same on every instruction set.
+void fill_u32(rng* rn, u32* out, sz count);
+void fill_f32_unit(rng* rn, f32* out, sz count); // Values in [0, 1), same as unilateral_f32.
+void fill_f64_unit(rng* rn, f64* out, sz count); // Values in [0, 1), same as unilateral_f64.
+void fill_range_u32(rng* rn, u32* out, sz count, u32 minimum, u32 maximum); // Min and max are inclusive.
+
+// Distributions.
+f32 normal_f32(rng* rn, f32 mean = 0.0f, f32 deviation = 1.0f); // Ziggurat.
+f64 normal_f64(rng* rn, f64 mean = 0.0, f64 deviation = 1.0); // Ziggurat.
+f32 exponential_f32(rng* rn, f32 rate = 1.0f); // Ziggurat.
+f64 exponential_f64(rng* rn, f64 rate = 1.0); // Ziggurat.
+u32 poisson_u32(rng* rn, f64 mean);
+f64 gamma_f64(rng* rn, f64 shape, f64 scale = 1.0); // Shape above 0.
+f64 beta_f64(rng* rn, f64 a, f64 b); // A and b above 0.
+
+// Distributions (bulk, constants are computed once per call).
+void fill_normal_f32(rng* rn, f32* out, sz count, f32 mean = 0.0f, f32 deviation = 1.0f);
+void fill_exponential_f32(rng* rn, f32* out, sz count, f32 rate = 1.0f);
+void fill_poisson_u32(rng* rn, u32* out, sz count, f64 mean);
+void fill_gamma_f32(rng* rn, f32* out, sz count, f32 shape, f32 scale = 1.0f);
+void fill_beta_f32(rng* rn, f32* out, sz count, f32 a, f32 b);
+
+// Shuffling (Fisher-Yates on the unbiased bounded generator).
+void shuffle(rng* rn, void* items, sz count, u32 size);
+void shuffle_blocked(rng* rn, void* items, sz count, u32 size, void* temp); // For arrays far beyond cache, temp holds count items.
+
+// Reservoir sampling (uniform sample of capacity items from a stream of unknown length).
+struct reservoir {
+      u8* items;
+      u32 size;
+      u32 capacity;
+      u32 count; // Items held so far.
+      u64 seen;
+      u64 next; // Stream index of the next item kept.
+      f64 w;
+};
+
+void init_reservoir(reservoir* r, void* storage, u32 capacity, u32 size); // Storage holds capacity items.
+b8x push_reservoir(reservoir* r, rng* rn, void* item); // True if the item was kept.
+
+// Alias tables (Walker/Vose, O(count) build and O(1) weighted picks).
+struct alias_entry {
+      u32 threshold; // Chance to keep the column, out of 2^32.
+      u32 alias;
+};
+
+struct alias_table {
+      alias_entry* entries;
+      u32 count;
+};
+
+sz get_alias_table_size(u32 count);
+sz get_alias_scratch_size(u32 count); // Only needed while building.
+void build_alias_table(alias_table* t, f32* weights, u32 count, void* storage, void* scratch);
+u32 next_alias(rng* rn, alias_table* t);
 
 // *********
 // *********
 
-// Bit rotation intrinsics.
-u32 rotate_left(u32 x, u32 shift);
-u32 rotate_right(u32 x, u32 shift);
-u64 rotate_left(u64 x, u64 shift);
-u64 rotate_right(u64 x, u64 shift);
+// Bit manipulation, defined here so it works in constant expressions, builtins or intrinsics take over at run time.
+// Shifts are taken modulo the bit width, counts of a zero input are the bit width.
+
+// Bit rotation.
+constexpr u32 rotate_left(u32 x, u32 shift) {
+      return (x << (shift & 31)) | (x >> ((0u - shift) & 31));
+}
+
+constexpr u32 rotate_right(u32 x, u32 shift) {
+      return (x >> (shift & 31)) | (x << ((0u - shift) & 31));
+}
+
+constexpr u64 rotate_left(u64 x, u64 shift) {
+      return (x << (shift & 63)) | (x >> ((0ull - shift) & 63));
+}
+
+constexpr u64 rotate_right(u64 x, u64 shift) {
+      return (x >> (shift & 63)) | (x << ((0ull - shift) & 63));
+}
 
 // Endian swapping.
-s16 eswap(s16 x);
-u16 eswap(u16 x);
-s32 eswap(s32 x);
-u32 eswap(u32 x);
-s64 eswap(s64 x);
-u64 eswap(u64 x);
+constexpr u16 eswap(u16 x) {
+#if COMPILER == MSVC
+      if(!constant_evaluated()) return _byteswap_ushort(x);
+      return (u16)((x << 8) | (x >> 8));
+#else
+      return __builtin_bswap16(x);
+#endif
+}
+
+constexpr u32 eswap(u32 x) {
+#if COMPILER == MSVC
+      if(!constant_evaluated()) return _byteswap_ulong(x);
+      return (x << 24) | ((x << 8) & 0x00FF0000) | ((x >> 8) & 0x0000FF00) | (x >> 24);
+#else
+      return __builtin_bswap32(x);
+#endif
+}
+
+constexpr u64 eswap(u64 x) {
+#if COMPILER == MSVC
+      if(!constant_evaluated()) return _byteswap_uint64(x);
+      return ((u64)eswap((u32)x) << 32) | eswap((u32)(x >> 32));
+#else
+      return __builtin_bswap64(x);
+#endif
+}
+
+constexpr s16 eswap(s16 x) {
+      return (s16)eswap((u16)x);
+}
+
+constexpr s32 eswap(s32 x) {
+      return (s32)eswap((u32)x);
+}
+
+constexpr s64 eswap(s64 x) {
+      return (s64)eswap((u64)x);
+}
+
+// Bit counting.
+constexpr u32 count_trailing_zeros(u32 x) {
+#if COMPILER == MSVC
+      if(!constant_evaluated()) {
+            unsigned long index = 0;
+            return _BitScanForward(&index, x) ? (u32)index : 32;
+      }
+      u32 count = 0;
+      while((count < 32) && !((x >> count) & 1)) ++count;
+      return count;
+#else
+      return x ? (u32)__builtin_ctz(x) : 32;
+#endif
+}
+
+constexpr u32 count_trailing_zeros(u64 x) {
+#if COMPILER == MSVC
+      return (u32)x ? count_trailing_zeros((u32)x) : 32 + count_trailing_zeros((u32)(x >> 32));
+#else
+      return x ? (u32)__builtin_ctzll(x) : 64;
+#endif
+}
+
+constexpr u32 count_leading_zeros(u32 x) {
+#if COMPILER == MSVC
+      if(!constant_evaluated()) {
+            unsigned long index = 0;
+            return _BitScanReverse(&index, x) ? 31 - (u32)index : 32;
+      }
+      u32 count = 0;
+      while((count < 32) && !((x << count) & 0x80000000)) ++count;
+      return count;
+#else
+      return x ? (u32)__builtin_clz(x) : 32;
+#endif
+}
+
+constexpr u32 count_leading_zeros(u64 x) {
+#if COMPILER == MSVC
+      return (x >> 32) ? count_leading_zeros((u32)(x >> 32)) : 32 + count_leading_zeros((u32)x);
+#else
+      return x ? (u32)__builtin_clzll(x) : 64;
+#endif
+}
+
+constexpr u32 count_set_bits(u32 x) {
+#if COMPILER == MSVC
+#if SIMD >= AVX2
+      if(!constant_evaluated()) return __popcnt(x);
+#endif
+      x = x - ((x >> 1) & 0x55555555);
+      x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+      return (((x + (x >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#else
+      return (u32)__builtin_popcount(x);
+#endif
+}
+
+constexpr u32 count_set_bits(u64 x) {
+#if COMPILER == MSVC
+      return count_set_bits((u32)x) + count_set_bits((u32)(x >> 32));
+#else
+      return (u32)__builtin_popcountll(x);
+#endif
+}
+
+// Bit scanning (U8_MAX when no bit is set).
+constexpr u8 least_significant_bit(u32 mask) {
+      return mask ? (u8)count_trailing_zeros(mask) : U8_MAX;
+}
+
+constexpr u8 most_significant_bit(u32 mask) {
+      return mask ? (u8)(31 - count_leading_zeros(mask)) : U8_MAX;
+}
+
+constexpr u8 least_significant_bit(u64 mask) {
+      return mask ? (u8)count_trailing_zeros(mask) : U8_MAX;
+}
+
+constexpr u8 most_significant_bit(u64 mask) {
+      return mask ? (u8)(63 - count_leading_zeros(mask)) : U8_MAX;
+}
+
+// Bit reversal.
+constexpr u32 reverse_bits(u32 x) {
+#if COMPILER == CLANG
+      return __builtin_bitreverse32(x);
+#else
+      x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+      x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+      x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+      return eswap(x);
+#endif
+}
+
+constexpr u64 reverse_bits(u64 x) {
+#if COMPILER == CLANG
+      return __builtin_bitreverse64(x);
+#else
+      x = ((x >> 1) & 0x5555555555555555ull) | ((x & 0x5555555555555555ull) << 1);
+      x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+      x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+      return eswap(x);
+#endif
+}
+
+// Bit deposit and extract (pdep and pext), the fallbacks take one step per set mask bit.
+constexpr u32 deposit_bits(u32 x, u32 mask) { // Low bits of x go to the set bits of mask, in order.
+#if BMI2_ENABLED && (COMPILER == MSVC)
+      if(!constant_evaluated()) return _pdep_u32(x, mask);
+#elif BMI2_ENABLED
+      if(!constant_evaluated()) return __builtin_ia32_pdep_si(x, mask);
+#endif
+      u32 result = 0;
+      for(u32 b = 1; mask; b += b) {
+            if(x & b) result |= mask & (0u - mask);
+            mask &= mask - 1;
+      }
+      return result;
+}
+
+constexpr u64 deposit_bits(u64 x, u64 mask) {
+#if BMI2_ENABLED && (ARCHITECTURE == X64) && (COMPILER == MSVC)
+      if(!constant_evaluated()) return _pdep_u64(x, mask);
+#elif BMI2_ENABLED && (ARCHITECTURE == X64)
+      if(!constant_evaluated()) return __builtin_ia32_pdep_di(x, mask);
+#endif
+      u64 result = 0;
+      for(u64 b = 1; mask; b += b) {
+            if(x & b) result |= mask & (0ull - mask);
+            mask &= mask - 1;
+      }
+      return result;
+}
+
+constexpr u32 extract_bits(u32 x, u32 mask) { // Bits of x under the set bits of mask, packed into the low bits.
+#if BMI2_ENABLED && (COMPILER == MSVC)
+      if(!constant_evaluated()) return _pext_u32(x, mask);
+#elif BMI2_ENABLED
+      if(!constant_evaluated()) return __builtin_ia32_pext_si(x, mask);
+#endif
+      u32 result = 0;
+      for(u32 b = 1; mask; b += b) {
+            if(x & mask & (0u - mask)) result |= b;
+            mask &= mask - 1;
+      }
+      return result;
+}
+
+constexpr u64 extract_bits(u64 x, u64 mask) {
+#if BMI2_ENABLED && (ARCHITECTURE == X64) && (COMPILER == MSVC)
+      if(!constant_evaluated()) return _pext_u64(x, mask);
+#elif BMI2_ENABLED && (ARCHITECTURE == X64)
+      if(!constant_evaluated()) return __builtin_ia32_pext_di(x, mask);
+#endif
+      u64 result = 0;
+      for(u64 b = 1; mask; b += b) {
+            if(x & mask & (0ull - mask)) result |= b;
+            mask &= mask - 1;
+      }
+      return result;
+}
 
 // Endian swapping (direct).
 void eswap(s16* x);
@@ -481,6 +984,41 @@ void eswap(u32* x);
 void eswap(s64* x);
 void eswap(u64* x);
 
+// Endian swapping (arrays, dst may be src for in place but must not partly overlap it).
+void eswap_array16(u16* x, sz count);
+void eswap_array32(u32* x, sz count);
+void eswap_array64(u64* x, sz count);
+void eswap_copy16(u16* dst, u16* src, sz count);
+void eswap_copy32(u32* dst, u32* src, sz count);
+void eswap_copy64(u64* dst, u64* src, sz count);
+
+// Unaligned loads and stores in a fixed byte order, for parsing streams (T is a 16, 32 or 64 bit integer).
+template<typename T> T load_le(void* src) {
+      T x;
+#if COMPILER == MSVC
+      x = *(T __unaligned*)src;
+#else
+      __builtin_memcpy(&x, src, sizeof(T));
+#endif
+      return x;
+}
+
+template<typename T> void store_le(void* dst, T x) {
+#if COMPILER == MSVC
+      *(T __unaligned*)dst = x;
+#else
+      __builtin_memcpy(dst, &x, sizeof(T));
+#endif
+}
+
+template<typename T> T load_be(void* src) {
+      return eswap(load_le<T>(src));
+}
+
+template<typename T> void store_be(void* dst, T x) {
+      store_le<T>(dst, eswap(x));
+}
+
 // Interlocked operations.
 s16 int_increment(volatile s16* x); // Returns the non-incremented value.
 u16 int_increment(volatile u16* x); // Returns the non-incremented value.
@@ -507,11 +1045,561 @@ u32 int_exchange(volatile u32* x, u32 exchange_value); // Returns the value befo
 s64 int_exchange(volatile s64* x, s64 exchange_value); // Returns the value before the write.
 u64 int_exchange(volatile u64* x, u64 exchange_value); // Returns the value before the write.
 
-// Bit scanning.
-u8 least_significant_bit(u32 mask); // Returns the bit index (0 is valid).
-u8 most_significant_bit(u32 mask);  // Returns the bit index (0 is valid).
-u8 least_significant_bit(u64 mask);  // Returns the bit index (0 is valid).
-u8 most_significant_bit(u64 mask);  // Returns the bit index (0 is valid).
+// Memory orders (same values as the GCC/Clang __ATOMIC_* constants).
+#define MEMORY_RELAXED 0x00
+#define MEMORY_ACQUIRE 0x02
+#define MEMORY_RELEASE 0x03
+#define MEMORY_ACQ_REL 0x04
+#define MEMORY_SEQ_CST 0x05
+
+// Two words swapped together by the 128 bit compare exchange.
+struct alignas(16) atomic_pair {
+      u64 lo;
+      u64 hi;
+};
+
+// Atomic operations (MSVC read-modify-writes are always full barriers, so there the order is only a minimum).
+force_inline u32   atomic_load(volatile u32* x, u32 order = MEMORY_SEQ_CST);
+force_inline u64   atomic_load(volatile u64* x, u32 order = MEMORY_SEQ_CST);
+force_inline void* atomic_load(void* volatile* x, u32 order = MEMORY_SEQ_CST);
+force_inline void  atomic_store(volatile u32* x, u32 value, u32 order = MEMORY_SEQ_CST);
+force_inline void  atomic_store(volatile u64* x, u64 value, u32 order = MEMORY_SEQ_CST);
+force_inline void  atomic_store(void* volatile* x, void* value, u32 order = MEMORY_SEQ_CST);
+force_inline u32   atomic_exchange(volatile u32* x, u32 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the write.
+force_inline u64   atomic_exchange(volatile u64* x, u64 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the write.
+force_inline void* atomic_exchange(void* volatile* x, void* value, u32 order = MEMORY_SEQ_CST); // Returns the value before the write.
+force_inline u32   atomic_fetch_add(volatile u32* x, u32 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the add.
+force_inline u64   atomic_fetch_add(volatile u64* x, u64 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the add.
+force_inline u32   atomic_fetch_or(volatile u32* x, u32 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the or.
+force_inline u64   atomic_fetch_or(volatile u64* x, u64 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the or.
+force_inline u32   atomic_fetch_and(volatile u32* x, u32 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the and.
+force_inline u64   atomic_fetch_and(volatile u64* x, u64 value, u32 order = MEMORY_SEQ_CST); // Returns the value before the and.
+force_inline void  atomic_fence(u32 order = MEMORY_SEQ_CST);
+
+// Atomic compare exchange (on failure expected receives the current value, the weak forms may fail spuriously inside retry loops).
+force_inline b8x atomic_compare_exchange(volatile u32* x, u32* expected, u32 desired, u32 order = MEMORY_SEQ_CST);
+force_inline b8x atomic_compare_exchange(volatile u64* x, u64* expected, u64 desired, u32 order = MEMORY_SEQ_CST);
+force_inline b8x atomic_compare_exchange(void* volatile* x, void** expected, void* desired, u32 order = MEMORY_SEQ_CST);
+b8x atomic_compare_exchange(volatile atomic_pair* x, atomic_pair* expected, atomic_pair desired); // Always sequentially consistent.
+force_inline b8x atomic_compare_exchange_weak(volatile u32* x, u32* expected, u32 desired, u32 order = MEMORY_SEQ_CST);
+force_inline b8x atomic_compare_exchange_weak(volatile u64* x, u64* expected, u64 desired, u32 order = MEMORY_SEQ_CST);
+force_inline b8x atomic_compare_exchange_weak(void* volatile* x, void** expected, void* desired, u32 order = MEMORY_SEQ_CST);
+
+// Atomic definitions (kept in the header so constant orders fold, out of line GCC treats a run time order as sequentially consistent).
+#if COMPILER != MSVC
+// A failed compare exchange only loads, so it can not carry the release half of the order.
+force_inline s32 atomic_failure_order(u32 order) {
+      if(order == MEMORY_ACQ_REL) return __ATOMIC_ACQUIRE;
+      if(order == MEMORY_RELEASE) return __ATOMIC_RELAXED;
+      return (s32)order;
+}
+#endif
+
+force_inline u32 atomic_load(volatile u32* x, u32 order) {
+#if COMPILER == MSVC
+      u32 result = *x;
+      _ReadWriteBarrier();
+      return result;
+#else
+      return __atomic_load_n(x, (s32)order);
+#endif
+}
+
+force_inline u64 atomic_load(volatile u64* x, u32 order) {
+#if COMPILER == MSVC
+      u64 result = *x;
+      _ReadWriteBarrier();
+      return result;
+#else
+      return __atomic_load_n(x, (s32)order);
+#endif
+}
+
+force_inline void* atomic_load(void* volatile* x, u32 order) {
+#if COMPILER == MSVC
+      void* result = *x;
+      _ReadWriteBarrier();
+      return result;
+#else
+      return __atomic_load_n(x, (s32)order);
+#endif
+}
+
+force_inline void atomic_store(volatile u32* x, u32 value, u32 order) {
+#if COMPILER == MSVC
+      if(order == MEMORY_SEQ_CST) {
+            _InterlockedExchange((volatile long*)x, (long)value);
+      } else {
+            _ReadWriteBarrier();
+            *x = value;
+      }
+#else
+      __atomic_store_n(x, value, (s32)order);
+#endif
+}
+
+force_inline void atomic_store(volatile u64* x, u64 value, u32 order) {
+#if COMPILER == MSVC
+      if(order == MEMORY_SEQ_CST) {
+            _InterlockedExchange64((volatile __int64*)x, (__int64)value);
+      } else {
+            _ReadWriteBarrier();
+            *x = value;
+      }
+#else
+      __atomic_store_n(x, value, (s32)order);
+#endif
+}
+
+force_inline void atomic_store(void* volatile* x, void* value, u32 order) {
+#if COMPILER == MSVC
+      if(order == MEMORY_SEQ_CST) {
+            _InterlockedExchangePointer(x, value);
+      } else {
+            _ReadWriteBarrier();
+            *x = value;
+      }
+#else
+      __atomic_store_n(x, value, (s32)order);
+#endif
+}
+
+force_inline u32 atomic_exchange(volatile u32* x, u32 value, u32 order) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedExchange((volatile long*)x, (long)value);
+#else
+      return __atomic_exchange_n(x, value, (s32)order);
+#endif
+}
+
+force_inline u64 atomic_exchange(volatile u64* x, u64 value, u32 order) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedExchange64((volatile __int64*)x, (__int64)value);
+#else
+      return __atomic_exchange_n(x, value, (s32)order);
+#endif
+}
+
+force_inline void* atomic_exchange(void* volatile* x, void* value, u32 order) {
+#if COMPILER == MSVC
+      return _InterlockedExchangePointer(x, value);
+#else
+      return __atomic_exchange_n(x, value, (s32)order);
+#endif
+}
+
+force_inline u32 atomic_fetch_add(volatile u32* x, u32 value, u32 order) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedExchangeAdd((volatile long*)x, (long)value);
+#else
+      return __atomic_fetch_add(x, value, (s32)order);
+#endif
+}
+
+force_inline u64 atomic_fetch_add(volatile u64* x, u64 value, u32 order) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedExchangeAdd64((volatile __int64*)x, (__int64)value);
+#else
+      return __atomic_fetch_add(x, value, (s32)order);
+#endif
+}
+
+force_inline u32 atomic_fetch_or(volatile u32* x, u32 value, u32 order) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedOr((volatile long*)x, (long)value);
+#else
+      return __atomic_fetch_or(x, value, (s32)order);
+#endif
+}
+
+force_inline u64 atomic_fetch_or(volatile u64* x, u64 value, u32 order) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedOr64((volatile __int64*)x, (__int64)value);
+#else
+      return __atomic_fetch_or(x, value, (s32)order);
+#endif
+}
+
+force_inline u32 atomic_fetch_and(volatile u32* x, u32 value, u32 order) {
+#if COMPILER == MSVC
+      return (u32)_InterlockedAnd((volatile long*)x, (long)value);
+#else
+      return __atomic_fetch_and(x, value, (s32)order);
+#endif
+}
+
+force_inline u64 atomic_fetch_and(volatile u64* x, u64 value, u32 order) {
+#if COMPILER == MSVC
+      return (u64)_InterlockedAnd64((volatile __int64*)x, (__int64)value);
+#else
+      return __atomic_fetch_and(x, value, (s32)order);
+#endif
+}
+
+force_inline void atomic_fence(u32 order) {
+#if COMPILER == MSVC
+      _ReadWriteBarrier();
+      if(order == MEMORY_SEQ_CST) _mm_mfence();
+#else
+      __atomic_thread_fence((s32)order);
+#endif
+}
+
+force_inline b8x atomic_compare_exchange(volatile u32* x, u32* expected, u32 desired, u32 order) {
+#if COMPILER == MSVC
+      u32 previous = (u32)_InterlockedCompareExchange((volatile long*)x, (long)desired, (long)*expected);
+      b8x result = previous == *expected;
+      *expected = previous;
+      return result;
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, false, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+force_inline b8x atomic_compare_exchange(volatile u64* x, u64* expected, u64 desired, u32 order) {
+#if COMPILER == MSVC
+      u64 previous = (u64)_InterlockedCompareExchange64((volatile __int64*)x, (__int64)desired, (__int64)*expected);
+      b8x result = previous == *expected;
+      *expected = previous;
+      return result;
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, false, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+force_inline b8x atomic_compare_exchange(void* volatile* x, void** expected, void* desired, u32 order) {
+#if COMPILER == MSVC
+      void* previous = _InterlockedCompareExchangePointer(x, desired, *expected);
+      b8x result = previous == *expected;
+      *expected = previous;
+      return result;
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, false, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+
+force_inline b8x atomic_compare_exchange_weak(volatile u32* x, u32* expected, u32 desired, u32 order) {
+#if COMPILER == MSVC
+      return atomic_compare_exchange(x, expected, desired, order);
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, true, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+force_inline b8x atomic_compare_exchange_weak(volatile u64* x, u64* expected, u64 desired, u32 order) {
+#if COMPILER == MSVC
+      return atomic_compare_exchange(x, expected, desired, order);
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, true, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+force_inline b8x atomic_compare_exchange_weak(void* volatile* x, void** expected, void* desired, u32 order) {
+#if COMPILER == MSVC
+      return atomic_compare_exchange(x, expected, desired, order);
+#else
+      return __atomic_compare_exchange_n(x, expected, desired, true, (s32)order, atomic_failure_order(order));
+#endif
+}
+
+// *********
+// *********
+
+// Fields written by different threads are kept a cache line apart.
+#define CACHE_LINE 64
+
+// Lock-free stacks (Treiber) with a version tag beside the head, a node popped and pushed back in between fails the exchange (ABA).
+// Popped nodes must stay readable memory (pool storage) since a racing pop may still look at their link.
+struct stack_node {
+      stack_node* volatile next;
+};
+
+struct tagged_stack {
+      volatile atomic_pair head; // Node and tag, swapped with the 128 bit compare exchange.
+};
+
+struct index_stack {
+      volatile u64 head; // Index and tag packed with pack_u64_x2.
+      volatile u32* next;
+};
+
+// Pointer stack operations (intrusive, zero initialized is empty).
+void        push_tagged_stack(tagged_stack* s, stack_node* node);
+stack_node* pop_tagged_stack(tagged_stack* s);     // Zero when empty.
+stack_node* pop_all_tagged_stack(tagged_stack* s); // Detaches every node, linked through next.
+
+// Index stack operations (next holds one link per pool slot, U32_MAX ends a chain).
+void init_index_stack(index_stack* s, u32* next);
+void push_index_stack(index_stack* s, u32 index);
+u32  pop_index_stack(index_stack* s);     // U32_MAX when empty.
+u32  pop_all_index_stack(index_stack* s); // First index of the detached chain.
+
+// Safe reclamation hands unlinked nodes back once no reader can still hold them, in batches linked through next.
+// Retired nodes start with a stack_node (the link is the node pointer readers protect), so the pending lists need no memory of their own.
+typedef void reclaim_proc(void* param, stack_node* nodes);
+
+// Reclamation sizes.
+#define EPOCH_BATCH  64 // Retired nodes a thread holds before it tries to move the epoch on.
+#define HAZARD_SLOTS 4  // Hazard pointers per thread.
+
+// Epoch based reclamation, readers only announce the epoch they entered, a node retired in epoch e is reclaimed once the epoch reaches e + 2.
+// Cheap for readers, but one thread stalled inside a critical section holds every reclamation back.
+struct epoch_domain;
+struct epoch_thread {
+      alignas(CACHE_LINE) volatile u64 state; // Announced epoch << 1 | active.
+      volatile u32 used;
+      u32 depth; // Nesting of enter_epoch.
+      stack_node* limbo[3]; // Pending nodes by epoch % 3.
+      u64 limbo_epoch[3];
+      u32 limbo_count[3];
+      epoch_domain* domain;
+};
+
+struct epoch_domain {
+      alignas(CACHE_LINE) volatile u64 epoch;
+      epoch_thread* threads;
+      u32 thread_count;
+      reclaim_proc* reclaim;
+      void* param;
+};
+
+// Epoch operations (a thread joins once, then brackets every read of shared nodes with enter and exit, sizes include a cache line of slack for aligning the slots).
+sz   get_epoch_domain_size(u32 thread_count);
+void init_epoch_domain(epoch_domain* d, void* storage, u32 thread_count, reclaim_proc* reclaim, void* param);
+epoch_thread* join_epoch_domain(epoch_domain* d); // Zero when every slot is taken.
+void leave_epoch_domain(epoch_thread* t); // Pending nodes stay with the slot for the next thread that joins.
+void enter_epoch(epoch_thread* t);
+void exit_epoch(epoch_thread* t);
+void retire_epoch(epoch_thread* t, stack_node* node); // Call once the node is unlinked, inside or outside a critical section.
+void flush_epoch_domain(epoch_domain* d); // Reclaims everything pending, only while no thread is inside.
+
+// Hazard pointers, readers publish each node they are about to use and a retiring thread skips the published ones.
+// Costs a fence per protected load, but a stalled reader only holds back the few nodes it has published.
+struct hazard_domain;
+struct hazard_thread {
+      alignas(CACHE_LINE) void* volatile hazards[HAZARD_SLOTS];
+      volatile u32 used;
+      stack_node* retired;
+      u32 retired_count;
+      void** scan; // Hash set of the published pointers while scanning.
+      hazard_domain* domain;
+};
+
+struct hazard_domain {
+      hazard_thread* threads;
+      u32 thread_count;
+      u32 scan_size; // Hash set slots (a power of two), retired nodes are scanned once a thread holds half as many.
+      reclaim_proc* reclaim;
+      void* param;
+};
+
+// Hazard pointer operations (sizes include a cache line of slack for aligning the slots).
+sz   get_hazard_domain_size(u32 thread_count);
+void init_hazard_domain(hazard_domain* d, void* storage, u32 thread_count, reclaim_proc* reclaim, void* param);
+hazard_thread* join_hazard_domain(hazard_domain* d); // Zero when every slot is taken.
+void  leave_hazard_domain(hazard_thread* t); // Clears the hazards, pending nodes stay with the slot.
+void* protect_hazard(hazard_thread* t, u32 slot, void* volatile* source); // Loads *source and keeps it from being reclaimed.
+void  clear_hazard(hazard_thread* t, u32 slot);
+void  retire_hazard(hazard_thread* t, stack_node* node); // Call once the node is unlinked.
+void  flush_hazard_domain(hazard_domain* d); // Reclaims everything pending, only while no hazard is set.
+
+// Lock contention statistics, point a lock at one to have it counted (only the waits are timed).
+struct lock_stats {
+      volatile u64 acquires;
+      volatile u64 contended;   // Acquires that had to wait.
+      volatile u64 wait_cycles; // read_timestamp ticks spent waiting.
+};
+
+// Locks (zero initialized is unlocked, stats is optional).
+struct spin_lock {
+      volatile u32 locked; // Test and test-and-set with exponential pause backoff.
+      lock_stats* stats;
+};
+
+struct ticket_lock {
+      volatile u32 next; // Fair, first come first served.
+      volatile u32 serving;
+      lock_stats* stats;
+};
+
+struct rw_lock {
+      volatile u32 state; // Reader count, a waiting writer holds new readers back.
+      lock_stats* stats;
+};
+
+struct mutex {
+      volatile u32 state; // Unlocked, locked, locked with sleepers (spins briefly before it sleeps on a futex).
+      lock_stats* stats;
+};
+
+// Lock operations.
+void lock(spin_lock* l);
+void lock(ticket_lock* l);
+void lock(mutex* l);
+void unlock(spin_lock* l);
+void unlock(ticket_lock* l);
+void unlock(mutex* l);
+b8x  try_lock(spin_lock* l);
+b8x  try_lock(ticket_lock* l);
+b8x  try_lock(mutex* l);
+void lock_read(rw_lock* l);
+void unlock_read(rw_lock* l);
+void lock_write(rw_lock* l);
+void unlock_write(rw_lock* l);
+
+// Sharded statistics, one cache line slot per processor written by the threads running there, slots are only combined on read.
+// Shard counts are powers of two, threads on processors past the count share slots (updates stay atomic, a migrated thread just shares a line).
+struct counter_shard {
+      alignas(CACHE_LINE) volatile u64 value;
+};
+
+struct sharded_counter {
+      counter_shard* shards;
+      u32 mask;
+};
+
+struct min_max_shard {
+      alignas(CACHE_LINE) volatile u64 min;
+      volatile u64 max;
+};
+
+struct sharded_min_max {
+      min_max_shard* shards;
+      u32 mask;
+};
+
+struct sharded_histogram {
+      volatile u64* bins; // One row of bin_count counts per shard.
+      u32 bin_count;
+      u32 stride; // Row length padded to whole cache lines.
+      u32 mask;
+};
+
+// Sharded statistics operations (sizes include a cache line of slack for aligning the slots, reads are a sum over slots, not a snapshot while updates run).
+u32  get_shard_count(void); // Processor count rounded up to a power of two.
+sz   get_sharded_counter_size(u32 shards);
+void init_sharded_counter(sharded_counter* c, void* storage, u32 shards);
+void add_sharded_counter(sharded_counter* c, u64 amount = 1);
+u64  read_sharded_counter(sharded_counter* c);
+u64  take_sharded_counter(sharded_counter* c); // Reads and zeroes, no concurrent add is lost.
+sz   get_sharded_min_max_size(u32 shards);
+void init_sharded_min_max(sharded_min_max* m, void* storage, u32 shards);
+void add_sharded_min_max(sharded_min_max* m, u64 x);
+void read_sharded_min_max(sharded_min_max* m, u64* min, u64* max); // U64_MAX and 0 when nothing was added.
+void reset_sharded_min_max(sharded_min_max* m);
+sz   get_sharded_histogram_size(u32 shards, u32 bin_count);
+void init_sharded_histogram(sharded_histogram* h, void* storage, u32 shards, u32 bin_count);
+void add_sharded_histogram(sharded_histogram* h, u32 bin, u64 amount = 1);
+void read_sharded_histogram(sharded_histogram* h, u64* bins); // Writes bin_count sums.
+void take_sharded_histogram(sharded_histogram* h, u64* bins); // Reads and zeroes, no concurrent add is lost.
+
+// Single producer single consumer ring of fixed size items in caller storage (capacity is a power of two).
+// Each side keeps a copy of the other side's index and only reloads it when the ring looks full (or empty).
+struct spsc_ring {
+      alignas(CACHE_LINE) volatile u64 tail; // Producer side.
+      u64 head_cache;
+      alignas(CACHE_LINE) volatile u64 head; // Consumer side.
+      u64 tail_cache;
+      alignas(CACHE_LINE) u8* items;
+      u32 size;
+      u32 mask;
+};
+
+// Single producer single consumer ring operations (one thread pushes, one thread pops).
+sz   get_spsc_ring_size(u32 capacity, u32 size);
+void init_spsc_ring(spsc_ring* r, void* storage, u32 capacity, u32 size);
+b8x  push_spsc_ring(spsc_ring* r, void* item); // False when full.
+b8x  pop_spsc_ring(spsc_ring* r, void* item);  // False when empty.
+
+// Zero copy batches, reserve hands out up to count contiguous slots (fewer when short or at the wrap) and commit publishes them.
+u32  reserve_spsc_write(spsc_ring* r, u32 count, void** items);
+void commit_spsc_write(spsc_ring* r, u32 count);
+u32  reserve_spsc_read(spsc_ring* r, u32 count, void** items);
+void commit_spsc_read(spsc_ring* r, u32 count);
+
+// Bounded multi producer multi consumer queue (Vyukov), a sequence number per cell says whether it is free or full for a given position.
+// Threads about to sleep join a waiter count and wait on a futex word that the other side bumps.
+struct mpmc_queue {
+      alignas(CACHE_LINE) volatile u64 tail; // Next push position.
+      alignas(CACHE_LINE) volatile u64 head; // Next pop position.
+      alignas(CACHE_LINE) volatile u32 pushed; // Bumped for sleeping consumers.
+      volatile u32 pop_waiters;
+      alignas(CACHE_LINE) volatile u32 popped; // Bumped for sleeping producers.
+      volatile u32 push_waiters;
+      alignas(CACHE_LINE) u8* cells;
+      u64 mask;
+      u32 size;
+      u32 stride;
+};
+
+// Multi producer multi consumer queue operations (capacity is a power of two).
+sz   get_mpmc_queue_size(u32 capacity, u32 size);
+void init_mpmc_queue(mpmc_queue* q, void* storage, u32 capacity, u32 size);
+b8x  try_push_mpmc_queue(mpmc_queue* q, void* item); // False when full.
+b8x  try_pop_mpmc_queue(mpmc_queue* q, void* item);  // False when empty.
+void push_mpmc_queue(mpmc_queue* q, void* item);     // Spins, then sleeps while full.
+void pop_mpmc_queue(mpmc_queue* q, void* item);      // Spins, then sleeps while empty.
+
+// Job system sizes (per worker, powers of two).
+#define JOB_DEQUE_CAPACITY 4096 // Queued jobs, further jobs run inline.
+#define JOB_POOL_CAPACITY  4096 // Job records in flight (recycled round robin), further jobs run inline.
+
+// Jobs (the counter, if any, is decremented once the job has run).
+typedef void job_proc(void* param);
+struct job {
+      job_proc* proc;
+      void* param;
+      volatile u32* counter;
+      volatile u32 busy;
+};
+
+// Chase-Lev deque, the owner pushes and pops at the bottom while thieves take from the top.
+struct job_deque {
+      alignas(CACHE_LINE) volatile u64 top;
+      alignas(CACHE_LINE) volatile u64 bottom;
+      alignas(CACHE_LINE) job** jobs;
+};
+
+struct job_system;
+struct job_worker {
+      job_deque deque;
+      job* pool;
+      u32 pool_next;
+      u32 index;
+      rng rn; // Victim choice.
+      thread t;
+      job_system* system;
+};
+
+struct job_system {
+      job_worker* workers;
+      u32 worker_count;
+      volatile u32 running;
+      alignas(CACHE_LINE) volatile u32 signal; // Bumped for sleeping workers.
+      volatile u32 sleepers;
+};
+
+// Job system (worker 0 is the thread that starts it, the others are new threads pinned to their own processor).
+// Jobs can only be queued from worker threads, other threads run them inline but may still wait (and steal).
+sz   get_job_system_size(u32 worker_count);
+b8x  start_job_system(job_system* s, void* storage, u32 worker_count, b8x pin = true);
+void stop_job_system(job_system* s); // Call from worker 0 once all work is done.
+void run_job(job_system* s, job_proc* proc, void* param, volatile u32* counter = 0); // Increments the counter.
+void wait_counter(job_system* s, volatile u32* counter); // Runs other jobs until the counter drops to zero.
+
+// Parallel loops over [begin, end) in blocks of grain indices, a range is only split further when the local deque has run dry.
+// Reductions and scans combine the per block results in a fixed order, so float results depend on grain but not on threads or timing.
+typedef void range_proc(void* param, u64 begin, u64 end);
+typedef void reduce_proc(void* param, u64 begin, u64 end, void* result); // Writes the result of one block.
+typedef void combine_proc(void* param, void* result, void* left, void* right); // Result = left op right (may alias either).
+typedef void scan_proc(void* param, u64 begin, u64 end, void* prefix); // Prefix of everything before begin, zero for the first block.
+
+// Parallel loops (partials hold one result of size bytes per block).
+u64  get_parallel_block_count(u64 begin, u64 end, u64 grain);
+void parallel_for(job_system* s, u64 begin, u64 end, u64 grain, range_proc* proc, void* param);
+void parallel_reduce(job_system* s, u64 begin, u64 end, u64 grain, reduce_proc* reduce, combine_proc* combine, void* param, void* partials, u32 size, void* result);
+void parallel_scan(job_system* s, u64 begin, u64 end, u64 grain, reduce_proc* reduce, combine_proc* combine, scan_proc* scan, void* param, void* partials, u32 size);
 
 // *********
 // *********
@@ -857,4 +1945,18 @@ quat inverse(quat q);
 v3   to_euler_xyz(quat q);
 quat slerp(quat a, quat b, f32 t);
 
+// *********
+// *********
+
+// Geometric sampling, batches written straight into point arrays.
+void fill_in_r2(rng* rn, v2* out, sz count, r2 bounds);
+void fill_in_disk(rng* rn, v2* out, sz count, v2 center = {}, f32 radius = 1.0f);
+void fill_on_sphere(rng* rn, v3* out, sz count); // Unit sphere surface.
+void fill_in_sphere(rng* rn, v3* out, sz count); // Unit ball.
+void fill_rotations(rng* rn, quat* out, sz count); // Uniform unit quaternions (Shoemake).
+
+// Poisson-disk points inside bounds, no two closer than radius (Bridson), returns how many were written (up to capacity).
+sz  get_poisson_disk_scratch_size(r2 bounds, f32 radius, u32 capacity);
+u32 poisson_disk(rng* rn, r2 bounds, f32 radius, v2* out, u32 capacity, void* scratch, u32 attempts = 30);
+
 #endif
\ No newline at end of file
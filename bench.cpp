@@ -0,0 +1,623 @@
+#include "basic.h"
+#include "basic.cpp"
+
+#include <stdio.h>
+
+#if PLATFORM != WIN32
+#include <time.h>
+#include <sys/mman.h>
+#endif
+
+internal u64 bench_now_ns(void) {
+#if PLATFORM == WIN32
+      LARGE_INTEGER frequency = {};
+      LARGE_INTEGER counter = {};
+      QueryPerformanceFrequency(&frequency);
+      QueryPerformanceCounter(&counter);
+      return (u64)((f64)counter.QuadPart * 1e9 / (f64)frequency.QuadPart);
+#else
+      struct timespec now = {};
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+#endif
+}
+
+internal void* bench_alloc(sz size) {
+#if PLATFORM == WIN32
+      return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+      void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      return (memory == MAP_FAILED) ? 0 : memory;
+#endif
+}
+
+internal void bench_free(void* memory, sz size) {
+#if PLATFORM == WIN32
+      VirtualFree(memory, 0, MEM_RELEASE);
+#else
+      munmap(memory, size);
+#endif
+}
+
+// *********
+// *********
+
+// Key distributions.
+enum bench_distribution {
+      BENCH_RANDOM,
+      BENCH_SORTED,
+      BENCH_REVERSE,
+      BENCH_ORGAN_PIPE,
+      BENCH_FEW_UNIQUE,
+      BENCH_ZIPF,
+      BENCH_DISTRIBUTION_COUNT,
+};
+
+global_variable const char* bench_distribution_names[BENCH_DISTRIBUTION_COUNT] = {
+      "random", "sorted", "reverse", "organ-pipe", "few-unique", "zipf",
+};
+
+// Zipf (s = 1) over this many ranks, drawn by inverting the cumulative harmonic weights.
+#define BENCH_ZIPF_RANKS 65536
+global_variable f64 bench_zipf_cdf[BENCH_ZIPF_RANKS];
+
+internal void bench_init_zipf(void) {
+      f64 total = 0.0;
+      for(u32 rank = 0; rank < BENCH_ZIPF_RANKS; ++rank) {
+            total += 1.0 / (f64)(rank + 1);
+            bench_zipf_cdf[rank] = total;
+      }
+}
+
+internal u32 bench_zipf(rng* rn) {
+      f64 target = unilateral_f64(rn) * bench_zipf_cdf[BENCH_ZIPF_RANKS - 1];
+      u32 lo = 0;
+      u32 hi = BENCH_ZIPF_RANKS - 1;
+      while(lo < hi) {
+            u32 mid = (lo + hi) / 2;
+            if(bench_zipf_cdf[mid] < target) lo = mid + 1;
+            else hi = mid;
+      }
+      
+      return lo;
+}
+
+internal void bench_generate(rng* rn, sort_entry* entries, u32 count, bench_distribution distribution) {
+      for(u32 i = 0; i < count; ++i) {
+            u32 key = 0;
+            switch(distribution) {
+                  case BENCH_RANDOM:     { key = next_u32(rn); } break;
+                  case BENCH_SORTED:     { key = i; } break;
+                  case BENCH_REVERSE:    { key = count - i; } break;
+                  case BENCH_ORGAN_PIPE: { key = (i < count / 2) ? i : (count - i); } break;
+                  case BENCH_FEW_UNIQUE: { key = range_u32(rn, 0, 15); } break;
+                  case BENCH_ZIPF:       { key = bench_zipf(rn); } break;
+                  invalid_default_case;
+            }
+            
+            entries[i] = {key, i};
+      }
+}
+
+// *********
+// *********
+
+// Sorters under test.
+enum bench_sorter {
+      BENCH_BUBBLE,
+      BENCH_QUICK,
+      BENCH_RADIX,
+      BENCH_INTRO,
+      BENCH_NETWORK,
+      BENCH_SORTER_COUNT,
+};
+
+global_variable const char* bench_sorter_names[BENCH_SORTER_COUNT] = {
+      "sort_bubble", "sort_quick", "sort_radix", "sort_intro", "sort_network",
+};
+
+internal void bench_sort(bench_sorter sorter, sort_entry* entries, u32 count, sort_entry* temp) {
+      switch(sorter) {
+            case BENCH_BUBBLE:  { sort_bubble(entries, count); } break;
+            case BENCH_QUICK:   { sort_quick(entries, count); } break;
+            case BENCH_RADIX:   { sort_radix(entries, count, temp); } break;
+            case BENCH_INTRO:   { sort_intro(entries, count); } break;
+            case BENCH_NETWORK: { sort_network(entries, count); } break;
+            invalid_default_case;
+      }
+}
+
+// Small arrays are repeated until this many entries are sorted per measurement.
+#define BENCH_BATCH_ENTRIES mil(1)
+
+// Once a sorter is this slow on a distribution, larger sizes are skipped (quadratic behaviour).
+#define BENCH_SKIP_NS_PER_ENTRY 2000.0
+
+// Sizes go from 16 up to max_count in steps of 16x.
+internal int bench_sorts(u64 max_count) {
+      u32 counts[16] = {};
+      u32 count_count = 0;
+      for(u64 count = 16; count <= max_count && count_count < countof(counts); count *= 16) {
+            counts[count_count++] = (u32)count;
+      }
+      
+      if(count_count && (counts[count_count - 1] < max_count)) {
+            if(count_count == countof(counts)) count_count--;
+            counts[count_count++] = (u32)max_count;
+      }
+      
+      u64 largest = max(max_count, (u64)BENCH_BATCH_ENTRIES);
+      sz buffer_size = (sz)(largest * sizeof(sort_entry));
+      sort_entry* source = (sort_entry*)bench_alloc(buffer_size);
+      sort_entry* work = (sort_entry*)bench_alloc(buffer_size);
+      sort_entry* temp = (sort_entry*)bench_alloc(buffer_size);
+      if(!source || !work || !temp) {
+            printf("Out of memory for %llu entries.\n", (unsigned long long)largest);
+            return 1;
+      }
+      
+      bench_init_zipf();
+      printf("%-14s %-12s %12s %14s\n", "sorter", "distribution", "size", "ns/element");
+      
+      int failures = 0;
+      for(u32 sorter = 0; sorter < BENCH_SORTER_COUNT; ++sorter) {
+            for(u32 distribution = 0; distribution < BENCH_DISTRIBUTION_COUNT; ++distribution) {
+                  b8x skipping = false;
+                  for(u32 c = 0; c < count_count; ++c) {
+                        u32 count = counts[c];
+                        if((sorter == BENCH_NETWORK) && (count > SORT_NETWORK_MAX)) break;
+                        
+                        if(skipping) {
+                              printf("%-14s %-12s %12u %14s\n", bench_sorter_names[sorter], bench_distribution_names[distribution], count, "skipped");
+                              continue;
+                        }
+                        
+                        // Same seed for every sorter, so they all see the same keys.
+                        rng rn = {};
+                        seed(&rn, 0x5EED + count);
+                        u32 repeats = max(1u, (u32)(BENCH_BATCH_ENTRIES / count));
+                        for(u32 r = 0; r < repeats; ++r) {
+                              bench_generate(&rn, source + (sz)r * count, count, (bench_distribution)distribution);
+                        }
+                        
+                        copy_array(work, source, (sz)repeats * count);
+                        u64 start = bench_now_ns();
+                        for(u32 r = 0; r < repeats; ++r) {
+                              bench_sort((bench_sorter)sorter, work + (sz)r * count, count, temp);
+                        }
+                        u64 elapsed = bench_now_ns() - start;
+                        
+                        b8x sorted = true;
+                        for(u32 r = 0; r < repeats; ++r) {
+                              sorted = sorted && are_sorted(work + (sz)r * count, count);
+                        }
+                        
+                        f64 ns_per_entry = (f64)elapsed / ((f64)repeats * (f64)count);
+                        printf("%-14s %-12s %12u %14.2f%s\n", bench_sorter_names[sorter], bench_distribution_names[distribution], count, ns_per_entry, sorted ? "" : "  NOT SORTED");
+                        fflush(stdout);
+                        
+                        failures += sorted ? 0 : 1;
+                        skipping = ns_per_entry > BENCH_SKIP_NS_PER_ENTRY;
+                  }
+            }
+      }
+      
+      bench_free(source, buffer_size);
+      bench_free(work, buffer_size);
+      bench_free(temp, buffer_size);
+      return failures ? 1 : 0;
+}
+
+// *********
+// *********
+
+// Ring throughput between two pinned threads, the consumer checks that the sequence numbers arrive in order.
+#define BENCH_RING_CAPACITY 4096
+#define BENCH_RING_BATCH    256
+
+struct bench_ring_shared {
+      spsc_ring ring;
+      u64 messages;
+      b8x batched;
+      b8x failed;
+};
+
+// Spins while the other side is expected to catch up soon, then gives up the time slice.
+internal void bench_wait(u32* spins) {
+      if(++*spins < 1024) {
+            spin_pause();
+      } else {
+            yield_thread();
+            *spins = 0;
+      }
+}
+
+internal void bench_ring_producer(void* param) {
+      bench_ring_shared* shared = (bench_ring_shared*)param;
+      u32 spins = 0;
+      for(u64 next = 0; next < shared->messages;) {
+            if(shared->batched) {
+                  u64* items;
+                  u32 count = reserve_spsc_write(&shared->ring, (u32)min((u64)BENCH_RING_BATCH, shared->messages - next), (void**)&items);
+                  for(u32 i = 0; i < count; ++i) items[i] = next++;
+                  commit_spsc_write(&shared->ring, count);
+                  if(!count) bench_wait(&spins);
+            } else if(push_spsc_ring(&shared->ring, &next)) {
+                  next++;
+            } else {
+                  bench_wait(&spins);
+            }
+      }
+}
+
+internal void bench_ring_consumer(void* param) {
+      bench_ring_shared* shared = (bench_ring_shared*)param;
+      u32 spins = 0;
+      b8x failed = false;
+      for(u64 expected = 0; expected < shared->messages;) {
+            if(shared->batched) {
+                  u64* items;
+                  u32 count = reserve_spsc_read(&shared->ring, BENCH_RING_BATCH, (void**)&items);
+                  for(u32 i = 0; i < count; ++i) failed |= items[i] != expected++;
+                  commit_spsc_read(&shared->ring, count);
+                  if(!count) bench_wait(&spins);
+            } else {
+                  u64 item;
+                  if(pop_spsc_ring(&shared->ring, &item)) failed |= item != expected++;
+                  else bench_wait(&spins);
+            }
+      }
+      
+      shared->failed = failed;
+}
+
+internal int bench_rings(u64 messages) {
+      local_persist u64 storage[BENCH_RING_CAPACITY];
+      local_persist bench_ring_shared shared;
+      u32 processors = get_processor_count();
+      printf("%-14s %-12s %12s %14s\n", "ring", "mode", "messages", "M messages/s");
+      
+      int failures = 0;
+      for(u32 batched = 0; batched < 2; ++batched) {
+            init_spsc_ring(&shared.ring, storage, BENCH_RING_CAPACITY, sizeof(u64));
+            shared.messages = messages;
+            shared.batched = batched;
+            shared.failed = false;
+            
+            // Producer and consumer on different cores when there are two.
+            thread producer, consumer;
+            u64 start = bench_now_ns();
+            if(!start_thread(&consumer, bench_ring_consumer, &shared) || !start_thread(&producer, bench_ring_producer, &shared)) {
+                  printf("Could not start the ring threads.\n");
+                  return 1;
+            }
+            pin_thread(&consumer, 0);
+            pin_thread(&producer, (processors > 1) ? 1 : 0);
+            join_thread(&producer);
+            join_thread(&consumer);
+            u64 elapsed = bench_now_ns() - start;
+            
+            f64 rate = (f64)messages * 1e3 / (f64)max(elapsed, 1ull);
+            printf("%-14s %-12s %12llu %14.2f%s\n", "spsc_ring", batched ? "batched" : "single", (unsigned long long)messages, rate, shared.failed ? "  OUT OF ORDER" : "");
+            fflush(stdout);
+            failures += shared.failed ? 1 : 0;
+      }
+      
+      return failures ? 1 : 0;
+}
+
+// *********
+// *********
+
+// Queue fan-in, 1 to 64 producers feed two consumers through blocking pushes and pops.
+#define BENCH_QUEUE_CAPACITY  1024
+#define BENCH_QUEUE_CONSUMERS 2
+#define BENCH_QUEUE_MAX       64
+#define BENCH_QUEUE_STOP      U64_MAX
+
+struct bench_queue_shared {
+      mpmc_queue queue;
+      u64 per_producer;
+      volatile u64 received;
+};
+
+internal void bench_queue_producer(void* param) {
+      bench_queue_shared* shared = (bench_queue_shared*)param;
+      for(u64 i = 0; i < shared->per_producer; ++i) push_mpmc_queue(&shared->queue, &i);
+}
+
+internal void bench_queue_consumer(void* param) {
+      bench_queue_shared* shared = (bench_queue_shared*)param;
+      u64 received = 0;
+      for(;;) {
+            u64 item;
+            pop_mpmc_queue(&shared->queue, &item);
+            if(item == BENCH_QUEUE_STOP) break;
+            received++;
+      }
+      atomic_fetch_add(&shared->received, received);
+}
+
+internal int bench_queues(u64 messages) {
+      local_persist u8 storage[BENCH_QUEUE_CAPACITY * 16];
+      local_persist bench_queue_shared shared;
+      local_persist thread threads[BENCH_QUEUE_MAX + BENCH_QUEUE_CONSUMERS];
+      u32 processors = get_processor_count();
+      printf("%-14s %-12s %12s %14s\n", "queue", "producers", "messages", "M messages/s");
+      
+      int failures = 0;
+      for(u32 producers = 1; producers <= BENCH_QUEUE_MAX; producers *= 2) {
+            init_mpmc_queue(&shared.queue, storage, BENCH_QUEUE_CAPACITY, sizeof(u64));
+            shared.per_producer = max(messages / producers, 1ull);
+            shared.received = 0;
+            
+            // Consumers first, then producers, spread over the cores round robin.
+            u32 count = producers + BENCH_QUEUE_CONSUMERS;
+            u64 start = bench_now_ns();
+            for(u32 i = 0; i < count; ++i) {
+                  if(!start_thread(&threads[i], (i < BENCH_QUEUE_CONSUMERS) ? bench_queue_consumer : bench_queue_producer, &shared)) {
+                        printf("Could not start the queue threads.\n");
+                        return 1;
+                  }
+                  pin_thread(&threads[i], i % processors);
+            }
+            for(u32 i = BENCH_QUEUE_CONSUMERS; i < count; ++i) join_thread(&threads[i]);
+            for(u32 i = 0; i < BENCH_QUEUE_CONSUMERS; ++i) {
+                  u64 stop = BENCH_QUEUE_STOP;
+                  push_mpmc_queue(&shared.queue, &stop);
+            }
+            for(u32 i = 0; i < BENCH_QUEUE_CONSUMERS; ++i) join_thread(&threads[i]);
+            u64 elapsed = bench_now_ns() - start;
+            
+            u64 sent = shared.per_producer * producers;
+            b8x lost = shared.received != sent;
+            f64 rate = (f64)sent * 1e3 / (f64)max(elapsed, 1ull);
+            printf("%-14s %-12u %12llu %14.2f%s\n", "mpmc_queue", producers, (unsigned long long)sent, rate, lost ? "  LOST MESSAGES" : "");
+            fflush(stdout);
+            failures += lost ? 1 : 0;
+      }
+      
+      return failures ? 1 : 0;
+}
+
+// *********
+// *********
+
+// Lock hand-off, 1 to 8 threads take a lock around a one line critical section, the OS mutex is the baseline.
+enum bench_lock {
+      BENCH_SPIN_LOCK,
+      BENCH_TICKET_LOCK,
+      BENCH_MUTEX,
+      BENCH_RW_LOCK,
+      BENCH_OS_MUTEX,
+      BENCH_LOCK_COUNT,
+};
+
+global_variable const char* bench_lock_names[BENCH_LOCK_COUNT] = {
+      "spin_lock", "ticket_lock", "mutex", "rw_lock", "os_mutex",
+};
+
+#define BENCH_LOCK_THREADS 8
+
+struct bench_lock_shared {
+      bench_lock kind;
+      u64 rounds;
+      spin_lock spin;
+      ticket_lock ticket;
+      mutex mtx;
+      rw_lock rw;
+#if PLATFORM == WIN32
+      SRWLOCK os;
+#else
+      pthread_mutex_t os;
+#endif
+      volatile u64 counter;
+};
+
+internal void bench_lock_proc(void* param) {
+      bench_lock_shared* shared = (bench_lock_shared*)param;
+      for(u64 i = 0; i < shared->rounds; ++i) {
+            switch(shared->kind) {
+                  case BENCH_SPIN_LOCK:   { lock(&shared->spin); shared->counter = shared->counter + 1; unlock(&shared->spin); } break;
+                  case BENCH_TICKET_LOCK: { lock(&shared->ticket); shared->counter = shared->counter + 1; unlock(&shared->ticket); } break;
+                  case BENCH_MUTEX:       { lock(&shared->mtx); shared->counter = shared->counter + 1; unlock(&shared->mtx); } break;
+                  case BENCH_RW_LOCK:     { lock_write(&shared->rw); shared->counter = shared->counter + 1; unlock_write(&shared->rw); } break;
+#if PLATFORM == WIN32
+                  case BENCH_OS_MUTEX:    { AcquireSRWLockExclusive(&shared->os); shared->counter = shared->counter + 1; ReleaseSRWLockExclusive(&shared->os); } break;
+#else
+                  case BENCH_OS_MUTEX:    { pthread_mutex_lock(&shared->os); shared->counter = shared->counter + 1; pthread_mutex_unlock(&shared->os); } break;
+#endif
+                  invalid_default_case;
+            }
+      }
+}
+
+internal int bench_locks(u64 acquires) {
+      local_persist bench_lock_shared shared;
+      local_persist thread threads[BENCH_LOCK_THREADS];
+      u32 processors = get_processor_count();
+      printf("%-14s %-12s %12s %14s %12s %16s\n", "lock", "threads", "acquires", "ns/acquire", "contended", "wait cycles/acq");
+      
+      int failures = 0;
+      for(u32 kind = 0; kind < BENCH_LOCK_COUNT; ++kind) {
+            for(u32 count = 1; count <= BENCH_LOCK_THREADS; count *= 2) {
+                  lock_stats stats = {};
+                  zero_obj(&shared);
+                  shared.kind = (bench_lock)kind;
+                  shared.rounds = max(acquires / count, 1ull);
+                  shared.spin.stats = &stats;
+                  shared.ticket.stats = &stats;
+                  shared.mtx.stats = &stats;
+                  shared.rw.stats = &stats;
+#if PLATFORM == WIN32
+                  InitializeSRWLock(&shared.os);
+#else
+                  pthread_mutex_init(&shared.os, 0);
+#endif
+                  
+                  u64 start = bench_now_ns();
+                  for(u32 i = 0; i < count; ++i) {
+                        if(!start_thread(&threads[i], bench_lock_proc, &shared)) {
+                              printf("Could not start the lock threads.\n");
+                              return 1;
+                        }
+                        pin_thread(&threads[i], i % processors);
+                  }
+                  for(u32 i = 0; i < count; ++i) join_thread(&threads[i]);
+                  u64 elapsed = bench_now_ns() - start;
+
+#if PLATFORM != WIN32
+                  pthread_mutex_destroy(&shared.os);
+#endif
+                  u64 total = shared.rounds * count;
+                  b8x lost = shared.counter != total;
+                  f64 per_acquire = (f64)elapsed / (f64)total;
+                  if(kind == BENCH_OS_MUTEX) {
+                        printf("%-14s %-12u %12llu %14.2f %12s %16s%s\n", bench_lock_names[kind], count, (unsigned long long)total, per_acquire, "-", "-", lost ? "  LOST UPDATES" : "");
+                  } else {
+                        f64 contended = 100.0 * (f64)stats.contended / (f64)max(stats.acquires, 1ull);
+                        f64 wait = (f64)stats.wait_cycles / (f64)max(stats.acquires, 1ull);
+                        printf("%-14s %-12u %12llu %14.2f %11.2f%% %16.1f%s\n", bench_lock_names[kind], count, (unsigned long long)total, per_acquire, contended, wait, lost ? "  LOST UPDATES" : "");
+                  }
+                  fflush(stdout);
+                  failures += lost ? 1 : 0;
+            }
+      }
+      
+      return failures ? 1 : 0;
+}
+
+// *********
+// *********
+
+// Counter increments, 1 to 8 threads bump one shared word or a sharded counter.
+#define BENCH_COUNT_THREADS 8
+
+struct bench_count_shared {
+      b8x sharded;
+      u64 rounds;
+      sharded_counter counter;
+      alignas(CACHE_LINE) volatile u64 shared;
+};
+
+internal void bench_count_proc(void* param) {
+      bench_count_shared* shared = (bench_count_shared*)param;
+      if(shared->sharded) {
+            for(u64 i = 0; i < shared->rounds; ++i) add_sharded_counter(&shared->counter);
+      } else {
+            for(u64 i = 0; i < shared->rounds; ++i) atomic_fetch_add(&shared->shared, 1ull, MEMORY_RELAXED);
+      }
+}
+
+internal int bench_counts(u64 increments) {
+      local_persist bench_count_shared shared;
+      local_persist thread threads[BENCH_COUNT_THREADS];
+      u32 processors = get_processor_count();
+      u32 shards = get_shard_count();
+      void* storage = bench_alloc(get_sharded_counter_size(shards));
+      printf("%-16s %-12s %12s %16s\n", "counter", "threads", "increments", "ns/increment");
+      
+      int failures = 0;
+      for(u32 sharded = 0; sharded < 2; ++sharded) {
+            for(u32 count = 1; count <= BENCH_COUNT_THREADS; count *= 2) {
+                  shared.sharded = sharded;
+                  shared.rounds = max(increments / count, 1ull);
+                  shared.shared = 0;
+                  init_sharded_counter(&shared.counter, storage, shards);
+                  
+                  u64 start = bench_now_ns();
+                  for(u32 i = 0; i < count; ++i) {
+                        if(!start_thread(&threads[i], bench_count_proc, &shared)) {
+                              printf("Could not start the counter threads.\n");
+                              return 1;
+                        }
+                        pin_thread(&threads[i], i % processors);
+                  }
+                  for(u32 i = 0; i < count; ++i) join_thread(&threads[i]);
+                  u64 elapsed = bench_now_ns() - start;
+                  
+                  u64 total = shared.rounds * count;
+                  u64 counted = sharded ? read_sharded_counter(&shared.counter) : shared.shared;
+                  printf("%-16s %-12u %12llu %16.2f%s\n", sharded ? "sharded_counter" : "shared atomic", count, (unsigned long long)total, (f64)elapsed / (f64)total, counted != total ? "  LOST UPDATES" : "");
+                  fflush(stdout);
+                  failures += counted != total ? 1 : 0;
+            }
+      }
+      
+      bench_free(storage, get_sharded_counter_size(shards));
+      return failures ? 1 : 0;
+}
+
+// *********
+// *********
+
+// Endian conversion of a large buffer, one eswap call per element against the array versions.
+internal int bench_endian(u64 bytes) {
+      sz size = (sz)max(bytes & ~63ull, 64ull);
+      u8* source = (u8*)bench_alloc(size);
+      u8* target = (u8*)bench_alloc(size);
+      if(!source || !target) {
+            printf("Could not allocate the endian buffers.\n");
+            return 1;
+      }
+      for(sz i = 0; i < size; ++i) source[i] = (u8)(i * 131);
+      copy(target, source, size);
+      printf("%-22s %-8s %14s %12s\n", "conversion", "width", "bytes", "GB/s");
+      
+      for(u32 width = 2; width <= 8; width *= 2) {
+            sz count = size / width;
+            for(u32 kind = 0; kind < 3; ++kind) {
+                  // Best of a few passes, the first one also faults the pages in.
+                  u64 best = U64_MAX;
+                  for(u32 pass = 0; pass < 4; ++pass) {
+                        u64 start = bench_now_ns();
+                        if(kind == 0) {
+                              if(width == 2) for(sz i = 0; i < count; ++i) ((u16*)target)[i] = eswap(((volatile u16*)source)[i]);
+                              if(width == 4) for(sz i = 0; i < count; ++i) ((u32*)target)[i] = eswap(((volatile u32*)source)[i]);
+                              if(width == 8) for(sz i = 0; i < count; ++i) ((u64*)target)[i] = eswap(((volatile u64*)source)[i]);
+                        } else if(kind == 1) {
+                              if(width == 2) eswap_copy16((u16*)target, (u16*)source, count);
+                              if(width == 4) eswap_copy32((u32*)target, (u32*)source, count);
+                              if(width == 8) eswap_copy64((u64*)target, (u64*)source, count);
+                        } else {
+                              if(width == 2) eswap_array16((u16*)target, count);
+                              if(width == 4) eswap_array32((u32*)target, count);
+                              if(width == 8) eswap_array64((u64*)target, count);
+                        }
+                        best = min(best, bench_now_ns() - start);
+                  }
+                  
+                  const char* names[] = {"eswap per element", "eswap_copy", "eswap_array in place"};
+                  printf("%-22s %-8u %14llu %12.2f\n", names[kind], width * 8, (unsigned long long)size, (f64)size / (f64)max(best, 1ull));
+                  fflush(stdout);
+            }
+      }
+      
+      bench_free(source, size);
+      bench_free(target, size);
+      return 0;
+}
+
+entry_point int main(int argc, char** argv) {
+      // Usage: bench [sort|ring|queue|lock|count|endian] [count], count is the largest sort, the messages per ring or queue run, the operations per lock or counter run or the bytes per endian run (100M by default).
+      char mode = 's';
+      char* digits = 0;
+      for(int i = 1; i < argc; ++i) {
+            if((argv[i][0] >= '0') && (argv[i][0] <= '9')) digits = argv[i];
+            else mode = argv[i][0];
+      }
+      
+      u64 count = mil(100);
+      if(digits) {
+            count = 0;
+            for(char* at = digits; (*at >= '0') && (*at <= '9'); ++at) count = count * 10 + (*at - '0');
+      }
+      
+      printf("%s %s %s\n", COMPILER_NAME, PLATFORM_NAME, SIMD_NAME);
+      if(mode == 'r') return bench_rings(count);
+      if(mode == 'q') return bench_queues(count);
+      if(mode == 'l') return bench_locks(count);
+      if(mode == 'c') return bench_counts(count);
+      if(mode == 'e') return bench_endian(count);
+      return bench_sorts(count);
+}
@@ -3,6 +3,7 @@
 if not exist .build mkdir .build
 pushd .build
 
-cl ../test.cpp /nologo /FC /Ob0 /Od /Z7 /link /incremental:no user32.lib gdi32.lib
+cl ../test.cpp /nologo /FC /arch:AVX2 /Ob0 /Od /Z7 /link /incremental:no user32.lib gdi32.lib synchronization.lib
+cl ../bench.cpp /nologo /FC /arch:AVX2 /O2 /Z7 /link /incremental:no user32.lib gdi32.lib synchronization.lib
 
 popd
\ No newline at end of file
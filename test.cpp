@@ -67,8 +67,1520 @@ internal void test_rng(void) {
       printf("100,0%%\n");
 }
 
+internal void test_rng_bounded(void) {
+      rng rn = {};
+      seed(&rn, 99ull, RNG_XOSHIRO256SS);
+      
+      // A span of 3 * 2^30 is where modulo reduction doubles the odds of the lowest third.
+      u32 thirds[3] = {};
+      for(s32 i = 0; i < 300000; ++i) thirds[range_u32(&rn, 0, (3u << 30) - 1) >> 30]++;
+      for(u32 i = 0; i < 3; ++i) assert(in_range(thirds[i], 97000, 103000));
+      
+      // Signed 64 bit ranges wider than 2^32 reach both ends.
+      b8x low = false, high = false;
+      for(s32 i = 0; i < 1000; ++i) {
+            s64 x = range_s64(&rn, -(1ll << 40), 1ll << 40);
+            assert(in_range(x, -(1ll << 40), 1ll << 40));
+            low = low || (x < -(1ll << 39));
+            high = high || (x > (1ll << 39));
+      }
+      assert(low && high);
+      
+      // Full ranges and single values.
+      u32 negative = 0;
+      for(s32 i = 0; i < 1000; ++i) {
+            negative += range_s64(&rn, S64_MIN, S64_MAX) < 0;
+            assert(range_u32(&rn, 7, 7) == 7);
+            assert(range_s32(&rn, -5, -5) == -5);
+            assert(in_range(range_s32(&rn, S32_MIN, S32_MAX), S32_MIN, S32_MAX));
+      }
+      assert(in_range(negative, 400, 600));
+      
+      // Chance and the precomputed sampler.
+      u32 hits = 0;
+      for(s32 i = 0; i < 100000; ++i) hits += chance(&rn, 4);
+      assert(in_range(hits, 23500, 26500));
+      
+      bounded_sampler b;
+      u32 seen[6] = {};
+      init_bounded_sampler(&b, 10, 15);
+      for(s32 i = 0; i < 60000; ++i) {
+            u32 x = next_bounded(&rn, &b);
+            assert(in_range(x, 10, 15));
+            seen[x - 10]++;
+      }
+      for(u32 i = 0; i < 6; ++i) assert(in_range(seen[i], 9400, 10600));
+      
+      // The full range has no rejection zone, each high bit should still be set half the time.
+      init_bounded_sampler(&b, 0, U32_MAX);
+      u32 high_bits[2] = {};
+      for(s32 i = 0; i < 100000; ++i) {
+            u32 x = next_bounded(&rn, &b);
+            high_bits[0] += x >> 31;
+            high_bits[1] += (x >> 30) & 1;
+      }
+      for(u32 i = 0; i < 2; ++i) assert(in_range(high_bits[i], 48500, 51500));
+}
+
+internal void test_rng_floats(void) {
+      rng rn = {};
+      seed(&rn, 5ull, RNG_PCG64);
+      
+      f64 sum = 0.0;
+      for(s32 i = 0; i < 100000; ++i) {
+            f32 a = unilateral_f32(&rn);
+            assert(a >= 0.0f && a < 1.0f);
+            assert(a * 8388608.0f == (f32)(s32)(a * 8388608.0f));
+            sum += a;
+            
+            f64 b = unilateral_f64(&rn);
+            assert(b >= 0.0 && b < 1.0);
+            
+            f32 c = bilateral_f32(&rn);
+            assert(c >= -1.0f && c < 1.0f);
+            
+            f32 d = unilateral_open_f32(&rn);
+            assert(d > 0.0f && d < 1.0f);
+            
+            f64 e = unilateral_open_f64(&rn);
+            assert(e > 0.0 && e < 1.0);
+            
+            assert(is_unilateral(unilateral_closed_f32(&rn)));
+            assert(is_unilateral(unilateral_closed_f64(&rn)));
+            
+            f32 f = next_f32(&rn);
+            assert(f == f && f >= -F32_MAX && f <= F32_MAX);
+            
+            f64 g = next_f64(&rn);
+            assert(g == g && g >= -F64_MAX && g <= F64_MAX);
+      }
+      
+      assert(in_range(sum / 100000.0, 0.49, 0.51));
+}
+
+internal void test_rng_distributions(void) {
+      local_persist f32 values[100000];
+      local_persist u32 counts[100000];
+      rng rn = {};
+      seed(&rn, 17ull, RNG_XOSHIRO256PP);
+      
+      // Sample mean and variance against the analytic ones, bounds are several standard errors wide.
+      f64 mean = 0.0, variance = 0.0;
+      fill_normal_f32(&rn, values, countof(values), 3.0f, 2.0f);
+      for(u32 i = 0; i < countof(values); ++i) mean += values[i];
+      mean /= countof(values);
+      for(u32 i = 0; i < countof(values); ++i) variance += (values[i] - mean) * (values[i] - mean);
+      variance /= countof(values);
+      assert(in_range(mean, 2.98, 3.02));
+      assert(in_range(variance, 3.92, 4.08));
+      
+      mean = 0.0;
+      fill_exponential_f32(&rn, values, countof(values), 4.0f);
+      for(u32 i = 0; i < countof(values); ++i) {
+            assert(values[i] >= 0.0f);
+            mean += values[i];
+      }
+      assert(in_range(mean / countof(values), 0.247, 0.253));
+      
+      f64 poisson_means[3] = {0.5, 6.0, 250.0};
+      for(u32 m = 0; m < countof(poisson_means); ++m) {
+            mean = 0.0;
+            fill_poisson_u32(&rn, counts, countof(counts), poisson_means[m]);
+            for(u32 i = 0; i < countof(counts); ++i) mean += counts[i];
+            mean /= countof(counts);
+            assert(in_range(mean, poisson_means[m] * 0.98, poisson_means[m] * 1.02));
+      }
+      
+      f32 shapes[3] = {0.4f, 1.0f, 7.5f};
+      for(u32 k = 0; k < countof(shapes); ++k) {
+            mean = 0.0;
+            fill_gamma_f32(&rn, values, countof(values), shapes[k], 2.0f);
+            for(u32 i = 0; i < countof(values); ++i) {
+                  assert(values[i] >= 0.0f);
+                  mean += values[i];
+            }
+            assert(in_range(mean / countof(values), shapes[k] * 2.0 * 0.98, shapes[k] * 2.0 * 1.02));
+      }
+      
+      mean = 0.0;
+      fill_beta_f32(&rn, values, countof(values), 2.0f, 5.0f);
+      for(u32 i = 0; i < countof(values); ++i) {
+            assert(is_unilateral(values[i]));
+            mean += values[i];
+      }
+      assert(in_range(mean / countof(values), 2.0 / 7.0 - 0.003, 2.0 / 7.0 + 0.003));
+      
+      // Single draws go through the same ziggurat.
+      f64 sum = 0.0;
+      for(s32 i = 0; i < 100000; ++i) {
+            sum += normal_f64(&rn) + exponential_f64(&rn) + poisson_u32(&rn, 20.0) + gamma_f64(&rn, 3.0) + beta_f64(&rn, 1.0, 1.0);
+      }
+      assert(in_range(sum / 100000.0, 24.4, 24.6));
+}
+
+internal void test_rng_counter(void) {
+      // Known answers from the Random123 reference (counter words are low to high: counter, then stream).
+      philox_block a = philox(0, 0, 0);
+      assert(a.x[0] == 0x6627E8D5 && a.x[1] == 0xE169C58D && a.x[2] == 0xBC57AC4C && a.x[3] == 0x9B00DBD8);
+      philox_block b = philox(U64_MAX, U64_MAX, U64_MAX);
+      assert(b.x[0] == 0x408F276D && b.x[1] == 0x41C83B0E && b.x[2] == 0xA20BC7C6 && b.x[3] == 0x6D5451FD);
+      philox_block c = philox(0x299F31D0A4093822ull, 0x85A308D3243F6A88ull, 0x0370734413198A2Eull);
+      assert(c.x[0] == 0xD16CFE09 && c.x[1] == 0x94FDCCEB && c.x[2] == 0x5001E420 && c.x[3] == 0x24126EA1);
+      
+      // Bulk output is word addressable, any split gives the same values.
+      local_persist u32 whole[1003];
+      local_persist u32 parts[1003];
+      u64 key = 0xC0FFEEull;
+      fill_philox_u32(key, 5, 0, whole, countof(whole));
+      for(u32 at = 0, step = 1; at < countof(parts); at += step, step = (step * 7) % 61 + 1) {
+            fill_philox_u32(key, 5, at, parts + at, min(step, (u32)countof(parts) - at));
+      }
+      for(u32 i = 0; i < countof(whole); ++i) assert(whole[i] == parts[i]);
+      
+      // The rng adapter hands out the same words, and seeking lands on the same block.
+      rng rn = {};
+      seed(&rn, key, RNG_PHILOX);
+      seek(&rn, 5);
+      for(u32 i = 0; i < 64; ++i) assert(next_u32(&rn) == whole[i]);
+      seek(&rn, 5, 100);
+      assert(next_u32(&rn) == whole[400]);
+      assert(next_u64(&rn) == pack_u64_x2(whole[401], whole[402]));
+      
+      local_persist f32 floats[1003];
+      fill_philox_f32_unit(key, 5, 0, floats, countof(floats));
+      for(u32 i = 0; i < countof(floats); ++i) {
+            assert(floats[i] == (f32)(whole[i] >> 9) / 8388608.0f);
+      }
+      
+      // Helpers and jumps work on top of it.
+      seed(&rn, key, RNG_PHILOX);
+      for(s32 i = 0; i < 10000; ++i) {
+            assert(in_range(range_u32(&rn, 3, 9), 3, 9));
+            assert(is_unilateral(unilateral_f32(&rn)));
+      }
+      rng other = rn;
+      jump(&other);
+      assert(next_u64(&other) != next_u64(&rn));
+}
+
+internal void test_rng_sampling(void) {
+      rng rn = {};
+      seed(&rn, 23ull, RNG_XOSHIRO256PP);
+      
+      // All six orders of three items come up equally often.
+      u32 orders[27] = {};
+      for(s32 i = 0; i < 60000; ++i) {
+            u32 items[3] = {0, 1, 2};
+            shuffle(&rn, items, 3, sizeof(u32));
+            orders[items[0] * 9 + items[1] * 3 + items[2]]++;
+      }
+      u32 distinct = 0;
+      for(u32 i = 0; i < countof(orders); ++i) {
+            if(orders[i]) {
+                  assert(in_range(orders[i], 9500, 10500));
+                  distinct++;
+            }
+      }
+      assert(distinct == 6);
+      
+      // Pairs of f32 on 4 byte alignment are swapped whole.
+      alignas(8) u8 raw[64 * sizeof(v2) + 4];
+      v2* points = (v2*)(raw + 4);
+      for(u32 i = 0; i < 64; ++i) points[i] = {(f32)i, (f32)i + 100.0f};
+      shuffle(&rn, points, 64, sizeof(v2));
+      u32 seen[64] = {};
+      for(u32 i = 0; i < 64; ++i) {
+            assert(points[i].y == points[i].x + 100.0f);
+            seen[(u32)points[i].x]++;
+      }
+      for(u32 i = 0; i < 64; ++i) assert(seen[i] == 1);
+      
+      // The blocked shuffle (many buckets here) is still a permutation and moves items anywhere.
+      local_persist u64 items[300000];
+      local_persist u64 temp[300000];
+      u32 count = countof(items);
+      for(u32 i = 0; i < count; ++i) items[i] = i;
+      shuffle_blocked(&rn, items, count, sizeof(u64), temp);
+      u64 sum = 0, displaced = 0;
+      for(u32 i = 0; i < count; ++i) {
+            sum += items[i];
+            displaced += (items[i] < count / 2) != (i < count / 2);
+            temp[i] = 0;
+      }
+      for(u32 i = 0; i < count; ++i) temp[items[i]]++;
+      for(u32 i = 0; i < count; ++i) assert(temp[i] == 1);
+      assert(sum == (u64)count * (count - 1) / 2);
+      assert(in_range(displaced, count / 2 - 2000, count / 2 + 2000));
+      
+      // Every stream item has the same chance of ending up in the reservoir.
+      u32 kept[200] = {};
+      for(s32 trial = 0; trial < 5000; ++trial) {
+            u32 storage[10];
+            reservoir r;
+            init_reservoir(&r, storage, countof(storage), sizeof(u32));
+            for(u32 i = 0; i < countof(kept); ++i) push_reservoir(&r, &rn, &i);
+            assert(r.count == countof(storage));
+            for(u32 i = 0; i < r.count; ++i) kept[storage[i]]++;
+      }
+      for(u32 i = 0; i < countof(kept); ++i) assert(in_range(kept[i], 170, 330));
+      
+      // Alias picks follow the weights, zero weights never come up.
+      f32 weights[5] = {1.0f, 0.0f, 3.0f, 0.5f, 5.5f};
+      alias_entry entries[5];
+      u8 scratch[5 * (sizeof(f64) + sizeof(u32))];
+      assert(get_alias_table_size(5) == sizeof(entries) && get_alias_scratch_size(5) == sizeof(scratch));
+      alias_table table;
+      build_alias_table(&table, weights, 5, entries, scratch);
+      u32 picks[5] = {};
+      for(s32 i = 0; i < 100000; ++i) picks[next_alias(&rn, &table)]++;
+      assert(picks[1] == 0);
+      for(u32 i = 0; i < 5; ++i) assert(in_range(picks[i], weights[i] * 10000 * 0.95, weights[i] * 10000 * 1.05));
+}
+
+internal void test_rng_geometry(void) {
+      rng rn = {};
+      seed(&rn, 29ull, RNG_XOSHIRO256PP);
+      local_persist v2 points[20000];
+      local_persist v3 spatial[20000];
+      local_persist quat rotations[20000];
+      u32 count = countof(points);
+      
+      // Uniform in a rectangle and in a disk, a quarter of the disk lies within half its radius.
+      r2 bounds = mk_r2({-3.0f, 1.0f}, {5.0f, 2.0f});
+      fill_in_r2(&rn, points, count, bounds);
+      for(u32 i = 0; i < count; ++i) assert(in_range(points[i].x, -3.0f, 5.0f) && in_range(points[i].y, 1.0f, 2.0f));
+      fill_in_disk(&rn, points, count, {1.0f, 2.0f}, 4.0f);
+      u32 inner = 0;
+      for(u32 i = 0; i < count; ++i) {
+            f32 d = lensq(points[i] - v2{1.0f, 2.0f});
+            assert(d < 16.0f);
+            inner += d < 4.0f;
+      }
+      assert(in_range(inner, count / 4 - 400, count / 4 + 400));
+      
+      // On the sphere the points have unit length and average out to the origin, in the ball an eighth lies within half the radius.
+      fill_on_sphere(&rn, spatial, count);
+      v3 mean = {};
+      for(u32 i = 0; i < count; ++i) {
+            assert(in_range(lensq(spatial[i]), 0.998f, 1.002f));
+            mean = mean + spatial[i];
+      }
+      mean = mean / (f32)count;
+      assert(lensq(mean) < 0.001f);
+      fill_in_sphere(&rn, spatial, count);
+      inner = 0;
+      for(u32 i = 0; i < count; ++i) {
+            assert(lensq(spatial[i]) < 1.0f);
+            inner += lensq(spatial[i]) < 0.25f;
+      }
+      assert(in_range(inner, count / 8 - 300, count / 8 + 300));
+      
+      // Rotations are unit quaternions and spread the x axis evenly over the sphere.
+      fill_rotations(&rn, rotations, count);
+      mean = {};
+      for(u32 i = 0; i < count; ++i) {
+            assert(in_range(lensq(rotations[i]), 0.998f, 1.002f));
+            mean = mean + rotate(v3{1.0f, 0.0f, 0.0f}, rotations[i]);
+      }
+      mean = mean / (f32)count;
+      assert(lensq(mean) < 0.001f);
+      
+      // Poisson-disk points keep their distance and fill the rectangle.
+      local_persist u8 scratch[64 * 1024];
+      assert(get_poisson_disk_scratch_size(bounds, 0.1f, 2000) <= sizeof(scratch));
+      u32 written = poisson_disk(&rn, bounds, 0.1f, points, 2000, scratch);
+      assert(in_range(written, 400, 2000));
+      for(u32 i = 0; i < written; ++i) {
+            assert(in_range(points[i].x, -3.0f, 5.0f) && in_range(points[i].y, 1.0f, 2.0f));
+            for(u32 j = 0; j < i; ++j) assert(lensq(points[i] - points[j]) >= 0.01f * 0.999f);
+      }
+      assert(poisson_disk(&rn, bounds, 0.1f, points, 50, scratch) == 50);
+}
+
+internal void test_rng_streams(void) {
+      // Reference outputs for seed 42: three draws, one after jump, one after a following long jump.
+      u32 kinds[3] = {RNG_XOSHIRO256PP, RNG_XOSHIRO256SS, RNG_PCG64};
+      u64 expected[3][5] = {
+            {0xD0764D4F4476689Full, 0x519E4174576F3791ull, 0xFBE07CFB0C24ED8Cull, 0xDD4B9019A605434Dull, 0xC1054E7284F7A902ull},
+            {0x15780B2E0C2EC716ull, 0x6104D9866D113A7Eull, 0xAE17533239E499A1ull, 0x03A5C66424702131ull, 0x2E5771502F9237A9ull},
+            {0xDE593E2F1E214CB2ull, 0x9A503048546CEE48ull, 0x97B8011AE48A98A1ull, 0x390C9BF6A55BD88Bull, 0x16BE4AC203D67520ull},
+      };
+      
+      for(u32 k = 0; k < countof(kinds); ++k) {
+            rng rn = {};
+            seed(&rn, 42ull, kinds[k]);
+            for(u32 i = 0; i < 3; ++i) assert(next_u64(&rn) == expected[k][i]);
+            jump(&rn);
+            assert(next_u64(&rn) == expected[k][3]);
+            long_jump(&rn);
+            assert(next_u64(&rn) == expected[k][4]);
+            
+            // Clear restarts the sequence from the seed.
+            clear(&rn);
+            assert(next_u64(&rn) == expected[k][0]);
+            
+            // Substreams split off by jumping must not repeat the parent's values.
+            rng streams[4] = {};
+            for(u32 i = 0; i < countof(streams); ++i) {
+                  streams[i] = rn;
+                  jump(&rn);
+            }
+            
+            u64 first[countof(streams)] = {};
+            for(u32 i = 0; i < countof(streams); ++i) {
+                  first[i] = next_u64(&streams[i]);
+                  for(u32 j = 0; j < i; ++j) assert(first[i] != first[j]);
+            }
+            
+            for(s32 i = 0; i < 10000; ++i) {
+                  s64 w = range_s64(&streams[0], -40, 10);
+                  assert(in_range(w, -40, 10));
+                  f32 a = unilateral_f32(&streams[1]);
+                  assert(is_unilateral(a));
+            }
+      }
+}
+
+internal void test_rng_fill(void) {
+      local_persist u32 values[4099];
+      local_persist f32 floats[4099];
+      local_persist f64 doubles[2049];
+      
+      // Same seed, same sequence on every instruction set (tails that are not a multiple of the lane block included).
+      rng rn = {};
+      seed(&rn, 7ull, RNG_XOSHIRO256PP);
+      fill_u32(&rn, values, countof(values));
+      u64 hash = 0;
+      for(u32 i = 0; i < countof(values); ++i) hash = (hash ^ values[i]) * 0x100000001B3ull;
+      assert(hash == 0xC2CC6375D5B37A95ull);
+      
+      // Floats take their mantissa from the top 23 bits of the same values, doubles from a whole lane.
+      seed(&rn, 7ull, RNG_XOSHIRO256PP);
+      fill_f32_unit(&rn, floats, countof(floats));
+      for(u32 i = 0; i < countof(floats); ++i) {
+            assert(floats[i] >= 0.0f && floats[i] < 1.0f);
+            assert(floats[i] == (f32)(values[i] >> 9) / 8388608.0f);
+      }
+      
+      seed(&rn, 7ull, RNG_XOSHIRO256PP);
+      fill_f64_unit(&rn, doubles, countof(doubles));
+      for(u32 i = 0; i < countof(doubles); ++i) {
+            assert(doubles[i] >= 0.0 && doubles[i] < 1.0);
+            assert(doubles[i] == (f64)(pack_u64_x2(values[i * 2], values[i * 2 + 1]) >> 12) / 4503599627370496.0);
+      }
+      
+      // Every value of a small range shows up, nothing outside it.
+      u32 seen[13] = {};
+      fill_range_u32(&rn, values, countof(values), 100, 112);
+      for(u32 i = 0; i < countof(values); ++i) {
+            assert(in_range(values[i], 100, 112));
+            seen[values[i] - 100]++;
+      }
+      for(u32 i = 0; i < countof(seen); ++i) assert(seen[i] > 0);
+      
+      // A span just above 2^31 rejects about half the draws, the redraws still land in range.
+      fill_range_u32(&rn, values, countof(values), 0, 0x80000000);
+      for(u32 i = 0; i < countof(values); ++i) assert(values[i] <= 0x80000000);
+      fill_range_u32(&rn, values, countof(values), 0, U32_MAX);
+}
+
+internal u64 sort_checksum(sort_entry* entries, u32 count) {
+      u64 sum = 0;
+      for(u32 i = 0; i < count; ++i) sum += pack_u64_x2(entries[i].value, entries[i].key) * 2654435761u;
+      return sum;
+}
+
+struct test_atomics_shared {
+      volatile u64 counter;
+      volatile u32 bits;
+      volatile atomic_pair pair;
+      volatile u32 legacy;
+};
+
+// Compile time, the whole bit layer must fold into constants.
+cassert(rotate_left(0x80000001u, 1u) == 0x00000003u);
+cassert(rotate_right((u64)1, (u64)65) == 0x8000000000000000ull);
+cassert(eswap((u32)0x11223344) == 0x44332211);
+cassert(eswap((u16)0x1122) == 0x2211);
+cassert(count_trailing_zeros(0u) == 32 && count_leading_zeros((u64)0) == 64);
+cassert(count_set_bits((u64)0xF0F0F0F0F0F0F0F0) == 32);
+cassert(most_significant_bit(0x00010000u) == 16 && least_significant_bit((u64)0) == U8_MAX);
+cassert(reverse_bits(1u) == 0x80000000u);
+cassert(deposit_bits(0x5u, 0xF0u) == 0x50u && extract_bits((u64)0xABCD, (u64)0xFF00) == 0xAB);
+
+// Bit at a time references.
+internal u64 test_bits_reverse(u64 x, u32 width) {
+      u64 result = 0;
+      for(u32 i = 0; i < width; ++i) result |= ((x >> i) & 1) << (width - 1 - i);
+      return result;
+}
+
+internal u64 test_bits_deposit(u64 x, u64 mask) {
+      u64 result = 0;
+      for(u32 i = 0, j = 0; i < 64; ++i) {
+            if((mask >> i) & 1) result |= ((x >> j++) & 1) << i;
+      }
+      return result;
+}
+
+internal u64 test_bits_extract(u64 x, u64 mask) {
+      u64 result = 0;
+      for(u32 i = 0, j = 0; i < 64; ++i) {
+            if((mask >> i) & 1) result |= ((x >> i) & 1) << j++;
+      }
+      return result;
+}
+
+internal void test_bits(void) {
+      rng rn = {};
+      seed(&rn, 2468);
+      
+      // Single bits, edges and sparse or dense random words.
+      local_persist u64 values[256 + 64];
+      u32 count = 0;
+      values[count++] = 0;
+      values[count++] = U64_MAX;
+      for(u32 i = 0; i < 64; ++i) values[count++] = 1ull << i;
+      while(count < countof(values)) {
+            u64 x = next_u64(&rn);
+            if(count % 3 == 1) x &= next_u64(&rn) & next_u64(&rn);
+            if(count % 3 == 2) x |= next_u64(&rn) | next_u64(&rn);
+            values[count++] = x;
+      }
+      
+      for(u32 v = 0; v < count; ++v) {
+            u64 x = values[v];
+            u32 x32 = (u32)x;
+            u32 ones = 0, trailing = 0, leading = 0, trailing32 = 0, leading32 = 0, ones32 = 0;
+            for(u32 i = 0; i < 64; ++i) ones += (x >> i) & 1;
+            for(u32 i = 0; i < 32; ++i) ones32 += (x32 >> i) & 1;
+            while((trailing < 64) && !((x >> trailing) & 1)) ++trailing;
+            while((leading < 64) && !((x >> (63 - leading)) & 1)) ++leading;
+            while((trailing32 < 32) && !((x32 >> trailing32) & 1)) ++trailing32;
+            while((leading32 < 32) && !((x32 >> (31 - leading32)) & 1)) ++leading32;
+            
+            assert(count_set_bits(x) == ones && count_set_bits(x32) == ones32);
+            assert(count_trailing_zeros(x) == trailing && count_trailing_zeros(x32) == trailing32);
+            assert(count_leading_zeros(x) == leading && count_leading_zeros(x32) == leading32);
+            assert(least_significant_bit(x) == (x ? trailing : U8_MAX) && most_significant_bit(x) == (x ? 63 - leading : U8_MAX));
+            assert(least_significant_bit(x32) == (x32 ? trailing32 : U8_MAX) && most_significant_bit(x32) == (x32 ? 31 - leading32 : U8_MAX));
+            assert(reverse_bits(x) == test_bits_reverse(x, 64) && reverse_bits(x32) == test_bits_reverse(x32, 32));
+            
+            u64 swapped = 0;
+            for(u32 i = 0; i < 8; ++i) swapped |= ((x >> (i * 8)) & 0xFF) << (56 - i * 8);
+            assert(eswap(x) == swapped && eswap((s64)x) == (s64)swapped);
+            assert(eswap(x32) == (u32)(swapped >> 32) && eswap((u16)x) == (u16)(swapped >> 48));
+            
+            for(u32 shift = 0; shift < 70; shift += 7) {
+                  u32 wide = shift % 64, narrow = shift % 32;
+                  u64 left = wide ? ((x << wide) | (x >> (64 - wide))) : x;
+                  u32 left32 = narrow ? ((x32 << narrow) | (x32 >> (32 - narrow))) : x32;
+                  assert(rotate_left(x, (u64)shift) == left && rotate_right(left, (u64)shift) == x);
+                  assert(rotate_left(x32, shift) == left32 && rotate_right(left32, shift) == x32);
+            }
+            
+            u64 mask = values[(v * 7 + 3) % count];
+            assert(deposit_bits(x, mask) == test_bits_deposit(x, mask) && extract_bits(x, mask) == test_bits_extract(x, mask));
+            assert(deposit_bits(x32, (u32)mask) == test_bits_deposit(x32, (u32)mask));
+            assert(extract_bits(x32, (u32)mask) == test_bits_extract(x32, (u32)mask));
+            assert(extract_bits(deposit_bits(x, mask), mask) == (x & ((ones = count_set_bits(mask)) == 64 ? U64_MAX : (1ull << ones) - 1)));
+      }
+}
+
+internal void test_endian(void) {
+      rng rn = {};
+      seed(&rn, 1357);
+      
+      // Every length up to a few vectors covers the tails, odd offsets cover unaligned starts.
+      local_persist u64 source[1024 + 1];
+      local_persist u64 copied[1024 + 1];
+      local_persist u64 swapped[1024 + 1];
+      for(u32 i = 0; i < countof(source); ++i) source[i] = next_u64(&rn);
+      u32 counts[] = {0, 1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 1024};
+      for(u32 c = 0; c < countof(counts); ++c) {
+            u32 count = counts[c];
+            for(u32 offset = 0; offset < 2; ++offset) {
+                  u16* s16 = (u16*)((u8*)source + offset * 2);
+                  u32* s32 = (u32*)((u8*)source + offset * 4);
+                  u64* s64 = (u64*)((u8*)source + offset * 8);
+                  
+                  copy(copied, source, sizeof(source));
+                  eswap_copy16((u16*)swapped, s16, count);
+                  eswap_array16((u16*)((u8*)copied + offset * 2), count);
+                  for(u32 i = 0; i < count; ++i) assert(((u16*)swapped)[i] == eswap(s16[i]) && ((u16*)((u8*)copied + offset * 2))[i] == eswap(s16[i]));
+                  
+                  copy(copied, source, sizeof(source));
+                  eswap_copy32((u32*)swapped, s32, count);
+                  eswap_array32((u32*)((u8*)copied + offset * 4), count);
+                  for(u32 i = 0; i < count; ++i) assert(((u32*)swapped)[i] == eswap(s32[i]) && ((u32*)((u8*)copied + offset * 4))[i] == eswap(s32[i]));
+                  
+                  u32 count64 = min(count, 1023u);
+                  copy(copied, source, sizeof(source));
+                  eswap_copy64(swapped, s64, count64);
+                  eswap_array64(copied + offset, count64);
+                  for(u32 i = 0; i < count64; ++i) assert(swapped[i] == eswap(s64[i]) && copied[offset + i] == eswap(s64[i]));
+                  
+                  // Nothing past the end is touched.
+                  assert(copied[offset + count64] == source[offset + count64]);
+            }
+      }
+      
+      // Byte order loads and stores at every misalignment.
+      u8 bytes[] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0xDC, 0xFE};
+      for(u32 at = 0; at < 8; ++at) {
+            u64 be = 0, le = 0;
+            for(u32 i = 0; i < 8; ++i) {
+                  be = (be << 8) | bytes[at + i];
+                  le |= (u64)bytes[at + i] << (i * 8);
+            }
+            assert(load_be<u64>(bytes + at) == be && load_le<u64>(bytes + at) == le);
+            assert(load_be<u32>(bytes + at) == (u32)(be >> 32) && load_le<u32>(bytes + at) == (u32)le);
+            assert(load_be<u16>(bytes + at) == (u16)(be >> 48) && load_le<u16>(bytes + at) == (u16)le);
+            assert(load_be<s32>(bytes + at) == (s32)(be >> 32));
+            
+            u8 out[16] = {};
+            store_be<u64>(out + at, be);
+            assert(compare(out + at, bytes + at, 8));
+            store_le<u32>(out + at, (u32)le);
+            assert(compare(out + at, bytes + at, 4));
+            store_be<s16>(out + at + 1, (s16)(be >> 40));
+            assert(compare(out + at + 1, bytes + at + 1, 2));
+      }
+}
+
+internal void test_atomics_proc(void* param) {
+      test_atomics_shared* shared = (test_atomics_shared*)param;
+      for(u32 i = 0; i < 100000; ++i) {
+            atomic_fetch_add(&shared->counter, 1, MEMORY_RELAXED);
+            int_increment(&shared->legacy);
+            
+            // Both halves move together, so they never drift apart.
+            atomic_pair expected = {shared->pair.lo, shared->pair.hi};
+            while(!atomic_compare_exchange(&shared->pair, &expected, {expected.lo + 1, expected.hi + 2}));
+      }
+      atomic_fetch_or(&shared->bits, 1u, MEMORY_RELEASE);
+}
+
+internal void test_atomics(void) {
+      // Single threaded results.
+      volatile u32 a = 5;
+      volatile u64 b = 7;
+      void* volatile p = 0;
+      assert(atomic_load(&a) == 5 && atomic_load(&b, MEMORY_RELAXED) == 7);
+      atomic_store(&a, 9, MEMORY_RELEASE);
+      assert(atomic_exchange(&a, 3u) == 9 && a == 3);
+      assert(atomic_fetch_add(&b, 10ull) == 7 && b == 17);
+      assert(atomic_fetch_or(&a, 12u) == 3 && a == 15);
+      assert(atomic_fetch_and(&b, 6ull, MEMORY_ACQ_REL) == 17 && b == 0);
+      u32 expected = 4;
+      assert(!atomic_compare_exchange(&a, &expected, 1u) && expected == 15);
+      assert(atomic_compare_exchange(&a, &expected, 1u, MEMORY_ACQUIRE) && a == 1);
+      while(!atomic_compare_exchange_weak(&a, &expected, 2u, MEMORY_RELAXED));
+      assert(a == 2 && expected == 1);
+      void* object = (void*)&a;
+      void* nothing = 0;
+      assert(atomic_compare_exchange(&p, &nothing, object) && atomic_load(&p) == object);
+      assert(atomic_exchange(&p, (void*)0) == object && !p);
+      
+      // The interlocked operations return the previous value on every compiler.
+      volatile s16 c = -2;
+      volatile u64 d = 10;
+      assert(int_increment(&c) == -2 && c == -1);
+      assert(int_decrement(&d) == 10 && d == 9);
+      assert(int_compare_exchange(&d, 9ull, 4ull) == 9 && d == 4);
+      assert(int_compare_exchange(&d, 9ull, 5ull) == 4 && d == 4);
+      assert(int_exchange(&c, (s16)8) == -1 && c == 8);
+      
+      // Contended updates from several threads are not lost.
+      local_persist test_atomics_shared shared;
+      thread threads[4];
+      for(u32 i = 0; i < countof(threads); ++i) assert(start_thread(&threads[i], test_atomics_proc, &shared));
+      for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+      assert(shared.counter == 400000 && shared.legacy == 400000);
+      assert(shared.pair.lo == 400000 && shared.pair.hi == 800000);
+      assert(shared.bits == 1);
+}
+
+#define TEST_SPSC_COUNT 1000000
+
+internal void test_spsc_producer(void* param) {
+      spsc_ring* r = (spsc_ring*)param;
+      u64 next = 0;
+      while(next < TEST_SPSC_COUNT) {
+            // Alternate between single pushes and batches so both paths race against the consumer.
+            if(next & 1024) {
+                  if(push_spsc_ring(r, &next)) next++;
+                  else yield_thread();
+                  continue;
+            }
+            
+            u64* items;
+            u32 count = reserve_spsc_write(r, (u32)min((u64)100, TEST_SPSC_COUNT - next), (void**)&items);
+            for(u32 i = 0; i < count; ++i) items[i] = next++;
+            commit_spsc_write(r, count);
+            if(!count) yield_thread();
+      }
+}
+
+internal void test_spsc_ring(void) {
+      local_persist u64 storage[64];
+      spsc_ring r;
+      assert(get_spsc_ring_size(64, sizeof(u64)) == sizeof(storage));
+      init_spsc_ring(&r, storage, 64, sizeof(u64));
+      
+      // Reservations stop at the wrap and when the ring is full.
+      u64 value = 0;
+      void* items;
+      for(u64 i = 0; i < 60; ++i) assert(push_spsc_ring(&r, &i));
+      for(u64 i = 0; i < 50; ++i) assert(pop_spsc_ring(&r, &value) && value == i);
+      assert(reserve_spsc_write(&r, 10, &items) == 4);
+      commit_spsc_write(&r, 4);
+      assert(reserve_spsc_write(&r, 100, &items) == 50 && items == storage);
+      commit_spsc_write(&r, 50);
+      assert(!push_spsc_ring(&r, &value));
+      assert(reserve_spsc_read(&r, 100, &items) == 14);
+      commit_spsc_read(&r, 14);
+      assert(reserve_spsc_read(&r, 100, &items) == 50);
+      commit_spsc_read(&r, 50);
+      assert(!pop_spsc_ring(&r, &value));
+      
+      // Everything arrives once and in order across threads.
+      thread producer;
+      assert(start_thread(&producer, test_spsc_producer, &r));
+      u64 expected = 0;
+      while(expected < TEST_SPSC_COUNT) {
+            u64* received;
+            u32 count = reserve_spsc_read(&r, 64, (void**)&received);
+            for(u32 i = 0; i < count; ++i) assert(received[i] == expected++);
+            commit_spsc_read(&r, count);
+            if(!count) yield_thread();
+      }
+      join_thread(&producer);
+      assert(!pop_spsc_ring(&r, &value));
+}
+
+#define TEST_MPMC_PER_THREAD 50000
+
+struct test_mpmc_shared {
+      mpmc_queue queue;
+      volatile u64 sum;
+      volatile u32 next_producer;
+};
+
+internal void test_mpmc_producer(void* param) {
+      test_mpmc_shared* shared = (test_mpmc_shared*)param;
+      u64 base = (u64)atomic_fetch_add(&shared->next_producer, 1) << 32;
+      for(u64 i = 0; i < TEST_MPMC_PER_THREAD; ++i) {
+            u64 item = base | i;
+            push_mpmc_queue(&shared->queue, &item);
+      }
+}
+
+internal void test_mpmc_consumer(void* param) {
+      test_mpmc_shared* shared = (test_mpmc_shared*)param;
+      u64 last[4] = {0, 0, 0, 0};
+      u64 sum = 0;
+      for(u32 i = 0; i < TEST_MPMC_PER_THREAD; ++i) {
+            u64 item;
+            pop_mpmc_queue(&shared->queue, &item);
+            
+            // Items from one producer keep their order for any single consumer.
+            u64 producer = item >> 32;
+            u64 index = (item & U32_MAX) + 1;
+            assert(index > last[producer]);
+            last[producer] = index;
+            sum += index;
+      }
+      atomic_fetch_add(&shared->sum, sum);
+}
+
+internal void test_mpmc_queue(void) {
+      local_persist u8 storage[8 * 16];
+      local_persist test_mpmc_shared shared;
+      assert(get_mpmc_queue_size(8, sizeof(u64)) == sizeof(storage));
+      init_mpmc_queue(&shared.queue, storage, 8, sizeof(u64));
+      
+      // The try forms report full and empty.
+      u64 value;
+      for(u64 i = 0; i < 8; ++i) assert(try_push_mpmc_queue(&shared.queue, &i));
+      assert(!try_push_mpmc_queue(&shared.queue, &value));
+      for(u64 i = 0; i < 8; ++i) assert(try_pop_mpmc_queue(&shared.queue, &value) && value == i);
+      assert(!try_pop_mpmc_queue(&shared.queue, &value));
+      
+      // Four producers and four consumers block on a tiny queue, nothing is lost or duplicated.
+      thread threads[8];
+      for(u32 i = 0; i < 4; ++i) assert(start_thread(&threads[i], test_mpmc_consumer, &shared));
+      for(u32 i = 4; i < 8; ++i) assert(start_thread(&threads[i], test_mpmc_producer, &shared));
+      for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+      assert(shared.sum == 4ull * TEST_MPMC_PER_THREAD * (TEST_MPMC_PER_THREAD + 1) / 2);
+      assert(!try_pop_mpmc_queue(&shared.queue, &value));
+}
+
+struct test_jobs_fib {
+      job_system* system;
+      u32 n;
+      u64 result;
+};
+
+// Every call waits on its own children, so waiting has to keep running other jobs.
+internal void test_jobs_fib_proc(void* param) {
+      test_jobs_fib* f = (test_jobs_fib*)param;
+      if(f->n < 2) {
+            f->result = f->n;
+            return;
+      }
+      
+      test_jobs_fib children[2] = {{f->system, f->n - 1, 0}, {f->system, f->n - 2, 0}};
+      volatile u32 counter = 0;
+      run_job(f->system, test_jobs_fib_proc, &children[0], &counter);
+      run_job(f->system, test_jobs_fib_proc, &children[1], &counter);
+      wait_counter(f->system, &counter);
+      f->result = children[0].result + children[1].result;
+}
+
+internal void test_jobs_add_proc(void* param) {
+      atomic_fetch_add((volatile u64*)param, 1ull, MEMORY_RELAXED);
+}
+
+internal void test_jobs(void) {
+      local_persist u8 storage[4 * 1024 * 1024];
+      job_system system;
+      assert(get_job_system_size(4) <= sizeof(storage));
+      assert(start_job_system(&system, storage, 4));
+      
+      // More jobs than a deque holds, the overflow runs inline.
+      volatile u64 sum = 0;
+      volatile u32 counter = 0;
+      for(u32 i = 0; i < 10000; ++i) run_job(&system, test_jobs_add_proc, (void*)&sum, &counter);
+      wait_counter(&system, &counter);
+      assert(sum == 10000 && counter == 0);
+      
+      test_jobs_fib fib = {&system, 20, 0};
+      run_job(&system, test_jobs_fib_proc, &fib, &counter);
+      wait_counter(&system, &counter);
+      assert(fib.result == 6765);
+      stop_job_system(&system);
+      
+      // Without a system to queue on, jobs run right away.
+      sum = 0;
+      run_job(&system, test_jobs_add_proc, (void*)&sum, &counter);
+      assert(sum == 1 && counter == 0);
+}
+
+#define TEST_PARALLEL_COUNT 100000
+
+internal void test_parallel_fill_proc(void* param, u64 begin, u64 end) {
+      f32* values = (f32*)param;
+      for(u64 i = begin; i < end; ++i) values[i] = 1.0f / (f32)(i + 1);
+}
+
+internal void test_parallel_sum_proc(void* param, u64 begin, u64 end, void* result) {
+      f32* values = (f32*)param;
+      f32 sum = 0.0f;
+      for(u64 i = begin; i < end; ++i) sum += values[i];
+      *(f32*)result = sum;
+}
+
+internal void test_parallel_add_proc(void*, void* result, void* left, void* right) {
+      *(f32*)result = *(f32*)left + *(f32*)right;
+}
+
+internal void test_parallel_prefix_proc(void* param, u64 begin, u64 end, void* prefix) {
+      f32* values = (f32*)param;
+      f32 sum = prefix ? *(f32*)prefix : 0.0f;
+      for(u64 i = begin; i < end; ++i) values[i] = sum += values[i];
+}
+
+// Sum and prefix sums of 1 / (i + 1), scan_last is the last prefix.
+internal void test_parallel_run(job_system* system, f32* sum, f32* scan_last) {
+      local_persist f32 values[TEST_PARALLEL_COUNT];
+      local_persist f32 partials[TEST_PARALLEL_COUNT / 100 + 1];
+      assert(get_parallel_block_count(0, TEST_PARALLEL_COUNT, 100) <= countof(partials));
+      parallel_for(system, 0, TEST_PARALLEL_COUNT, 64, test_parallel_fill_proc, values);
+      for(u32 i = 0; i < TEST_PARALLEL_COUNT; ++i) assert(values[i] == 1.0f / (f32)(i + 1));
+      parallel_reduce(system, 0, TEST_PARALLEL_COUNT, 100, test_parallel_sum_proc, test_parallel_add_proc, values, partials, sizeof(f32), sum);
+      parallel_scan(system, 0, TEST_PARALLEL_COUNT, 100, test_parallel_sum_proc, test_parallel_add_proc, test_parallel_prefix_proc, values, partials, sizeof(f32));
+      f64 exact = 0.0;
+      for(u32 i = 0; i < TEST_PARALLEL_COUNT; ++i) {
+            exact += 1.0 / (f64)(i + 1);
+            assert(in_range(values[i], exact - 1e-3, exact + 1e-3));
+      }
+      *scan_last = values[TEST_PARALLEL_COUNT - 1];
+}
+
+internal void test_parallel(void) {
+      local_persist u8 storage[4 * 1024 * 1024];
+      job_system system;
+      
+      // Four workers and one worker give bit identical float results.
+      f32 sums[2], scans[2];
+      for(u32 run = 0; run < 2; ++run) {
+            assert(start_job_system(&system, storage, run ? 1 : 4));
+            test_parallel_run(&system, &sums[run], &scans[run]);
+            stop_job_system(&system);
+      }
+      assert(sums[0] == sums[1] && scans[0] == scans[1]);
+      assert(in_range(sums[0], 12.08f, 12.10f) && in_range(scans[0], 12.07f, 12.11f));
+      
+      // Empty ranges do nothing.
+      f32 untouched = -1.0f;
+      parallel_reduce(&system, 5, 5, 10, test_parallel_sum_proc, test_parallel_add_proc, 0, 0, sizeof(f32), &untouched);
+      assert(untouched == -1.0f);
+}
+
+#define TEST_STACK_NODES 64
+
+struct test_stack_node {
+      stack_node link;
+      volatile u32 holders;
+};
+
+struct test_stack_shared {
+      tagged_stack pointers;
+      index_stack indices;
+      test_stack_node nodes[TEST_STACK_NODES];
+      volatile u32 index_holders[TEST_STACK_NODES];
+      volatile u32 failures;
+};
+
+// Pops and pushes back in a tight loop, a node handed out twice at the same time would show up in its holder count.
+internal void test_stacks_proc(void* param) {
+      test_stack_shared* shared = (test_stack_shared*)param;
+      for(u32 i = 0; i < 100000; ++i) {
+            test_stack_node* node = (test_stack_node*)pop_tagged_stack(&shared->pointers);
+            if(node) {
+                  if(atomic_fetch_add(&node->holders, 1)) atomic_fetch_add(&shared->failures, 1);
+                  atomic_fetch_add(&node->holders, U32_MAX);
+                  push_tagged_stack(&shared->pointers, &node->link);
+            }
+            
+            u32 index = pop_index_stack(&shared->indices);
+            if(index != U32_MAX) {
+                  if(atomic_fetch_add(&shared->index_holders[index], 1)) atomic_fetch_add(&shared->failures, 1);
+                  atomic_fetch_add(&shared->index_holders[index], U32_MAX);
+                  push_index_stack(&shared->indices, index);
+            }
+      }
+}
+
+internal void test_stacks(void) {
+      local_persist test_stack_shared shared;
+      local_persist u32 next[TEST_STACK_NODES];
+      init_index_stack(&shared.indices, next);
+      
+      // Last in, first out.
+      assert(!pop_tagged_stack(&shared.pointers) && (pop_index_stack(&shared.indices) == U32_MAX));
+      for(u32 i = 0; i < TEST_STACK_NODES; ++i) {
+            push_tagged_stack(&shared.pointers, &shared.nodes[i].link);
+            push_index_stack(&shared.indices, i);
+      }
+      assert(pop_tagged_stack(&shared.pointers) == &shared.nodes[TEST_STACK_NODES - 1].link);
+      assert(pop_index_stack(&shared.indices) == TEST_STACK_NODES - 1);
+      push_tagged_stack(&shared.pointers, &shared.nodes[TEST_STACK_NODES - 1].link);
+      push_index_stack(&shared.indices, TEST_STACK_NODES - 1);
+      
+      thread threads[4];
+      for(u32 i = 0; i < countof(threads); ++i) assert(start_thread(&threads[i], test_stacks_proc, &shared));
+      for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+      assert(shared.failures == 0);
+      
+      // Every node is still there exactly once.
+      u32 seen[TEST_STACK_NODES] = {};
+      u32 count = 0;
+      for(stack_node* node = pop_all_tagged_stack(&shared.pointers); node; node = node->next) {
+            seen[(test_stack_node*)node - shared.nodes]++;
+            count++;
+      }
+      for(u32 index = pop_all_index_stack(&shared.indices); index != U32_MAX; index = next[index]) {
+            seen[index]++;
+            count++;
+      }
+      for(u32 i = 0; i < TEST_STACK_NODES; ++i) assert(seen[i] == 2);
+      assert(count == 2 * TEST_STACK_NODES);
+      assert(!pop_all_tagged_stack(&shared.pointers) && (pop_all_index_stack(&shared.indices) == U32_MAX));
+}
+
+#define TEST_LOCK_ROUNDS 20000
+
+struct test_locks_shared {
+      spin_lock spin;
+      ticket_lock ticket;
+      mutex mtx;
+      rw_lock rw;
+      volatile u64 counters[3]; // Plain increments, only correct if the locks exclude each other.
+      volatile u64 pair[2];     // Written together under the write lock, always equal to readers.
+      volatile u32 failures;
+};
+
+internal void test_locks_proc(void* param) {
+      test_locks_shared* shared = (test_locks_shared*)param;
+      for(u32 i = 0; i < TEST_LOCK_ROUNDS; ++i) {
+            lock(&shared->spin);
+            shared->counters[0] = shared->counters[0] + 1;
+            unlock(&shared->spin);
+            
+            lock(&shared->ticket);
+            shared->counters[1] = shared->counters[1] + 1;
+            unlock(&shared->ticket);
+            
+            lock(&shared->mtx);
+            shared->counters[2] = shared->counters[2] + 1;
+            unlock(&shared->mtx);
+            
+            if(i % 8) {
+                  lock_read(&shared->rw);
+                  if(shared->pair[0] != shared->pair[1]) atomic_fetch_add(&shared->failures, 1);
+                  unlock_read(&shared->rw);
+            } else {
+                  lock_write(&shared->rw);
+                  shared->pair[0] = shared->pair[0] + 1;
+                  shared->pair[1] = shared->pair[1] + 1;
+                  unlock_write(&shared->rw);
+            }
+      }
+}
+
+internal void test_locks(void) {
+      local_persist test_locks_shared shared;
+      local_persist lock_stats stats[4];
+      shared.spin.stats = &stats[0];
+      shared.ticket.stats = &stats[1];
+      shared.mtx.stats = &stats[2];
+      shared.rw.stats = &stats[3];
+      
+      // Try fails while held.
+      assert(try_lock(&shared.spin) && !try_lock(&shared.spin));
+      assert(try_lock(&shared.ticket) && !try_lock(&shared.ticket));
+      assert(try_lock(&shared.mtx) && !try_lock(&shared.mtx));
+      unlock(&shared.spin);
+      unlock(&shared.ticket);
+      unlock(&shared.mtx);
+      
+      thread threads[4];
+      for(u32 i = 0; i < countof(threads); ++i) assert(start_thread(&threads[i], test_locks_proc, &shared));
+      for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+      u64 total = countof(threads) * TEST_LOCK_ROUNDS;
+      for(u32 i = 0; i < 3; ++i) assert(shared.counters[i] == total);
+      assert((shared.pair[0] == total / 8) && (shared.pair[1] == total / 8) && !shared.failures);
+      
+      // Every acquire is counted, only contended ones carry wait time.
+      for(u32 i = 0; i < 3; ++i) assert(stats[i].acquires == total + 1);
+      assert(stats[3].acquires == total);
+      for(u32 i = 0; i < 4; ++i) assert(stats[i].contended <= stats[i].acquires && (stats[i].wait_cycles || !stats[i].contended));
+}
+
+#define TEST_RECLAIM_NODES  1024
+#define TEST_RECLAIM_ROUNDS 20000
+
+struct test_reclaim_node {
+      stack_node link;
+      volatile u32 freed;
+};
+
+struct test_reclaim_shared {
+      test_reclaim_node nodes[TEST_RECLAIM_NODES];
+      tagged_stack pool;
+      u32 reclaimed;
+      epoch_domain epochs;
+      hazard_domain hazards;
+      b8x use_hazards;
+      void* volatile current;
+      volatile u32 next;
+      volatile u32 failures;
+};
+
+internal void test_reclaim_proc(void* param, stack_node* nodes) {
+      test_reclaim_shared* shared = (test_reclaim_shared*)param;
+      while(nodes) {
+            stack_node* next = nodes->next;
+            test_reclaim_node* node = (test_reclaim_node*)nodes;
+            assert(!node->freed);
+            node->freed = 1;
+            atomic_fetch_add(&shared->reclaimed, 1u);
+            push_tagged_stack(&shared->pool, nodes);
+            nodes = next;
+      }
+}
+
+internal test_reclaim_node* test_reclaim_take(test_reclaim_shared* shared) {
+      test_reclaim_node* node = (test_reclaim_node*)pop_tagged_stack(&shared->pool);
+      assert(node && node->freed);
+      node->freed = 0;
+      return node;
+}
+
+internal void test_reclaim_thread_proc(void* param) {
+      // Half the threads swap the current node out and retire it, the others read it and check it was not handed back under them.
+      test_reclaim_shared* shared = (test_reclaim_shared*)param;
+      b8x writer = atomic_fetch_add(&shared->next, 1u) & 1;
+      epoch_thread* et = shared->use_hazards ? 0 : join_epoch_domain(&shared->epochs);
+      hazard_thread* ht = shared->use_hazards ? join_hazard_domain(&shared->hazards) : 0;
+      assert(et || ht);
+      for(u32 i = 0; i < TEST_RECLAIM_ROUNDS; ++i) {
+            if(writer) {
+                  test_reclaim_node* node = (test_reclaim_node*)pop_tagged_stack(&shared->pool);
+                  if(!node) {
+                        yield_thread(); // Everything is in flight or waiting in limbo.
+                        continue;
+                  }
+                  node->freed = 0;
+                  stack_node* old = (stack_node*)atomic_exchange(&shared->current, node);
+                  if(ht) retire_hazard(ht, old);
+                  else retire_epoch(et, old);
+            } else if(ht) {
+                  test_reclaim_node* node = (test_reclaim_node*)protect_hazard(ht, 0, &shared->current);
+                  if(node->freed) atomic_fetch_add(&shared->failures, 1u);
+                  clear_hazard(ht, 0);
+            } else {
+                  enter_epoch(et);
+                  test_reclaim_node* node = (test_reclaim_node*)atomic_load(&shared->current, MEMORY_ACQUIRE);
+                  if(node->freed) atomic_fetch_add(&shared->failures, 1u);
+                  exit_epoch(et);
+            }
+      }
+      if(ht) leave_hazard_domain(ht);
+      else leave_epoch_domain(et);
+}
+
+internal void test_reclaim_reset(test_reclaim_shared* shared) {
+      zero_obj(&shared->pool);
+      for(u32 i = 0; i < TEST_RECLAIM_NODES; ++i) {
+            shared->nodes[i].freed = 1;
+            push_tagged_stack(&shared->pool, &shared->nodes[i].link);
+      }
+      shared->reclaimed = 0;
+      shared->current = test_reclaim_take(shared);
+}
+
+internal void test_reclaim(void) {
+      local_persist test_reclaim_shared shared;
+      alignas(CACHE_LINE) local_persist u8 storage[64 * 1024];
+      
+      // A reader inside a critical section holds every later retirement back.
+      test_reclaim_reset(&shared);
+      assert(get_epoch_domain_size(2) <= sizeof(storage));
+      init_epoch_domain(&shared.epochs, storage, 2, test_reclaim_proc, &shared);
+      epoch_thread* writer = join_epoch_domain(&shared.epochs);
+      epoch_thread* reader = join_epoch_domain(&shared.epochs);
+      assert(writer && reader && !join_epoch_domain(&shared.epochs));
+      enter_epoch(reader);
+      enter_epoch(reader);
+      exit_epoch(reader);
+      for(u32 i = 0; i < 4 * EPOCH_BATCH; ++i) retire_epoch(writer, &test_reclaim_take(&shared)->link);
+      assert(shared.reclaimed == 0);
+      exit_epoch(reader);
+      for(u32 i = 0; i < 4 * EPOCH_BATCH; ++i) retire_epoch(writer, &test_reclaim_take(&shared)->link);
+      assert(shared.reclaimed >= 4 * EPOCH_BATCH);
+      flush_epoch_domain(&shared.epochs);
+      assert(shared.reclaimed == 8 * EPOCH_BATCH);
+      leave_epoch_domain(reader);
+      assert(join_epoch_domain(&shared.epochs) == reader);
+      
+      // A published hazard keeps only its own node back.
+      test_reclaim_reset(&shared);
+      assert(get_hazard_domain_size(2) <= sizeof(storage));
+      init_hazard_domain(&shared.hazards, storage, 2, test_reclaim_proc, &shared);
+      hazard_thread* retirer = join_hazard_domain(&shared.hazards);
+      hazard_thread* holder = join_hazard_domain(&shared.hazards);
+      assert(retirer && holder && !join_hazard_domain(&shared.hazards));
+      test_reclaim_node* held = (test_reclaim_node*)protect_hazard(holder, 1, &shared.current);
+      assert(held == shared.current);
+      retire_hazard(retirer, &held->link);
+      u32 retired = 1;
+      for(; shared.reclaimed == 0; ++retired) retire_hazard(retirer, &test_reclaim_take(&shared)->link);
+      assert(!held->freed && (shared.reclaimed == retired - 1));
+      clear_hazard(holder, 1);
+      flush_hazard_domain(&shared.hazards);
+      assert(held->freed && (shared.reclaimed == retired));
+      
+      // Readers and writers racing, every node must come back exactly once.
+      for(u32 hazards = 0; hazards < 2; ++hazards) {
+            test_reclaim_reset(&shared);
+            shared.use_hazards = hazards;
+            shared.next = 0;
+            shared.failures = 0;
+            assert(get_hazard_domain_size(4) <= sizeof(storage) && get_epoch_domain_size(4) <= sizeof(storage));
+            if(hazards) init_hazard_domain(&shared.hazards, storage, 4, test_reclaim_proc, &shared);
+            else init_epoch_domain(&shared.epochs, storage, 4, test_reclaim_proc, &shared);
+            
+            thread threads[4];
+            for(u32 i = 0; i < countof(threads); ++i) assert(start_thread(&threads[i], test_reclaim_thread_proc, &shared));
+            for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+            assert(!shared.failures);
+            
+            if(hazards) flush_hazard_domain(&shared.hazards);
+            else flush_epoch_domain(&shared.epochs);
+            u32 pooled = 0;
+            for(u32 i = 0; i < TEST_RECLAIM_NODES; ++i) pooled += shared.nodes[i].freed;
+            assert(pooled == TEST_RECLAIM_NODES - 1 && !((test_reclaim_node*)shared.current)->freed);
+      }
+}
+
+#define TEST_SHARDED_ROUNDS 100000
+#define TEST_SHARDED_BINS   5
+
+struct test_sharded_shared {
+      sharded_counter counter;
+      sharded_min_max range;
+      sharded_histogram histogram;
+      volatile u32 next;
+};
+
+internal void test_sharded_proc(void* param) {
+      test_sharded_shared* shared = (test_sharded_shared*)param;
+      u32 index = atomic_fetch_add(&shared->next, 1u);
+      for(u32 i = 0; i < TEST_SHARDED_ROUNDS; ++i) {
+            add_sharded_counter(&shared->counter);
+            add_sharded_min_max(&shared->range, 1000 + index * TEST_SHARDED_ROUNDS + i);
+            add_sharded_histogram(&shared->histogram, i % TEST_SHARDED_BINS, 2);
+      }
+}
+
+internal void test_sharded(void) {
+      local_persist test_sharded_shared shared;
+      u32 shards = get_shard_count();
+      assert(shards >= get_processor_count() && is_pow2(shards));
+      
+      // More shards than processors leaves some idle, fewer makes processors share, both must add up.
+      u32 counts[] = {1, 8, shards};
+      for(u32 c = 0; c < countof(counts); ++c) {
+            alignas(CACHE_LINE) local_persist u8 counter_storage[64 * 64 + CACHE_LINE];
+            alignas(CACHE_LINE) local_persist u8 range_storage[64 * 64 + CACHE_LINE];
+            alignas(CACHE_LINE) local_persist u8 histogram_storage[64 * 64 + CACHE_LINE];
+            u32 count = min(counts[c], 64u);
+            assert(get_sharded_counter_size(count) <= sizeof(counter_storage));
+            assert(get_sharded_min_max_size(count) <= sizeof(range_storage));
+            assert(get_sharded_histogram_size(count, TEST_SHARDED_BINS) <= sizeof(histogram_storage));
+            init_sharded_counter(&shared.counter, counter_storage, count);
+            init_sharded_min_max(&shared.range, range_storage, count);
+            init_sharded_histogram(&shared.histogram, histogram_storage, count, TEST_SHARDED_BINS);
+            shared.next = 0;
+            
+            u64 min, max;
+            read_sharded_min_max(&shared.range, &min, &max);
+            assert(min == U64_MAX && max == 0 && read_sharded_counter(&shared.counter) == 0);
+            
+            thread threads[4];
+            for(u32 i = 0; i < countof(threads); ++i) assert(start_thread(&threads[i], test_sharded_proc, &shared));
+            for(u32 i = 0; i < countof(threads); ++i) join_thread(&threads[i]);
+            
+            u64 total = countof(threads) * TEST_SHARDED_ROUNDS;
+            assert(read_sharded_counter(&shared.counter) == total);
+            assert(take_sharded_counter(&shared.counter) == total);
+            assert(read_sharded_counter(&shared.counter) == 0);
+            
+            read_sharded_min_max(&shared.range, &min, &max);
+            assert(min == 1000 && max == 1000 + total - 1);
+            reset_sharded_min_max(&shared.range);
+            read_sharded_min_max(&shared.range, &min, &max);
+            assert(min == U64_MAX && max == 0);
+            
+            u64 bins[TEST_SHARDED_BINS];
+            read_sharded_histogram(&shared.histogram, bins);
+            for(u32 i = 0; i < TEST_SHARDED_BINS; ++i) assert(bins[i] == 2 * total / TEST_SHARDED_BINS);
+            take_sharded_histogram(&shared.histogram, bins);
+            assert(bins[0] == 2 * total / TEST_SHARDED_BINS);
+            read_sharded_histogram(&shared.histogram, bins);
+            for(u32 i = 0; i < TEST_SHARDED_BINS; ++i) assert(bins[i] == 0);
+      }
+}
+
+internal void test_sort(void) {
+      rng rn = {};
+      seed(&rn, 4321);
+      
+      local_persist sort_entry entries[20000];
+      local_persist u32 keys[SORT_NETWORK_MAX];
+      
+      for(u32 count = 0; count <= SORT_NETWORK_MAX; ++count) {
+            for(u32 i = 0; i < count; ++i) {
+                  keys[i] = (i & 1) ? U32_MAX : next_u32(&rn);
+                  entries[i] = {range_u32(&rn, 0, 8) * U32_MAX / 8, i};
+            }
+            
+            u64 checksum = sort_checksum(entries, count);
+            sort_network(keys, count);
+            sort_network(entries, count);
+            assert(are_sorted(keys, count));
+            assert(are_sorted(entries, count));
+            assert(sort_checksum(entries, count) == checksum);
+            for(u32 i = 1; i < count; ++i) {
+                  assert((entries[i - 1].key < entries[i].key) || (entries[i - 1].value < entries[i].value));
+            }
+      }
+      
+      u32 counts[] = {0, 1, 7, 8, 65, 127, 1000, 20000};
+      for(u32 c = 0; c < countof(counts); ++c) {
+            u32 count = counts[c];
+            for(u32 distribution = 0; distribution < 4; ++distribution) {
+                  for(u32 i = 0; i < count; ++i) {
+                        u32 key = next_u32(&rn);
+                        if(distribution == 1) key = range_u32(&rn, 0, 3);
+                        if(distribution == 2) key = i;
+                        if(distribution == 3) key = count - i;
+                        entries[i] = {key, i};
+                  }
+                  
+                  u64 checksum = sort_checksum(entries, count);
+                  sort_intro(entries, count);
+                  assert(are_sorted(entries, count));
+                  assert(sort_checksum(entries, count) == checksum);
+            }
+      }
+}
+
+internal void test_select(void) {
+      rng rn = {};
+      seed(&rn, 777);
+      
+      local_persist sort_entry entries[10000];
+      local_persist sort_entry sorted[10000];
+      local_persist sort_entry kept[200];
+      
+      u32 counts[] = {1, 50, 500, 10000};
+      for(u32 c = 0; c < countof(counts); ++c) {
+            u32 count = counts[c];
+            for(u32 distribution = 0; distribution < 2; ++distribution) {
+                  for(u32 i = 0; i < count; ++i) {
+                        sorted[i] = {distribution ? range_u32(&rn, 0, 5) : next_u32(&rn), i};
+                  }
+                  
+                  u32 nths[] = {0, count / 3, count - 1};
+                  for(u32 n = 0; n < countof(nths); ++n) {
+                        copy_array((sort_entry*)entries, sorted, count);
+                        select_nth(entries, count, nths[n]);
+                        for(u32 i = 0; i < count; ++i) {
+                              assert((i <= nths[n]) ? (entries[i].key <= entries[nths[n]].key) : (entries[i].key >= entries[nths[n]].key));
+                        }
+                  }
+                  
+                  u32 ks[] = {0, 1, 100, count};
+                  for(u32 n = 0; n < countof(ks); ++n) {
+                        u32 k = min(ks[n], count);
+                        copy_array((sort_entry*)entries, sorted, count);
+                        partial_sort_k(entries, count, k);
+                        assert(are_sorted(entries, k));
+                        for(u32 i = k; k && (i < count); ++i) {
+                              assert(entries[i].key >= entries[k - 1].key);
+                        }
+                  }
+                  
+                  copy_array((sort_entry*)entries, sorted, count);
+                  sort_intro(sorted, count);
+                  
+                  top_k smallest = {};
+                  top_k largest = {};
+                  init_top_k(&smallest, kept, 100);
+                  init_top_k(&largest, kept + 100, 100, true);
+                  for(u32 i = 0; i < count; i += 37) {
+                        push_top_k(&smallest, entries + i, min(37, count - i));
+                        push_top_k(&largest, entries + i, min(37, count - i));
+                  }
+                  
+                  u32 kept_count = finish_top_k(&smallest);
+                  assert(kept_count == min(100, count));
+                  assert(finish_top_k(&largest) == kept_count);
+                  for(u32 i = 0; i < kept_count; ++i) {
+                        assert(kept[i].key == sorted[i].key);
+                        assert(kept[100 + i].key == sorted[count - 1 - i].key);
+                  }
+            }
+      }
+}
+
+internal void test_permute(void) {
+      rng rn = {};
+      seed(&rn, 31);
+      
+      const u32 count = 5000;
+      local_persist u32 keys[count];
+      local_persist u32 ids[count];
+      local_persist v3 positions[count];
+      local_persist quat orientations[count];
+      local_persist r2 bounds[count];
+      local_persist u32 permutation[count];
+      local_persist sort_entry scratch[count * 2];
+      alignas(16) local_persist u8 buffer[count * sizeof(quat) * 2];
+      
+      // Small buffer: columns get split between gather passes and in place cycles.
+      sz buffer_sizes[] = {0, count * sizeof(quat), sizeof(buffer)};
+      for(u32 b = 0; b < countof(buffer_sizes); ++b) {
+            for(u32 i = 0; i < count; ++i) {
+                  keys[i] = range_u32(&rn, 0, 1000);
+                  ids[i] = keys[i];
+                  positions[i] = mk_v3((f32)keys[i]);
+                  orientations[i] = mk_v4((f32)keys[i]);
+                  bounds[i] = {mk_v2((f32)keys[i]), mk_v2((f32)i)};
+            }
+            
+            argsort(keys, count, permutation, scratch);
+            permute_column columns[] = {
+                  mk_permute_column(ids, sizeof_each(ids)),
+                  mk_permute_column(positions, sizeof_each(positions)),
+                  mk_permute_column(orientations, sizeof_each(orientations)),
+                  mk_permute_column(bounds, sizeof_each(bounds)),
+            };
+            
+            if(b) {
+                  permute(columns, countof(columns), permutation, count, buffer, buffer_sizes[b]);
+            } else {
+                  permute_in_place(columns, countof(columns), permutation, count);
+            }
+            
+            for(u32 i = 0; i < count; ++i) {
+                  assert(permutation[i] < count);
+                  assert(ids[i] == keys[permutation[i]]);
+                  assert((i == 0) || (ids[i - 1] <= ids[i]));
+                  assert(positions[i].z == (f32)ids[i]);
+                  assert(orientations[i].w == (f32)ids[i]);
+                  assert(bounds[i].a.x == (f32)ids[i]);
+                  assert(bounds[i].b.x == (f32)permutation[i]);
+            }
+      }
+      
+      // Narrow columns (an odd count of u16) leave the next held element and buffer slice off the word alignment.
+      const u32 mixed_count = 777;
+      local_persist u16 tags[mixed_count];
+      for(u32 b = 0; b < countof(buffer_sizes); ++b) {
+            for(u32 i = 0; i < mixed_count; ++i) {
+                  keys[i] = range_u32(&rn, 0, 1000);
+                  tags[i] = (u16)keys[i];
+                  ids[i] = keys[i];
+                  positions[i] = mk_v3((f32)keys[i]);
+            }
+            
+            argsort(keys, mixed_count, permutation, scratch);
+            permute_column columns[] = {
+                  mk_permute_column(tags, sizeof_each(tags)),
+                  mk_permute_column(ids, sizeof_each(ids)),
+                  mk_permute_column(positions, sizeof_each(positions)),
+            };
+            
+            if(b) {
+                  permute(columns, countof(columns), permutation, mixed_count, buffer, buffer_sizes[b]);
+            } else {
+                  permute_in_place(columns, countof(columns), permutation, mixed_count);
+            }
+            
+            for(u32 i = 0; i < mixed_count; ++i) {
+                  assert(tags[i] == keys[permutation[i]]);
+                  assert(ids[i] == tags[i]);
+                  assert(positions[i].x == (f32)tags[i]);
+            }
+      }
+}
+
+internal void test_search(void) {
+      rng rn = {};
+      seed(&rn, 1357);
+      
+      const u32 max_count = 3000;
+      local_persist sort_entry sorted[max_count];
+      alignas(64) local_persist u8 eytzinger_storage[(max_count + 1) * sizeof(sort_entry)];
+      alignas(64) local_persist u8 btree_storage[(max_count + STATIC_BTREE_KEYS) * sizeof(u32) * 2];
+      
+      u32 counts[] = {0, 1, 15, 16, 17, 300, max_count};
+      for(u32 c = 0; c < countof(counts); ++c) {
+            u32 count = counts[c];
+            for(u32 i = 0; i < count; ++i) {
+                  sorted[i] = {(i == count - 1) ? U32_MAX : range_u32(&rn, 0, 5000), i};
+            }
+            sort_intro(sorted, count);
+            
+            eytzinger e = {};
+            static_btree t = {};
+            assert(get_eytzinger_size(count) <= sizeof(eytzinger_storage));
+            assert(get_static_btree_size(count) <= sizeof(btree_storage));
+            build_eytzinger(&e, sorted, count, eytzinger_storage);
+            build_static_btree(&t, sorted, count, btree_storage);
+            
+            for(u32 probe = 0; probe < 2000; ++probe) {
+                  u32 key = (probe == 0) ? U32_MAX : (probe == 1) ? 0 : range_u32(&rn, 0, 5100);
+                  u32 expected = 0;
+                  while((expected < count) && (sorted[expected].key < key)) expected++;
+                  
+                  assert(lower_bound(sorted, count, key) == expected);
+                  assert(lower_bound(&e, key) == expected);
+                  assert(lower_bound(&t, key) == expected);
+                  
+                  u32 maximum = (probe == 0) ? U32_MAX : key + range_u32(&rn, 0, 100);
+                  u32 last = expected;
+                  while((last < count) && (sorted[last].key <= maximum)) last++;
+                  
+                  u32 first = 0;
+                  assert(range_query(sorted, count, key, maximum, &first) == last - expected && first == expected);
+                  assert(range_query(&e, key, maximum, &first) == last - expected && first == expected);
+                  assert(range_query(&t, key, maximum, &first) == last - expected && first == expected);
+            }
+      }
+}
+
+internal void test_sort_external(void) {
+      rng rn = {};
+      seed(&rn, 99);
+      
+      local_persist sort_entry entries[50000];
+      local_persist u8 memory[mb(2)];
+      char src_path[] = "sort_external_src.bin";
+      char dst_path[] = "sort_external_dst.bin";
+      char temp_path[] = "sort_external_temp.bin";
+      
+      for(u32 i = 0; i < countof(entries); ++i) {
+            entries[i] = {range_u32(&rn, 0, 1000), i};
+      }
+      
+      file f = {};
+      assert(open_file(&f, src_path, FILE_MODE_WRITE));
+      assert(write_file(&f, entries, sizeof(entries), 0) == sizeof(entries));
+      close_file(&f);
+      
+      // Tiny memory forces several merge passes, large memory a single run.
+      sz memory_sizes[] = {SORT_EXTERNAL_MIN_MEMORY, sizeof(memory)};
+      for(u32 i = 0; i < countof(memory_sizes); ++i) {
+            assert(sort_external(src_path, dst_path, temp_path, memory, memory_sizes[i]));
+            
+            assert(open_file(&f, dst_path, FILE_MODE_READ));
+            assert(get_file_size(&f) == sizeof(entries));
+            assert(read_file(&f, entries, sizeof(entries), 0) == sizeof(entries));
+            close_file(&f);
+            
+            assert(are_sorted(entries, countof(entries)));
+            for(u32 j = 1; j < countof(entries); ++j) {
+                  assert((entries[j - 1].key < entries[j].key) || (entries[j - 1].value < entries[j].value));
+            }
+      }
+      
+      remove(src_path);
+      remove(dst_path);
+      remove(temp_path);
+}
+
 entry_point int main(int argc, char** argv) {
       test_rng();
+      test_rng_bounded();
+      test_rng_floats();
+      test_rng_distributions();
+      test_rng_counter();
+      test_rng_sampling();
+      test_rng_geometry();
+      test_rng_streams();
+      test_rng_fill();
+      test_bits();
+      test_endian();
+      test_atomics();
+      test_spsc_ring();
+      test_mpmc_queue();
+      test_jobs();
+      test_parallel();
+      test_stacks();
+      test_reclaim();
+      test_locks();
+      test_sharded();
+      test_sort();
+      test_select();
+      test_permute();
+      test_search();
+      test_sort_external();
       
       f32 c0 = cos(0.0f);
       f32 c1 = cos(1.0f);